@@ -0,0 +1,168 @@
+"""Throughput and latency of ring_buffer.Buffer from Python, next to collections.deque,
+multiprocessing.Queue and os.pipe carrying the same messages.
+
+    PYTHONPATH=.. python bench.py [messages]
+
+Every message starts with the time it was written, so the reader can tell how long it
+took to come out; the latency includes any queueing in a full buffer.
+"""
+import collections
+import multiprocessing
+import os
+import struct
+import sys
+import threading
+import time
+
+import ring_buffer
+
+clock = getattr(time, 'perf_counter', time.time)
+STAMP = struct.Struct('d')
+SIZES = (64, 1024, 16384)
+
+
+def make_message(size):
+    return STAMP.pack(clock()) + b'x' * (size - STAMP.size)
+
+
+def latency_ns(message):
+    return int((clock() - STAMP.unpack_from(message)[0]) * 1e9)
+
+
+def run_in_thread(target, *args):
+    thread = threading.Thread(target=target, args=args)
+    thread.start()
+    return thread.join
+
+
+def run_in_process(target, *args):
+    pid = os.fork()
+    if pid == 0:
+        try:
+            target(*args)
+        finally:
+            os._exit(0)
+    return lambda: os.waitpid(pid, 0)
+
+
+def buffer_single(size, count):
+    buf = ring_buffer.Buffer(order=20)
+    latencies = []
+    for i in range(count):
+        buf.write(make_message(size))
+        latencies.append(latency_ns(buf.read(size)))
+    return latencies
+
+
+def buffer_pair(spawn, size, count):
+    if spawn is run_in_process:
+        name = '/ring_buffer_bench_%d' % os.getpid()
+        buf = ring_buffer.Buffer.create_shared(name, order=20)
+        ring_buffer.unlink_shared(name)
+    else:
+        buf = ring_buffer.Buffer(order=20)
+
+    def produce():
+        for i in range(count):
+            buf.write(make_message(size), timeout=None)
+
+    join = spawn(produce)
+    latencies = [latency_ns(buf.read(size, timeout=None)) for i in range(count)]
+    join()
+    return latencies
+
+
+def deque_single(size, count):
+    queue = collections.deque()
+    latencies = []
+    for i in range(count):
+        queue.append(make_message(size))
+        latencies.append(latency_ns(queue.popleft()))
+    return latencies
+
+
+def deque_threads(size, count):
+    queue = collections.deque()
+
+    def produce():
+        for i in range(count):
+            queue.append(make_message(size))
+
+    join = run_in_thread(produce)
+    latencies = []
+    while len(latencies) < count:
+        try:
+            latencies.append(latency_ns(queue.popleft()))
+        except IndexError:
+            time.sleep(0)
+    join()
+    return latencies
+
+
+def mp_queue_process(size, count):
+    # produce() is a closure, so the child has to be forked rather than spawned
+    context = multiprocessing.get_context('fork') if hasattr(multiprocessing, 'get_context') else multiprocessing
+    queue = context.Queue(maxsize=1024)
+
+    def produce():
+        for i in range(count):
+            queue.put(make_message(size))
+
+    process = context.Process(target=produce)
+    process.start()
+    latencies = [latency_ns(queue.get()) for i in range(count)]
+    process.join()
+    return latencies
+
+
+def pipe_pair(spawn, size, count):
+    read_fd, write_fd = os.pipe()
+
+    def produce():
+        for i in range(count):
+            message = make_message(size)
+            while message:
+                message = message[os.write(write_fd, message):]
+
+    join = spawn(produce)
+    latencies = []
+    for i in range(count):
+        message = b''
+        while len(message) < size:
+            message += os.read(read_fd, size - len(message))
+        latencies.append(latency_ns(message))
+    join()
+    os.close(read_fd)
+    os.close(write_fd)
+    return latencies
+
+
+BENCHMARKS = (
+    ('Buffer', 'single', buffer_single),
+    ('Buffer', 'threads', lambda size, count: buffer_pair(run_in_thread, size, count)),
+    ('Buffer', 'process', lambda size, count: buffer_pair(run_in_process, size, count)),
+    ('deque', 'single', deque_single),
+    ('deque', 'threads', deque_threads),
+    ('mp.Queue', 'process', mp_queue_process),
+    ('pipe', 'threads', lambda size, count: pipe_pair(run_in_thread, size, count)),
+    ('pipe', 'process', lambda size, count: pipe_pair(run_in_process, size, count)),
+)
+
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 20000
+    print('%-10s %-8s %8s %10s %12s %10s %10s %10s' % (
+        'transport', 'mode', 'bytes', 'GB/s', 'msgs/s', 'p50 ns', 'p99 ns', 'p999 ns'))
+    for transport, mode, benchmark in BENCHMARKS:
+        for size in SIZES:
+            start = clock()
+            latencies = sorted(benchmark(size, count))
+            seconds = clock() - start
+            print('%-10s %-8s %8d %10.3f %12.0f %10d %10d %10d' % (
+                transport, mode, size, size * count / seconds / 1e9, count / seconds,
+                latencies[count // 2], latencies[count * 99 // 100], latencies[count * 999 // 1000]))
+            sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,306 @@
+/* Throughput and latency of the ring buffer across message sizes, buffer orders and
+ * modes, against a plain memcpy and a pipe(2) carrying the same messages.
+ *
+ *     ./bench_buffer [messages]
+ *
+ * Every message starts with the CLOCK_MONOTONIC time it was written, so the reader can
+ * tell how long it took to come out; the latency includes any queueing in a full buffer.
+ */
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "../src/buffer.h"
+
+struct run
+{
+    const char *mode;
+    unsigned long order;
+    unsigned long message_bytes;
+    unsigned long messages;
+    struct ring_buffer *buffer;
+    int pipe_fds[2];
+    unsigned long *latencies_ns; // one per message, filled by the reader
+    double seconds;
+};
+
+static unsigned long
+now_ns (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+static void
+put_message (char *address, unsigned long message_bytes)
+{
+    unsigned long stamp = now_ns ();
+
+    memcpy (address, &stamp, sizeof stamp);
+    memset (address + sizeof stamp, 'x', message_bytes - sizeof stamp);
+}
+
+static unsigned long
+message_latency (const char *address)
+{
+    unsigned long stamp;
+
+    memcpy (&stamp, address, sizeof stamp);
+    return now_ns () - stamp;
+}
+
+static void
+buffer_write_messages (struct run *run)
+{
+    struct ring_buffer *buffer = run->buffer;
+    unsigned long i;
+
+    for (i=0; i<run->messages; i++) {
+        while (ring_buffer_producer_free_bytes (buffer, run->message_bytes) < run->message_bytes)
+            sched_yield ();
+        put_message (ring_buffer_write_address (buffer), run->message_bytes);
+        ring_buffer_write_advance (buffer, run->message_bytes);
+    }
+}
+
+static void
+buffer_read_messages (struct run *run)
+{
+    struct ring_buffer *buffer = run->buffer;
+    char *message = malloc (run->message_bytes);
+    unsigned long i;
+
+    for (i=0; i<run->messages; i++) {
+        while (ring_buffer_consumer_count_bytes (buffer, run->message_bytes) < run->message_bytes)
+            sched_yield ();
+        memcpy (message, ring_buffer_read_address (buffer), run->message_bytes);
+        ring_buffer_read_advance (buffer, run->message_bytes);
+        run->latencies_ns[i] = message_latency (message);
+    }
+    free (message);
+}
+
+static void
+pipe_write_messages (struct run *run)
+{
+    char *message = malloc (run->message_bytes);
+    unsigned long i, written;
+    ssize_t status;
+
+    for (i=0; i<run->messages; i++) {
+        put_message (message, run->message_bytes);
+        for (written=0; written<run->message_bytes; written+=status) {
+            status = write (run->pipe_fds[1], message + written, run->message_bytes - written);
+            if (status < 0) {
+                perror ("write");
+                exit (1);
+            }
+        }
+    }
+    free (message);
+}
+
+static void
+pipe_read_messages (struct run *run)
+{
+    char *message = malloc (run->message_bytes);
+    unsigned long i, received;
+    ssize_t status;
+
+    for (i=0; i<run->messages; i++) {
+        for (received=0; received<run->message_bytes; received+=status) {
+            status = read (run->pipe_fds[0], message + received, run->message_bytes - received);
+            if (status <= 0) {
+                perror ("read");
+                exit (1);
+            }
+        }
+        run->latencies_ns[i] = message_latency (message);
+    }
+    free (message);
+}
+
+static void *
+writer_thread (void *arg)
+{
+    struct run *run = arg;
+
+    if (run->buffer)
+        buffer_write_messages (run);
+    else
+        pipe_write_messages (run);
+    return NULL;
+}
+
+/* Write and read one message at a time in this thread */
+static void
+run_single (struct run *run)
+{
+    struct ring_buffer *buffer = run->buffer;
+    char *message = malloc (run->message_bytes);
+    unsigned long i;
+
+    for (i=0; i<run->messages; i++) {
+        put_message (ring_buffer_write_address (buffer), run->message_bytes);
+        ring_buffer_write_advance (buffer, run->message_bytes);
+        memcpy (message, ring_buffer_read_address (buffer), run->message_bytes);
+        ring_buffer_read_advance (buffer, run->message_bytes);
+        run->latencies_ns[i] = message_latency (message);
+    }
+    free (message);
+}
+
+/* The same copies with no buffer in between: the floor for run_single */
+static void
+run_memcpy (struct run *run)
+{
+    char *source = malloc (run->message_bytes), *message = malloc (run->message_bytes);
+    unsigned long i;
+
+    for (i=0; i<run->messages; i++) {
+        put_message (source, run->message_bytes);
+        memcpy (message, source, run->message_bytes);
+        run->latencies_ns[i] = message_latency (message);
+    }
+    free (source);
+    free (message);
+}
+
+static void
+run_threads (struct run *run)
+{
+    pthread_t writer;
+
+    pthread_create (&writer, NULL, writer_thread, run);
+    if (run->buffer)
+        buffer_read_messages (run);
+    else
+        pipe_read_messages (run);
+    pthread_join (writer, NULL);
+}
+
+static void
+run_processes (struct run *run)
+{
+    pid_t pid = fork ();
+
+    if (pid == 0) {
+        writer_thread (run);
+        _exit (0);
+    }
+    if (run->buffer)
+        buffer_read_messages (run);
+    else
+        pipe_read_messages (run);
+    waitpid (pid, NULL, 0);
+}
+
+static int
+compare_ns (const void *a, const void *b)
+{
+    unsigned long x = *(const unsigned long *)a, y = *(const unsigned long *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void
+report (struct run *run)
+{
+    unsigned long n = run->messages;
+
+    qsort (run->latencies_ns, n, sizeof *run->latencies_ns, compare_ns);
+    printf ("%-16s %6lu %8lu %10.3f %12.0f %10lu %10lu %10lu\n",
+            run->mode, run->order, run->message_bytes,
+            run->message_bytes * n / run->seconds / 1e9, n / run->seconds,
+            run->latencies_ns[n / 2], run->latencies_ns[n * 99 / 100], run->latencies_ns[n * 999 / 1000]);
+    fflush (stdout);
+}
+
+static void
+bench (const char *mode, unsigned long order, unsigned long message_bytes, unsigned long messages)
+{
+    struct run run = { mode, order, message_bytes, messages, NULL, { -1, -1 }, NULL, 0 };
+    char name[64];
+    unsigned long start_ns;
+    int is_pipe = strncmp (mode, "pipe", 4) == 0;
+    int is_process = strstr (mode, "process") != NULL;
+
+    if (message_bytes > (1UL << order))
+        return;
+
+    /* the reader of a cross-process run fills these in the parent, so no sharing needed */
+    run.latencies_ns = malloc (messages * sizeof *run.latencies_ns);
+    run.buffer = NULL;
+    if (is_pipe) {
+        if (pipe (run.pipe_fds)) {
+            perror ("pipe");
+            exit (1);
+        }
+    } else if (strcmp (mode, "memcpy") != 0) {
+        if (posix_memalign ((void **)&run.buffer, RING_BUFFER_CACHE_LINE_BYTES, sizeof *run.buffer))
+            exit (1);
+        snprintf (name, sizeof name, "/ring_buffer_bench_%d", (int)getpid ());
+        if (is_process) {
+            if (ring_buffer_create_shared (run.buffer, name, order)) {
+                perror ("ring_buffer_create_shared");
+                exit (1);
+            }
+            ring_buffer_unlink (name);
+        } else {
+            ring_buffer_create (run.buffer, order);
+        }
+    }
+
+    start_ns = now_ns ();
+    if (strcmp (mode, "memcpy") == 0)
+        run_memcpy (&run);
+    else if (strcmp (mode, "single") == 0)
+        run_single (&run);
+    else if (is_process)
+        run_processes (&run);
+    else
+        run_threads (&run);
+    run.seconds = (now_ns () - start_ns) / 1e9;
+
+    report (&run);
+
+    if (run.buffer) {
+        ring_buffer_free (run.buffer);
+        free (run.buffer);
+    }
+    if (is_pipe) {
+        close (run.pipe_fds[0]);
+        close (run.pipe_fds[1]);
+    }
+    free (run.latencies_ns);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *modes[] = { "memcpy", "single", "threads", "process", "pipe-threads", "pipe-process" };
+    static const unsigned long orders[] = { 16, 20 };
+    static const unsigned long sizes[] = { 64, 1024, 16384, 262144 };
+    unsigned long messages = argc > 1 ? strtoul (argv[1], NULL, 10) : 100000;
+    unsigned long m, o, s;
+
+    printf ("%-16s %6s %8s %10s %12s %10s %10s %10s\n",
+            "mode", "order", "bytes", "GB/s", "msgs/s", "p50 ns", "p99 ns", "p999 ns");
+    for (m=0; m<sizeof modes / sizeof *modes; m++)
+        for (o=0; o<sizeof orders / sizeof *orders; o++)
+            for (s=0; s<sizeof sizes / sizeof *sizes; s++) {
+                // the baselines do not depend on the order, run them once
+                if (o > 0 && (strcmp (modes[m], "memcpy") == 0 || strncmp (modes[m], "pipe", 4) == 0))
+                    continue;
+                bench (modes[m], orders[o], sizes[s], sizes[s] > 16384 ? messages / 20 + 1 : messages);
+            }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+"""asyncio front end for ring_buffer.Buffer.
+
+The reader registers the buffer's readable eventfd with the event loop, so a
+coroutine waiting for data costs nothing until the writer crosses the buffer's
+readable_mark. The eventfd is signalled by writes made in this process, so the
+writer has to be another thread (or the event loop itself).
+"""
+import asyncio
+import os
+
+
+class BufferReader(object):
+    """A StreamReader-like view of the read side of a ring_buffer.Buffer."""
+
+    def __init__(self, buffer, loop=None):
+        self._buffer = buffer
+        self._loop = loop or asyncio.get_event_loop()
+        self._fd = buffer.readable_fileno()
+        self._waiter = None
+        self._loop.add_reader(self._fd, self._on_readable)
+
+    def _on_readable(self):
+        try:
+            os.read(self._fd, 8)
+        except BlockingIOError:
+            pass
+        if self._waiter is not None and not self._waiter.done():
+            self._waiter.set_result(None)
+
+    async def _wait_for(self, count_bytes):
+        """Wait until count_bytes are readable or the writer closed."""
+        # Move the mark before looking at the buffer, so a write racing with the
+        # check below either is seen by it or signals the eventfd.
+        self._buffer.readable_mark = max(count_bytes, 1)
+        while len(self._buffer) < count_bytes and not self._buffer.writer_closed:
+            self._waiter = self._loop.create_future()
+            try:
+                await self._waiter
+            finally:
+                self._waiter = None
+
+    async def read(self, n=-1):
+        """Read up to n bytes, waiting for at least one. Return b'' at end of file."""
+        await self._wait_for(1)
+        count_bytes = len(self._buffer)
+        if n >= 0:
+            count_bytes = min(n, count_bytes)
+        if count_bytes == 0:
+            return b''
+        return self._buffer.read(count_bytes)
+
+    async def readexactly(self, n):
+        """Read exactly n bytes, raising asyncio.IncompleteReadError at end of file."""
+        await self._wait_for(n)
+        if len(self._buffer) < n:
+            partial = self._buffer.read(len(self._buffer)) if len(self._buffer) else b''
+            raise asyncio.IncompleteReadError(partial, n)
+        return self._buffer.read(n)
+
+    def at_eof(self):
+        return self._buffer.writer_closed and len(self._buffer) == 0
+
+    def close(self):
+        self._loop.remove_reader(self._fd)
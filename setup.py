@@ -1,11 +1,11 @@
 from setuptools import (
+    Extension,
     setup,
     find_packages,
 )
-from distutils.core import Extension
 
 buffer_m = Extension('ring_buffer',
-                     sources = ['type_extension.c', 'src/buffer.c'],
+                     sources = ['type_extension.c', 'src/buffer.c', 'src/mpmc.c', 'src/uring.c'],
                      include_dirs = ['src/'],
                      extra_compile_args = ['-g'],
                     )
@@ -16,14 +16,14 @@ setup(name = 'ring_buffer',
       C Implementation: http://en.wikipedia.org/wiki/Ring_buffer.''',
       classifiers = [
           "Programming Language :: Python :: C",
+          "Programming Language :: Python :: 3",
       ],
+      python_requires='>=3.7',
       author = 'Xiaonuo Gantan',
       author_email = 'xiaonuo.gantan@gmail.com',
       keywords='python c extension circular buffer mmap',
       packages=find_packages('.'),
+      py_modules=['ring_buffer_asyncio'],
       include_package_data=True,
       ext_modules = [buffer_m],
-      install_requires = [
-          'nose',
-      ],
      )
@@ -1,69 +1,518 @@
-#ifndef _BSD_SOURCE
-# define _BSD_SOURCE 1
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE 1 // memfd_create
 #endif
 
+#include <linux/futex.h>
+#include <linux/memfd.h>
+#include <linux/mempolicy.h>
+#include <sys/eventfd.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 #include "buffer.h"
 
+/* The producer publishes data with a release store of write_offset_bytes and the consumer
+ * observes it with an acquire load, and vice versa for read_offset_bytes.
+ */
+#define load_relaxed(p) __atomic_load_n ((p), __ATOMIC_RELAXED)
+#define load_acquire(p) __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
 
-/* Construct a ring_buffer by passing a reference to the zero-filled initialized *buffer pointer
- * @buffer: the zero-filled ring_buffer pointer
- * @order: size of the buffer in log2, which has to be at least 12 on linux
+/* The futex words may be shared between processes, so no FUTEX_PRIVATE_FLAG */
+static int
+futex_wait (unsigned int *futex, unsigned int value, const struct timespec *timeout)
+{
+    return syscall (SYS_futex, futex, FUTEX_WAIT, value, timeout, NULL, 0);
+}
+
+/* Wake every sleeper on @futex if @waiters says there is one. The full fence orders the
+ * offset store the caller just made before the load of @waiters; the sleeper does the
+ * mirror image, so either it sees the new offset or we see it waiting.
  */
-void
-ring_buffer_create(struct ring_buffer *buffer, unsigned long order)
+static void
+futex_wake_waiters (unsigned int *futex, unsigned int *waiters)
 {
-    int fd;
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (load_relaxed (waiters) == 0)
+        return;
+
+    __atomic_add_fetch (futex, 1, __ATOMIC_RELEASE);
+    syscall (SYS_futex, futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static unsigned long
+monotonic_ns (void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/* Map the buffer: one system page of header from @header_fd at offset 0, directly
+ * followed by the @count_bytes data pages of @data_fd at @data_offset, twice back to back.
+ * @page_size: size of the data pages; the data address is aligned to it and the region
+ * in front of the data is this big, so that huge pages can be mapped there
+ * Return 0 on success, -1 with errno set on failure.
+ */
+static int
+ring_buffer_map (struct ring_buffer *buffer, int header_fd, int data_fd, off_t data_offset,
+                 unsigned long count_bytes, long page_size)
+{
+    long system_page_size = sysconf(_SC_PAGESIZE);
+    unsigned long mapping_bytes = page_size + (count_bytes << 1);
+    unsigned long slack_bytes = page_size - system_page_size;
+    unsigned long leading_bytes;
+    void *reservation;
+    void *base;
     void *address;
-    int status;
 
-    fd = open("/dev/zero", O_RDWR);
-    if (fd < 0)
-        terminate_and_generate_core_dump();
+    buffer->count_bytes = count_bytes;
+    buffer->page_size = page_size;
+    buffer->cached_read_offset_bytes = 0;
+    buffer->cached_write_offset_bytes = 0;
+    buffer->readable_fd = -1;
+    buffer->readable_mark_bytes = 1;
+    buffer->writable_fd = -1;
+    buffer->writable_mark_bytes = 1;
+    buffer->scan_delimiter_bytes = 0;
+    buffer->latency = NULL;
+    buffer->file_fd = -1;
+    buffer->resizable = 0;
+    buffer->io_in_flight = 0;
+    buffer->sync_policy = RING_BUFFER_SYNC_NONE;
+    buffer->sync_interval_ns = 0;
+    buffer->last_sync_ns = 0;
+    memset (&buffer->producer_stats, 0, sizeof buffer->producer_stats);
+    memset (&buffer->consumer_stats, 0, sizeof buffer->consumer_stats);
 
-    buffer->count_bytes = (1UL << order);
-    buffer->write_offset_bytes = 0;
-    buffer->read_offset_bytes = 0;
-    buffer->end_offset_bytes = 0;
-    buffer->page_size = sysconf(_SC_PAGESIZE);
+    /* reserve enough to place the data on a @page_size boundary, then give the slack back */
+    reservation = mmap (NULL, mapping_bytes + slack_bytes, PROT_NONE,
+                        MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (reservation == MAP_FAILED)
+        return -1;
 
-    //status = ftruncate(fd, buffer->count_bytes); // Truncate the fd into buffer->count_bytes
-    //if (status)
-    //    terminate_and_generate_core_dump();
+    base = (void *)(((unsigned long)reservation + page_size - 1) & ~(page_size - 1UL));
+    leading_bytes = base - reservation;
+    if (leading_bytes)
+        munmap (reservation, leading_bytes);
+    if (slack_bytes > leading_bytes)
+        munmap (base + mapping_bytes, slack_bytes - leading_bytes);
 
-    buffer->address = mmap (NULL, buffer->count_bytes << 1, PROT_NONE,
-                            MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    if (buffer->address == MAP_FAILED)
-        terminate_and_generate_core_dump();
+    buffer->address = base + page_size;
+    buffer->header = mmap (buffer->address - system_page_size, system_page_size, PROT_READ | PROT_WRITE,
+                           MAP_FIXED | MAP_SHARED, header_fd, 0);
+    if (buffer->header != buffer->address - system_page_size)
+        goto fail;
 
     /* Notice how this mmap call and the next mmap call map two physical memory pieces 
-     * to the same file descriptor @fd with the same offset 0. This is why when the
+     * to the same file descriptor @data_fd with the same offset. This is why when the
      * write pointer advances beyond the buffer->count_bytes, the next write call will
-     * start automatically from the beginning of the @fd.
+     * start automatically from the beginning of the data.
      */
     address = mmap (buffer->address, buffer->count_bytes, PROT_READ | PROT_WRITE,
-                    MAP_FIXED | MAP_SHARED, fd, 0);
+                    MAP_FIXED | MAP_SHARED, data_fd, data_offset);
 
     if (address != buffer->address)
-        terminate_and_generate_core_dump();
+        goto fail;
 
     address = mmap (buffer->address + buffer->count_bytes,
                     buffer->count_bytes, PROT_READ | PROT_WRITE,
-                    MAP_FIXED | MAP_SHARED, fd, 0);
+                    MAP_FIXED | MAP_SHARED, data_fd, data_offset);
 
     if (address != buffer->address + buffer->count_bytes)
+        goto fail;
+
+    return 0;
+
+fail:
+    munmap (base, mapping_bytes);
+    buffer->address = NULL;
+    buffer->header = NULL;
+    return -1;
+}
+
+/* Size the objects for a buffer of 2^@order data bytes, map them and initialize the
+ * header. When @header_fd is @data_fd the header takes the first system page of it.
+ */
+static int
+ring_buffer_init (struct ring_buffer *buffer, int header_fd, int data_fd, unsigned long order,
+                  long page_size)
+{
+    unsigned long count_bytes = (1UL << order);
+    long system_page_size = sysconf(_SC_PAGESIZE);
+    off_t data_offset = 0;
+
+    if (header_fd == data_fd)
+        data_offset = system_page_size;
+    else if (ftruncate(header_fd, system_page_size))
+        return -1;
+
+    if (ftruncate(data_fd, data_offset + count_bytes)) // Truncate the fd into header + data
+        return -1;
+
+    if (ring_buffer_map (buffer, header_fd, data_fd, data_offset, count_bytes, page_size))
+        return -1;
+
+    buffer->header->count_bytes = count_bytes;
+    buffer->header->write_offset_bytes = 0;
+    buffer->header->read_offset_bytes = 0;
+    buffer->header->end_offset_bytes = 0;
+    buffer->header->write_closed = 0;
+    buffer->header->overwrite = 0;
+    buffer->header->dropped_bytes = 0;
+    buffer->header->dropped_records = 0;
+    store_release (&buffer->header->magic, RING_BUFFER_MAGIC);
+
+    return 0;
+}
+
+/* Try to back the data with a hugetlb memfd of @huge_page_bytes pages. The header cannot
+ * share a hugetlb object without wasting a whole huge page, so it gets its own memfd.
+ */
+static int
+ring_buffer_init_huge (struct ring_buffer *buffer, unsigned long order, unsigned long huge_page_bytes)
+{
+    int header_fd, data_fd, status = -1;
+    int huge_page_order = __builtin_ctzl (huge_page_bytes);
+
+    if (huge_page_bytes & (huge_page_bytes - 1) || order < (unsigned long)huge_page_order)
+        return -1;
+
+    data_fd = memfd_create ("ring_buffer", MFD_CLOEXEC | MFD_HUGETLB | (huge_page_order << MFD_HUGE_SHIFT));
+    if (data_fd < 0)
+        return -1;
+    header_fd = memfd_create ("ring_buffer_header", MFD_CLOEXEC);
+    if (header_fd >= 0)
+    {
+        status = ring_buffer_init (buffer, header_fd, data_fd, order, huge_page_bytes);
+        close (header_fd);
+    }
+    close (data_fd);
+
+    return status;
+}
+
+/* Write to every page of both halves so the hot path takes no page faults. The buffer is
+ * empty, so the zeros written do not matter.
+ */
+static void
+ring_buffer_prefault (struct ring_buffer *buffer)
+{
+    volatile char *address = buffer->address;
+    unsigned long offset;
+
+    for (offset = 0; offset < buffer->count_bytes << 1; offset += buffer->page_size)
+        address[offset] = 0;
+}
+
+/* Construct a ring_buffer as ring_buffer_create does, honouring @options. Huge pages fall
+ * back to normal pages when the kernel has none to give or @order is smaller than one
+ * huge page; buffer->page_size tells which one was used. Return 0 on success, -1 with
+ * errno set on failure.
+ */
+int
+ring_buffer_create_with_options (struct ring_buffer *buffer, unsigned long order,
+                                 const struct ring_buffer_options *options)
+{
+    int fd;
+    int status;
+    unsigned long node_mask[RING_BUFFER_MAX_NUMA_NODES / (8 * sizeof (unsigned long))] = { 0 };
+
+    if (options->huge_page_bytes == 0 || ring_buffer_init_huge (buffer, order, options->huge_page_bytes))
+    {
+        /* /dev/zero mapped MAP_SHARED gives every mmap call its own shmem object, so the two
+         * halves would not mirror each other. A memfd is one object that both halves share.
+         */
+        fd = memfd_create ("ring_buffer", MFD_CLOEXEC);
+        if (fd < 0)
+            return -1;
+
+        status = ring_buffer_init (buffer, fd, fd, order, sysconf(_SC_PAGESIZE));
+        close (fd); // already has a mmap-ed ring_buffer pointer *address, do not need fd anymore
+        if (status)
+            return -1;
+        buffer->resizable = 1;
+    }
+
+    /* bind before the first touch, which is when the pages get allocated */
+    if (options->numa_node >= 0)
+    {
+        if (options->numa_node >= RING_BUFFER_MAX_NUMA_NODES)
+        {
+            errno = EINVAL;
+            goto fail;
+        }
+        node_mask[options->numa_node / (8 * sizeof (unsigned long))] |= 1UL << (options->numa_node % (8 * sizeof (unsigned long)));
+        if (syscall (SYS_mbind, buffer->address, buffer->count_bytes << 1, MPOL_PREFERRED,
+                     node_mask, RING_BUFFER_MAX_NUMA_NODES, 0))
+            goto fail;
+    }
+
+    if (options->populate)
+        ring_buffer_prefault (buffer);
+
+    if (options->lock && mlock (buffer->address, buffer->count_bytes << 1))
+        goto fail;
+
+    return 0;
+
+fail:
+    status = errno;
+    ring_buffer_free (buffer);
+    errno = status;
+    return -1;
+}
+
+/* Construct a ring_buffer by passing a reference to the zero-filled initialized *buffer pointer
+ * @buffer: the zero-filled ring_buffer pointer
+ * @order: size of the buffer in log2, which has to be at least 12 on linux
+ */
+void
+ring_buffer_create(struct ring_buffer *buffer, unsigned long order)
+{
+    struct ring_buffer_options options = RING_BUFFER_DEFAULT_OPTIONS;
+
+    if (ring_buffer_create_with_options (buffer, order, &options))
         terminate_and_generate_core_dump();
+}
+
+/* Create the POSIX shared memory object @name (e.g. "/capture") holding a new, empty
+ * buffer of 2^@order bytes and map it. Fails with EEXIST if @name already exists.
+ * The name stays until ring_buffer_unlink, so other processes can ring_buffer_attach.
+ */
+int
+ring_buffer_create_shared (struct ring_buffer *buffer, const char *name, unsigned long order)
+{
+    int fd;
+    int saved_errno;
+
+    fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+        return -1;
+
+    if (ring_buffer_init (buffer, fd, fd, order, sysconf(_SC_PAGESIZE)))
+    {
+        saved_errno = errno;
+        shm_unlink (name);
+        close (fd);
+        errno = saved_errno;
+        return -1;
+    }
+
+    close (fd);
+    return 0;
+}
+
+/* Map the initialized buffer in @fd, a shared memory object or a file holding the header
+ * page and then the data. Fails with EINVAL if @fd does not hold one.
+ */
+static int
+ring_buffer_map_fd (struct ring_buffer *buffer, int fd)
+{
+    struct stat st;
+    unsigned long count_bytes;
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    if (fstat (fd, &st))
+        return -1;
+
+    count_bytes = st.st_size - page_size;
+    if (st.st_size <= page_size || (count_bytes & (count_bytes - 1)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
 
-    status = close (fd); // already has a mmap-ed ring_buffer pointer *address, do not need fd anymore
+    if (ring_buffer_map (buffer, fd, fd, page_size, count_bytes, page_size))
+        return -1;
+
+    if (load_acquire (&buffer->header->magic) != RING_BUFFER_MAGIC
+        || buffer->header->count_bytes != count_bytes)
+    {
+        ring_buffer_free (buffer);
+        errno = EINVAL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Map the buffer that another process created with ring_buffer_create_shared (@name).
+ * Fails with EINVAL if @name does not hold an initialized ring buffer.
+ */
+int
+ring_buffer_attach (struct ring_buffer *buffer, const char *name)
+{
+    int fd;
+
+    fd = shm_open (name, O_RDWR, 0);
+    if (fd < 0)
+        return -1;
+
+    if (ring_buffer_map_fd (buffer, fd))
+    {
+        close (fd);
+        return -1;
+    }
+
+    close (fd);
+    return 0;
+}
+
+int
+ring_buffer_resize (struct ring_buffer *buffer, unsigned long order)
+{
+    struct ring_buffer_header *header = buffer->header;
+    struct ring_buffer resized;
+    unsigned long count_bytes;
+    unsigned long read_offset_bytes = header->read_offset_bytes;
+    unsigned long readable_bytes = header->write_offset_bytes - read_offset_bytes;
+    long page_size = sysconf(_SC_PAGESIZE);
+    int fd, i, status;
+
+    if (!buffer->resizable || order >= 8 * sizeof (unsigned long))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    count_bytes = 1UL << order;
+    if (count_bytes < (unsigned long)page_size)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    if (readable_bytes > count_bytes)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+    for (i = 0; i < RING_BUFFER_MAX_CURSORS; i++)
+    {
+        if (header->cursors[i].state != RING_BUFFER_CURSOR_FREE)
+        {
+            errno = EBUSY;
+            return -1;
+        }
+    }
+    if (load_acquire (&buffer->io_in_flight))
+    {
+        errno = EBUSY;
+        return -1;
+    }
+    if (count_bytes == buffer->count_bytes)
+        return 0;
+
+    fd = memfd_create ("ring_buffer", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    status = ftruncate (fd, page_size + count_bytes);
+    if (status == 0)
+        status = ring_buffer_map (&resized, fd, fd, page_size, count_bytes, page_size);
+    close (fd);
     if (status)
+        return -1;
+
+    /* The offsets stay as they are, only the mask changes, so the readable bytes go where
+     * the new mask puts them; both mirror mappings make that one contiguous copy.
+     */
+    memcpy (resized.header, header, sizeof *header);
+    resized.header->count_bytes = count_bytes;
+    memcpy (resized.address + (read_offset_bytes & (count_bytes - 1)),
+            buffer->address + (read_offset_bytes & (buffer->count_bytes - 1)), readable_bytes);
+
+    if (munmap (buffer->address - buffer->page_size, buffer->page_size + (buffer->count_bytes << 1)))
         terminate_and_generate_core_dump();
+    buffer->address = resized.address;
+    buffer->header = resized.header;
+    buffer->count_bytes = count_bytes;
+    /* The cached offsets were taken against the old size; a stale read offset would make
+     * the producer see more free bytes than a smaller buffer has.
+     */
+    buffer->cached_read_offset_bytes = read_offset_bytes;
+    buffer->cached_write_offset_bytes = buffer->header->write_offset_bytes;
+    buffer->claimed_read_offset_bytes = read_offset_bytes;
+    return 0;
+}
+
+static int
+ring_buffer_remove_pages (struct ring_buffer *buffer, unsigned long offset_bytes, unsigned long count_bytes)
+{
+    if (count_bytes == 0)
+        return 0;
+    return madvise (buffer->address + offset_bytes, count_bytes, MADV_REMOVE);
+}
+
+int
+ring_buffer_trim (struct ring_buffer *buffer)
+{
+    unsigned long page_mask = buffer->page_size - 1;
+    unsigned long write_offset_bytes = buffer->header->write_offset_bytes;
+    unsigned long free_bytes = load_acquire (&buffer->header->read_offset_bytes) + buffer->count_bytes
+                               - write_offset_bytes;
+    unsigned long start_bytes = (write_offset_bytes & (buffer->count_bytes - 1)) + page_mask;
+    unsigned long end_bytes = (write_offset_bytes & (buffer->count_bytes - 1)) + free_bytes;
+
+    // a recv in flight may be landing in the free run
+    if (load_acquire (&buffer->io_in_flight))
+    {
+        errno = EBUSY;
+        return -1;
+    }
+
+    /* whole pages of the free run, in offsets of the first mapping, which may wrap */
+    start_bytes &= ~page_mask;
+    end_bytes &= ~page_mask;
+    if (end_bytes <= start_bytes)
+        return 0;
+    if (start_bytes >= buffer->count_bytes)
+        return ring_buffer_remove_pages (buffer, start_bytes - buffer->count_bytes, end_bytes - start_bytes);
+    if (end_bytes <= buffer->count_bytes)
+        return ring_buffer_remove_pages (buffer, start_bytes, end_bytes - start_bytes);
+    if (ring_buffer_remove_pages (buffer, start_bytes, buffer->count_bytes - start_bytes))
+        return -1;
+    return ring_buffer_remove_pages (buffer, 0, end_bytes - buffer->count_bytes);
+}
+
+long
+ring_buffer_resident_bytes (struct ring_buffer *buffer)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    unsigned long pages = buffer->count_bytes / page_size, i;
+    unsigned char *vector = malloc (pages);
+    long resident_pages = 0;
+
+    if (vector == NULL)
+        return -1;
+    if (mincore (buffer->address, buffer->count_bytes, vector))
+    {
+        free (vector);
+        return -1;
+    }
+    for (i = 0; i < pages; i++)
+        resident_pages += vector[i] & 1;
+    free (vector);
+    return resident_pages * page_size;
+}
+
+/* Remove the name of a shared buffer. Processes that attached it keep their mapping.
+ */
+int
+ring_buffer_unlink (const char *name)
+{
+    return shm_unlink (name);
 }
 
 void
@@ -74,40 +523,173 @@ ring_buffer_free (struct ring_buffer *buffer)
     if (buffer == NULL || buffer->address == NULL)
         return;
 
-    status = munmap (buffer->address, buffer->count_bytes << 1);
+    if (buffer->file_fd >= 0)
+    {
+        ring_buffer_sync (buffer);
+        close (buffer->file_fd); // drops our flock
+        buffer->file_fd = -1;
+    }
+
+    status = munmap (buffer->address - buffer->page_size, buffer->page_size + (buffer->count_bytes << 1));
     if (status)
         terminate_and_generate_core_dump();
+    if (buffer->readable_fd >= 0)
+        close (buffer->readable_fd);
+    if (buffer->writable_fd >= 0)
+        close (buffer->writable_fd);
+    buffer->readable_fd = -1;
+    buffer->writable_fd = -1;
+    buffer->address = NULL;
+    buffer->header = NULL;
+    free (buffer->latency);
+    buffer->latency = NULL;
+}
+
+/* Producer side of the time-in-buffer samples. A full sample queue skips the sample. */
+static void
+latency_sample (struct ring_buffer_latency *latency, unsigned long write_offset_bytes)
+{
+    unsigned long head = latency->head;
+
+    if (head - load_acquire (&latency->tail) >= RING_BUFFER_LATENCY_SAMPLES)
+        return;
+
+    latency->sample_offset_bytes[head % RING_BUFFER_LATENCY_SAMPLES] = write_offset_bytes;
+    latency->sample_ns[head % RING_BUFFER_LATENCY_SAMPLES] = monotonic_ns ();
+    store_release (&latency->head, head + 1);
+}
+
+/* Consumer side: every sample at or below @read_offset_bytes has left the buffer. */
+static void
+latency_observe (struct ring_buffer_latency *latency, unsigned long read_offset_bytes)
+{
+    unsigned long tail = latency->tail, head = load_acquire (&latency->head);
+    unsigned long now_ns = 0, elapsed_ns;
+
+    for (; tail != head; tail++)
+    {
+        if ((long)(latency->sample_offset_bytes[tail % RING_BUFFER_LATENCY_SAMPLES] - read_offset_bytes) > 0)
+            break;
+        if (now_ns == 0)
+            now_ns = monotonic_ns ();
+        elapsed_ns = now_ns - latency->sample_ns[tail % RING_BUFFER_LATENCY_SAMPLES];
+        latency->buckets[elapsed_ns ? 63 - __builtin_clzl (elapsed_ns) : 0]++;
+    }
+    store_release (&latency->tail, tail);
+}
+
+/* Signal @fd if a level went from below @mark_bytes to at least @mark_bytes. The caller's
+ * futex_wake_waiters already fenced its offset store against the load of the mark.
+ */
+static void
+eventfd_signal_crossing (int fd, unsigned long mark_bytes, unsigned long before_bytes, unsigned long after_bytes)
+{
+    if (before_bytes < mark_bytes && after_bytes >= mark_bytes)
+        eventfd_write (fd, 1);
+}
+
+/* The sync policy of the advances. A failed sync is left for the next one to retry. */
+static void
+ring_buffer_sync_on_advance (struct ring_buffer *buffer)
+{
+    if (buffer->sync_policy == RING_BUFFER_SYNC_INTERVAL
+        && monotonic_ns () - buffer->last_sync_ns < buffer->sync_interval_ns)
+        return;
+    ring_buffer_sync (buffer);
 }
 
 void *
 ring_buffer_write_address (struct ring_buffer *buffer)
 {
     /* ignore warnings about void pointer arithmetic */
-    return buffer->address + buffer->write_offset_bytes;
+    return buffer->address + (load_relaxed (&buffer->header->write_offset_bytes) & (buffer->count_bytes - 1));
 }
 
+/* Publish @count_bytes written at ring_buffer_write_address() to the consumer. Producer side.
+ */
 void
 ring_buffer_write_advance (struct ring_buffer *buffer, unsigned long count_bytes)
 {
-    buffer->write_offset_bytes += count_bytes;
+    unsigned long write_offset_bytes = load_relaxed (&buffer->header->write_offset_bytes) + count_bytes;
+    unsigned long readable_bytes;
+
+    store_release (&buffer->header->write_offset_bytes, write_offset_bytes);
+    futex_wake_waiters (&buffer->header->readable_futex, &buffer->header->read_waiters);
+    buffer->producer_stats.bytes_written += count_bytes;
+    buffer->producer_stats.writes++;
+    if (buffer->latency)
+        latency_sample (buffer->latency, write_offset_bytes);
+
+    if (buffer->readable_fd >= 0)
+    {
+        readable_bytes = write_offset_bytes - load_acquire (&buffer->header->read_offset_bytes);
+        eventfd_signal_crossing (buffer->readable_fd, load_relaxed (&buffer->readable_mark_bytes),
+                                 readable_bytes - count_bytes, readable_bytes);
+    }
+
+    if (buffer->sync_policy != RING_BUFFER_SYNC_NONE)
+        ring_buffer_sync_on_advance (buffer);
 }
 
+/* Consumer side. Remembers the read offset it hands out, so that in overwrite mode the
+ * advance can tell whether the producer discarded those bytes meanwhile.
+ */
 void *
 ring_buffer_read_address (struct ring_buffer *buffer)
 {
-    return buffer->address + buffer->read_offset_bytes;
+    buffer->claimed_read_offset_bytes = load_acquire (&buffer->header->read_offset_bytes);
+    return buffer->address + (buffer->claimed_read_offset_bytes & (buffer->count_bytes - 1));
 }
 
-void
+/* Hand @count_bytes back to the producer. Consumer side. The offsets are monotonic, so
+ * there is nothing to rewrite when the reader passes the end of the first mapping.
+ * Return 0, or -1 in overwrite mode if the producer discarded the bytes first.
+ */
+int
 ring_buffer_read_advance (struct ring_buffer *buffer, unsigned long count_bytes)
 {
-    buffer->read_offset_bytes += count_bytes;
+    unsigned long read_offset_bytes = load_relaxed (&buffer->header->read_offset_bytes);
+    unsigned long free_bytes;
+    struct ring_buffer_consumer_stats *stats = &buffer->consumer_stats;
+
+    if (load_relaxed (&buffer->header->overwrite))
+    {
+        // bytes past the cached write offset may not have been published when they were copied
+        read_offset_bytes = buffer->claimed_read_offset_bytes;
+        if ((long)(buffer->cached_write_offset_bytes - read_offset_bytes) < (long)count_bytes)
+            return -1;
+        // the release orders the caller's copy before the swap, as a seqlock reader would
+        if (!__atomic_compare_exchange_n (&buffer->header->read_offset_bytes, &read_offset_bytes,
+                                          read_offset_bytes + count_bytes, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return -1;
+        read_offset_bytes += count_bytes;
+    }
+    else
+    {
+        read_offset_bytes += count_bytes;
+        store_release (&buffer->header->read_offset_bytes, read_offset_bytes);
+    }
+    buffer->claimed_read_offset_bytes = read_offset_bytes;
+    stats->bytes_read += count_bytes;
+    stats->reads++;
+    if (((read_offset_bytes - count_bytes) ^ read_offset_bytes) & ~(buffer->count_bytes - 1))
+        stats->wraps++;
+    if (buffer->latency)
+        latency_observe (buffer->latency, read_offset_bytes);
+    futex_wake_waiters (&buffer->header->writable_futex, &buffer->header->write_waiters);
 
-    if (buffer->read_offset_bytes >= buffer->count_bytes)
+    if (buffer->writable_fd >= 0)
     {
-        buffer->read_offset_bytes -= buffer->count_bytes;
-        buffer->write_offset_bytes -= buffer->count_bytes;
+        free_bytes = buffer->count_bytes - (load_acquire (&buffer->header->write_offset_bytes) - read_offset_bytes);
+        eventfd_signal_crossing (buffer->writable_fd, load_relaxed (&buffer->writable_mark_bytes),
+                                 free_bytes - count_bytes, free_bytes);
     }
+
+    if (buffer->sync_policy != RING_BUFFER_SYNC_NONE)
+        ring_buffer_sync_on_advance (buffer);
+
+    return 0;
 }
 
 /* Return how many bytes available for read
@@ -115,7 +697,9 @@ ring_buffer_read_advance (struct ring_buffer *buffer, unsigned long count_bytes)
 unsigned long
 ring_buffer_count_bytes (struct ring_buffer *buffer)
 {
-    return buffer->write_offset_bytes - buffer->read_offset_bytes;
+    unsigned long read_offset_bytes = load_acquire (&buffer->header->read_offset_bytes);
+
+    return load_acquire (&buffer->header->write_offset_bytes) - read_offset_bytes;
 }
 
 /* Return how many bytes available for write
@@ -126,52 +710,1009 @@ ring_buffer_count_free_bytes (struct ring_buffer *buffer)
     return buffer->count_bytes - ring_buffer_count_bytes (buffer);
 }
 
-void
-ring_buffer_clear (struct ring_buffer *buffer)
+/* Return how many bytes the producer may write, refreshing its cached copy of the
+ * read offset only when the cached copy says fewer than @count_bytes are free.
+ */
+unsigned long
+ring_buffer_producer_free_bytes (struct ring_buffer *buffer, unsigned long count_bytes)
 {
-    buffer->write_offset_bytes = 0;
-    buffer->read_offset_bytes = 0;
+    unsigned long write_offset_bytes = load_relaxed (&buffer->header->write_offset_bytes);
+    unsigned long free_bytes;
+
+    free_bytes = buffer->count_bytes - (write_offset_bytes - buffer->cached_read_offset_bytes);
+    if (free_bytes < count_bytes)
+    {
+        buffer->cached_read_offset_bytes = load_acquire (&buffer->header->read_offset_bytes);
+        free_bytes = buffer->count_bytes - (write_offset_bytes - buffer->cached_read_offset_bytes);
+        if (buffer->count_bytes - free_bytes > buffer->producer_stats.high_water_bytes)
+            buffer->producer_stats.high_water_bytes = buffer->count_bytes - free_bytes;
+    }
+
+    return free_bytes;
 }
 
-/* Write @data of size @count_bytes into the buffer if there is enough space. Otherwise,
- * terminate_and_generate_core_dump()
+/* Return how many bytes the consumer may read, refreshing its cached copy of the
+ * write offset only when the cached copy says fewer than @count_bytes are readable.
  */
-void
-ring_buffer_write (struct ring_buffer *buffer, char *data, size_t count_bytes)
+unsigned long
+ring_buffer_consumer_count_bytes (struct ring_buffer *buffer, unsigned long count_bytes)
 {
-    // TODO: trigger an python exception instead of core dump
-    if (ring_buffer_count_free_bytes (buffer) < count_bytes)
-        terminate_and_generate_core_dump();
-    memcpy ((void *)ring_buffer_write_address (buffer), (void *)data, count_bytes);
-    ring_buffer_write_advance (buffer, count_bytes);
+    unsigned long read_offset_bytes = load_relaxed (&buffer->header->read_offset_bytes);
+    unsigned long available_bytes;
+
+    available_bytes = buffer->cached_write_offset_bytes - read_offset_bytes;
+    // an overwriting producer can push the read offset past the cached write offset
+    if (available_bytes < count_bytes || available_bytes > buffer->count_bytes)
+    {
+        buffer->cached_write_offset_bytes = load_acquire (&buffer->header->write_offset_bytes);
+        available_bytes = buffer->cached_write_offset_bytes - read_offset_bytes;
+        if (available_bytes <= buffer->count_bytes && available_bytes > buffer->consumer_stats.high_water_bytes)
+            buffer->consumer_stats.high_water_bytes = available_bytes;
+    }
+
+    return available_bytes;
 }
 
-/* Read @count_bytes into the @data.
+/* Sleep on @futex while @is_ready is false. See ring_buffer_wait_readable.
  */
-void
-ring_buffer_read (struct ring_buffer *buffer, char *data, unsigned long count_bytes)
+static int
+ring_buffer_wait (struct ring_buffer *buffer, unsigned int *futex, unsigned int *waiters,
+                  int (*is_ready) (struct ring_buffer *, int, unsigned long), int cursor,
+                  unsigned long min_bytes, long timeout_ns, unsigned long *waits, unsigned long *wait_ns)
 {
-    memcpy (data, ring_buffer_read_address (buffer), count_bytes);
-    ring_buffer_read_advance (buffer, count_bytes);
+    struct timespec now, deadline, remaining;
+    unsigned int value;
+    unsigned long sleep_ns;
+    int status;
+
+    if (timeout_ns >= 0)
+    {
+        clock_gettime (CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += timeout_ns / 1000000000L;
+        deadline.tv_nsec += timeout_ns % 1000000000L;
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            deadline.tv_sec += 1;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    for (;;)
+    {
+        value = load_acquire (futex);
+        __atomic_add_fetch (waiters, 1, __ATOMIC_SEQ_CST);
+        if (is_ready (buffer, cursor, min_bytes))
+        {
+            __atomic_sub_fetch (waiters, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+
+        if (timeout_ns >= 0)
+        {
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            remaining.tv_sec = deadline.tv_sec - now.tv_sec;
+            remaining.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+            if (remaining.tv_nsec < 0)
+            {
+                remaining.tv_sec -= 1;
+                remaining.tv_nsec += 1000000000L;
+            }
+            if (remaining.tv_sec < 0)
+            {
+                __atomic_sub_fetch (waiters, 1, __ATOMIC_RELAXED);
+                errno = ETIMEDOUT;
+                return -1;
+            }
+        }
+
+        sleep_ns = monotonic_ns ();
+        status = futex_wait (futex, value, timeout_ns >= 0 ? &remaining : NULL);
+        __atomic_sub_fetch (waiters, 1, __ATOMIC_RELAXED);
+        (*waits)++;
+        *wait_ns += monotonic_ns () - sleep_ns;
+        // EAGAIN means the futex moved before we slept, ETIMEDOUT is decided above
+        if (status && errno != EAGAIN && errno != ETIMEDOUT)
+            return -1;
+    }
 }
 
-/* Assign the value of current write_offset_bytes to end_offset_bytes to mark an eof
+static int
+ring_buffer_is_readable (struct ring_buffer *buffer, int cursor, unsigned long min_bytes)
+{
+    return ring_buffer_consumer_count_bytes (buffer, min_bytes) >= min_bytes
+        || ring_buffer_write_closed (buffer);
+}
+
+static int
+ring_buffer_is_writable (struct ring_buffer *buffer, int cursor, unsigned long min_bytes)
+{
+    return ring_buffer_producer_free_bytes (buffer, min_bytes) >= min_bytes;
+}
+
+int
+ring_buffer_wait_readable (struct ring_buffer *buffer, unsigned long min_bytes, long timeout_ns)
+{
+    return ring_buffer_wait (buffer, &buffer->header->readable_futex, &buffer->header->read_waiters,
+                             ring_buffer_is_readable, -1, min_bytes, timeout_ns,
+                             &buffer->consumer_stats.waits, &buffer->consumer_stats.wait_ns);
+}
+
+int
+ring_buffer_wait_writable (struct ring_buffer *buffer, unsigned long min_bytes, long timeout_ns)
+{
+    return ring_buffer_wait (buffer, &buffer->header->writable_futex, &buffer->header->write_waiters,
+                             ring_buffer_is_writable, -1, min_bytes, timeout_ns,
+                             &buffer->producer_stats.waits, &buffer->producer_stats.wait_ns);
+}
+
+/* Create the readable and writable eventfds. Return 0 on success, -1 with errno set.
+ */
+int
+ring_buffer_enable_eventfd (struct ring_buffer *buffer)
+{
+    if (buffer->readable_fd >= 0)
+        return 0;
+
+    buffer->writable_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (buffer->writable_fd < 0)
+        return -1;
+
+    /* publish readable_fd last, it is what the producer checks */
+    store_release (&buffer->readable_fd, eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC));
+    if (buffer->readable_fd < 0)
+    {
+        close (buffer->writable_fd);
+        buffer->writable_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Move a mark. The full fence orders the store before the caller's next look at the
+ * buffer, so an advance that raced with it either saw the new mark or is visible there.
  */
 void
-ring_buffer_write_close (struct ring_buffer *buffer)
+ring_buffer_set_readable_mark (struct ring_buffer *buffer, unsigned long count_bytes)
 {
-    buffer->end_offset_bytes = buffer->write_offset_bytes;
+    __atomic_store_n (&buffer->readable_mark_bytes, count_bytes, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
 }
 
-int ring_buffer_eof (struct ring_buffer *buffer)
+void
+ring_buffer_set_writable_mark (struct ring_buffer *buffer, unsigned long count_bytes)
 {
-    return buffer->write_offset_bytes == buffer->read_offset_bytes;
+    __atomic_store_n (&buffer->writable_mark_bytes, count_bytes, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
 }
 
-/* Copy the buffer data into @data without advancing the read pointer
+/* Reset the buffer to empty. Not safe while either side is running.
  */
 void
-ring_buffer_peek (struct ring_buffer *buffer, char *data, int count_bytes)
+ring_buffer_clear (struct ring_buffer *buffer)
 {
-    memcpy (data, ring_buffer_read_address (buffer), count_bytes);
+    int i;
+
+    buffer->header->write_offset_bytes = 0;
+    buffer->cached_read_offset_bytes = 0;
+    buffer->header->read_offset_bytes = 0;
+    buffer->cached_write_offset_bytes = 0;
+    buffer->claimed_read_offset_bytes = 0;
+    buffer->header->end_offset_bytes = 0;
+    buffer->header->write_closed = 0;
+    buffer->header->dropped_bytes = 0;
+    buffer->header->dropped_records = 0;
+    buffer->scan_delimiter_bytes = 0;
+    for (i = 0; i < RING_BUFFER_MAX_CURSORS; i++)
+        buffer->header->cursors[i].read_offset_bytes = 0;
+    if (buffer->latency)
+        buffer->latency->head = buffer->latency->tail = 0;
+}
+
+void
+ring_buffer_reset (struct ring_buffer *buffer)
+{
+    int i;
+
+    for (i = 0; i < RING_BUFFER_MAX_CURSORS; i++)
+        buffer->header->cursors[i].state = RING_BUFFER_CURSOR_FREE;
+    ring_buffer_clear (buffer);
+    buffer->header->overwrite = 0;
+
+    if (buffer->readable_fd >= 0)
+        close (buffer->readable_fd);
+    if (buffer->writable_fd >= 0)
+        close (buffer->writable_fd);
+    buffer->readable_fd = -1;
+    buffer->writable_fd = -1;
+    buffer->readable_mark_bytes = 1;
+    buffer->writable_mark_bytes = 1;
+
+    free (buffer->latency);
+    buffer->latency = NULL;
+    ring_buffer_reset_stats (buffer);
+}
+
+/* Write @data of size @count_bytes into the buffer if there is enough space, making room
+ * in overwrite mode. Otherwise, terminate_and_generate_core_dump()
+ */
+void
+ring_buffer_write (struct ring_buffer *buffer, char *data, size_t count_bytes)
+{
+    if (ring_buffer_overwrite (buffer) && count_bytes <= buffer->count_bytes)
+        ring_buffer_make_room (buffer, count_bytes, 0);
+
+    // TODO: trigger an python exception instead of core dump
+    if (ring_buffer_producer_free_bytes (buffer, count_bytes) < count_bytes)
+        terminate_and_generate_core_dump();
+    memcpy ((void *)ring_buffer_write_address (buffer), (void *)data, count_bytes);
+    ring_buffer_write_advance (buffer, count_bytes);
+}
+
+/* Read @count_bytes into the @data. In overwrite mode, copy again until the producer
+ * leaves the bytes alone; it only ever discards to publish a write right after, so the
+ * wait for @count_bytes to be readable again is short.
+ */
+void
+ring_buffer_read (struct ring_buffer *buffer, char *data, unsigned long count_bytes)
+{
+    // TODO: trigger an python exception instead of core dump
+    if (ring_buffer_consumer_count_bytes (buffer, count_bytes) < count_bytes)
+        terminate_and_generate_core_dump();
+    memcpy (data, ring_buffer_read_address (buffer), count_bytes);
+
+    /* Only an overwriting producer makes the advance fail, and it is writing, so the bytes
+     * it pushed the read offset past are being replaced.
+     */
+    while (ring_buffer_read_advance (buffer, count_bytes) < 0)
+    {
+        // give way, or on a single CPU the producer lapping us never gets to finish
+        do
+            sched_yield ();
+        while (ring_buffer_consumer_count_bytes (buffer, count_bytes) < count_bytes);
+        memcpy (data, ring_buffer_read_address (buffer), count_bytes);
+    }
+}
+
+/* Assign the value of current write_offset_bytes to end_offset_bytes to mark an eof
+ */
+void
+ring_buffer_write_close (struct ring_buffer *buffer)
+{
+    buffer->header->end_offset_bytes = load_relaxed (&buffer->header->write_offset_bytes);
+    store_release (&buffer->header->write_closed, 1);
+    futex_wake_waiters (&buffer->header->readable_futex, &buffer->header->read_waiters);
+    if (buffer->readable_fd >= 0)
+        eventfd_write (buffer->readable_fd, 1);
+}
+
+/* Return non-zero once the producer called ring_buffer_write_close, in any process
+ */
+int
+ring_buffer_write_closed (struct ring_buffer *buffer)
+{
+    return load_acquire (&buffer->header->write_closed);
+}
+
+int ring_buffer_eof (struct ring_buffer *buffer)
+{
+    return ring_buffer_count_bytes (buffer) == 0;
+}
+
+/* Copy the buffer data into @data without advancing the read pointer
+ */
+void
+ring_buffer_peek (struct ring_buffer *buffer, char *data, int count_bytes)
+{
+    memcpy (data, ring_buffer_read_address (buffer), count_bytes);
+}
+
+long
+ring_buffer_writev (struct ring_buffer *buffer, const struct iovec *iov, int iovcnt)
+{
+    unsigned long count_bytes = 0;
+    char *address;
+    int i;
+
+    for (i=0; i<iovcnt; i++)
+        count_bytes += iov[i].iov_len;
+    if (ring_buffer_overwrite (buffer) && count_bytes <= buffer->count_bytes)
+        ring_buffer_make_room (buffer, count_bytes, 0);
+    if (ring_buffer_producer_free_bytes (buffer, count_bytes) < count_bytes)
+    {
+        buffer->producer_stats.full++;
+        return -1;
+    }
+
+    address = ring_buffer_write_address (buffer);
+    for (i=0; i<iovcnt; i++)
+    {
+        memcpy (address, iov[i].iov_base, iov[i].iov_len);
+        address += iov[i].iov_len;
+    }
+    ring_buffer_write_advance (buffer, count_bytes);
+
+    return count_bytes;
+}
+
+long
+ring_buffer_readv (struct ring_buffer *buffer, const struct iovec *iov, int iovcnt)
+{
+    unsigned long wanted_bytes = 0;
+    unsigned long count_bytes, piece_bytes, copied_bytes = 0;
+    char *address;
+    int i;
+
+    for (i=0; i<iovcnt; i++)
+        wanted_bytes += iov[i].iov_len;
+
+    do
+    {
+        count_bytes = ring_buffer_consumer_count_bytes (buffer, wanted_bytes);
+        if (count_bytes > wanted_bytes)
+            count_bytes = wanted_bytes;
+
+        address = ring_buffer_read_address (buffer);
+        for (i=0, copied_bytes=0; i<iovcnt && copied_bytes < count_bytes; i++)
+        {
+            piece_bytes = iov[i].iov_len;
+            if (piece_bytes > count_bytes - copied_bytes)
+                piece_bytes = count_bytes - copied_bytes;
+            memcpy (iov[i].iov_base, address + copied_bytes, piece_bytes);
+            copied_bytes += piece_bytes;
+        }
+    }
+    while (ring_buffer_read_advance (buffer, count_bytes) < 0);
+    if (count_bytes == 0 && wanted_bytes)
+        buffer->consumer_stats.empty++;
+
+    return count_bytes;
+}
+
+/* The mirror mapping makes the whole free span one contiguous range, so a single read(2)
+ * can fill it even when it wraps.
+ */
+long
+ring_buffer_fill_from_fd (struct ring_buffer *buffer, int fd, unsigned long max_bytes)
+{
+    unsigned long count_bytes = ring_buffer_producer_free_bytes (buffer, max_bytes ? max_bytes : buffer->count_bytes);
+    ssize_t status;
+
+    if (max_bytes && count_bytes > max_bytes)
+        count_bytes = max_bytes;
+
+    status = read (fd, ring_buffer_write_address (buffer), count_bytes);
+    if (status > 0)
+        ring_buffer_write_advance (buffer, status);
+
+    return status;
+}
+
+/* vmsplice(2) would hand the pipe references to our pages rather than copies, and the
+ * producer reuses those pages as soon as we advance, so pipes get a plain write(2) too.
+ */
+long
+ring_buffer_drain_to_fd (struct ring_buffer *buffer, int fd, unsigned long max_bytes)
+{
+    unsigned long count_bytes = ring_buffer_consumer_count_bytes (buffer, max_bytes ? max_bytes : buffer->count_bytes);
+    ssize_t status;
+
+    if (max_bytes && count_bytes > max_bytes)
+        count_bytes = max_bytes;
+
+    status = write (fd, ring_buffer_read_address (buffer), count_bytes);
+    if (status > 0)
+        ring_buffer_read_advance (buffer, status);
+
+    return status;
+}
+
+/* Append @data of size @count_bytes as one record. Return 0 on success, -1 if the record
+ * does not fit in the free space right now.
+ */
+int
+ring_buffer_push_record (struct ring_buffer *buffer, const char *data, unsigned long count_bytes)
+{
+    unsigned long record_bytes = RING_BUFFER_RECORD_HEADER_BYTES + count_bytes;
+    uint32_t length = count_bytes;
+    char *address;
+
+    if (ring_buffer_overwrite (buffer) && record_bytes <= buffer->count_bytes)
+        ring_buffer_make_room (buffer, record_bytes, 1);
+    if (count_bytes > UINT32_MAX || ring_buffer_producer_free_bytes (buffer, record_bytes) < record_bytes)
+    {
+        buffer->producer_stats.full++;
+        return -1;
+    }
+
+    address = ring_buffer_write_address (buffer);
+    memcpy (address, &length, RING_BUFFER_RECORD_HEADER_BYTES);
+    memcpy (address + RING_BUFFER_RECORD_HEADER_BYTES, data, count_bytes);
+    ring_buffer_write_advance (buffer, record_bytes);
+
+    return 0;
+}
+
+/* Return the payload size of the record at the claimed read offset. A length running past
+ * the published bytes can only come from an overwriting producer lapping the consumer;
+ * it reads as 0 and the advance that follows fails.
+ */
+static unsigned long
+ring_buffer_claimed_record_bytes (struct ring_buffer *buffer)
+{
+    long available_bytes = buffer->cached_write_offset_bytes - buffer->claimed_read_offset_bytes;
+    uint32_t length;
+
+    memcpy (&length, buffer->address + (buffer->claimed_read_offset_bytes & (buffer->count_bytes - 1)),
+            RING_BUFFER_RECORD_HEADER_BYTES);
+    if (available_bytes < (long)RING_BUFFER_RECORD_HEADER_BYTES
+        || length > available_bytes - RING_BUFFER_RECORD_HEADER_BYTES)
+        return 0;
+
+    return length;
+}
+
+/* Return the payload address of the oldest record and store its size in @count_bytes,
+ * or return NULL if there is no record. The record stays in the buffer.
+ */
+void *
+ring_buffer_front_record (struct ring_buffer *buffer, unsigned long *count_bytes)
+{
+    char *address;
+
+    if (ring_buffer_consumer_count_bytes (buffer, RING_BUFFER_RECORD_HEADER_BYTES) < RING_BUFFER_RECORD_HEADER_BYTES)
+    {
+        buffer->consumer_stats.empty++;
+        return NULL;
+    }
+
+    address = ring_buffer_read_address (buffer);
+    *count_bytes = ring_buffer_claimed_record_bytes (buffer);
+
+    return address + RING_BUFFER_RECORD_HEADER_BYTES;
+}
+
+/* Discard the oldest record, which ring_buffer_front_record must have returned. Return 0,
+ * or -1 in overwrite mode if the producer discarded it first.
+ */
+int
+ring_buffer_pop_record (struct ring_buffer *buffer)
+{
+    return ring_buffer_read_advance (buffer, RING_BUFFER_RECORD_HEADER_BYTES + ring_buffer_claimed_record_bytes (buffer));
+}
+
+long
+ring_buffer_find (struct ring_buffer *buffer, const char *delimiter, unsigned long delimiter_bytes)
+{
+    char *address = ring_buffer_read_address (buffer);
+    unsigned long read_offset_bytes = buffer->claimed_read_offset_bytes;
+    unsigned long write_offset_bytes = load_acquire (&buffer->header->write_offset_bytes);
+    unsigned long start_offset_bytes = read_offset_bytes;
+    unsigned long readable_bytes = write_offset_bytes - read_offset_bytes;
+    char *found;
+
+    if (delimiter_bytes == 0)
+        return 0;
+    buffer->cached_write_offset_bytes = write_offset_bytes;
+    if (readable_bytes > buffer->count_bytes) // lapped by an overwriting producer
+        return -1;
+
+    if (buffer->scan_delimiter_bytes == delimiter_bytes
+        && memcmp (buffer->scan_delimiter, delimiter, delimiter_bytes) == 0
+        && buffer->scan_offset_bytes - read_offset_bytes <= readable_bytes)
+        start_offset_bytes = buffer->scan_offset_bytes;
+
+    if (delimiter_bytes == 1)
+        found = memchr (address + (start_offset_bytes - read_offset_bytes), delimiter[0],
+                        write_offset_bytes - start_offset_bytes);
+    else
+        found = memmem (address + (start_offset_bytes - read_offset_bytes), write_offset_bytes - start_offset_bytes,
+                        delimiter, delimiter_bytes);
+    if (found)
+        return found - address;
+
+    // the last delimiter_bytes - 1 bytes may start a delimiter that is not all written yet
+    if (delimiter_bytes <= RING_BUFFER_SCAN_DELIMITER_BYTES)
+    {
+        memcpy (buffer->scan_delimiter, delimiter, delimiter_bytes);
+        buffer->scan_delimiter_bytes = delimiter_bytes;
+        buffer->scan_offset_bytes = readable_bytes < delimiter_bytes ? read_offset_bytes
+                                    : write_offset_bytes - (delimiter_bytes - 1);
+        if ((long)(buffer->scan_offset_bytes - start_offset_bytes) < 0)
+            buffer->scan_offset_bytes = start_offset_bytes;
+    }
+    return -1;
+}
+
+void
+ring_buffer_set_overwrite (struct ring_buffer *buffer, int overwrite)
+{
+    store_release (&buffer->header->overwrite, overwrite != 0);
+}
+
+int
+ring_buffer_overwrite (struct ring_buffer *buffer)
+{
+    return load_relaxed (&buffer->header->overwrite);
+}
+
+/* Discard the oldest bytes, or with @whole_records the oldest records, until @count_bytes
+ * fit, racing the consumer with compare-and-swaps on read_offset_bytes. Producer side,
+ * overwrite mode only; @count_bytes must not exceed the buffer size. Return the bytes
+ * discarded.
+ */
+unsigned long
+ring_buffer_make_room (struct ring_buffer *buffer, unsigned long count_bytes, int whole_records)
+{
+    struct ring_buffer_header *header = buffer->header;
+    unsigned long write_offset_bytes = load_relaxed (&header->write_offset_bytes);
+    unsigned long read_offset_bytes = load_acquire (&header->read_offset_bytes);
+    unsigned long next_offset_bytes, dropped_bytes = 0, dropped_records = 0;
+    uint32_t length;
+
+    while (write_offset_bytes + count_bytes - read_offset_bytes > buffer->count_bytes)
+    {
+        if (whole_records)
+        {
+            // a stale length means the consumer moved on and the swap below fails
+            memcpy (&length, buffer->address + (read_offset_bytes & (buffer->count_bytes - 1)),
+                    RING_BUFFER_RECORD_HEADER_BYTES);
+            next_offset_bytes = read_offset_bytes + RING_BUFFER_RECORD_HEADER_BYTES + length;
+            if (next_offset_bytes - read_offset_bytes > write_offset_bytes - read_offset_bytes)
+                next_offset_bytes = write_offset_bytes;
+        }
+        else
+            next_offset_bytes = write_offset_bytes + count_bytes - buffer->count_bytes;
+
+        // acquire keeps the new data from being written before the bytes are given up
+        if (__atomic_compare_exchange_n (&header->read_offset_bytes, &read_offset_bytes, next_offset_bytes,
+                                         0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            dropped_bytes += next_offset_bytes - read_offset_bytes;
+            dropped_records += whole_records != 0;
+            read_offset_bytes = next_offset_bytes;
+        }
+    }
+    buffer->cached_read_offset_bytes = read_offset_bytes;
+
+    if (dropped_bytes)
+    {
+        store_release (&header->dropped_bytes, load_relaxed (&header->dropped_bytes) + dropped_bytes);
+        store_release (&header->dropped_records, load_relaxed (&header->dropped_records) + dropped_records);
+    }
+
+    return dropped_bytes;
+}
+
+unsigned long
+ring_buffer_dropped_bytes (struct ring_buffer *buffer)
+{
+    return load_acquire (&buffer->header->dropped_bytes);
+}
+
+unsigned long
+ring_buffer_dropped_records (struct ring_buffer *buffer)
+{
+    return load_acquire (&buffer->header->dropped_records);
+}
+
+int
+ring_buffer_enable_timestamps (struct ring_buffer *buffer)
+{
+    if (buffer->latency)
+        return 0;
+    if (posix_memalign ((void **)&buffer->latency, RING_BUFFER_CACHE_LINE_BYTES, sizeof *buffer->latency))
+    {
+        buffer->latency = NULL;
+        errno = ENOMEM;
+        return -1;
+    }
+    memset (buffer->latency, 0, sizeof *buffer->latency);
+
+    return 0;
+}
+
+void
+ring_buffer_reset_stats (struct ring_buffer *buffer)
+{
+    memset (&buffer->producer_stats, 0, sizeof buffer->producer_stats);
+    memset (&buffer->consumer_stats, 0, sizeof buffer->consumer_stats);
+    if (buffer->latency)
+        memset (buffer->latency->buckets, 0, sizeof buffer->latency->buckets);
+}
+
+/* Copy first, then check how far the read offset moved meanwhile, like a seqlock reader.
+ * The producer gives bytes up before it overwrites them, so everything from the read
+ * offset seen after the copy onwards is intact; only a lap past the copied write offset
+ * forces another try.
+ */
+unsigned long
+ring_buffer_snapshot (struct ring_buffer *buffer, char *data)
+{
+    unsigned long write_offset_bytes, read_offset_bytes, after_offset_bytes;
+
+    for (;;)
+    {
+        write_offset_bytes = load_acquire (&buffer->header->write_offset_bytes);
+        read_offset_bytes = load_acquire (&buffer->header->read_offset_bytes);
+        if ((long)(read_offset_bytes - write_offset_bytes) > 0)
+            continue; // the read offset already passed the write offset we loaded
+
+        memcpy (data, buffer->address + (read_offset_bytes & (buffer->count_bytes - 1)),
+                write_offset_bytes - read_offset_bytes);
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        after_offset_bytes = load_relaxed (&buffer->header->read_offset_bytes);
+
+        if (after_offset_bytes == read_offset_bytes)
+            return write_offset_bytes - read_offset_bytes;
+        if (after_offset_bytes - read_offset_bytes <= write_offset_bytes - read_offset_bytes)
+        {
+            memmove (data, data + (after_offset_bytes - read_offset_bytes), write_offset_bytes - after_offset_bytes);
+            return write_offset_bytes - after_offset_bytes;
+        }
+    }
+}
+
+/* FNV-1a over the commit and the buffer size */
+static unsigned long
+commit_checksum (const struct ring_buffer_commit *commit, unsigned long count_bytes)
+{
+    unsigned long fields[4] = { commit->generation, commit->write_offset_bytes,
+                                commit->read_offset_bytes, count_bytes };
+    const unsigned char *bytes = (const unsigned char *)fields;
+    unsigned long hash = 0xcbf29ce484222325UL;
+    size_t i;
+
+    for (i = 0; i < sizeof fields; i++)
+        hash = (hash ^ bytes[i]) * 0x100000001b3UL;
+    return hash;
+}
+
+/* The newer of the two commits that are intact, or NULL */
+static struct ring_buffer_commit *
+ring_buffer_newest_commit (struct ring_buffer *buffer)
+{
+    struct ring_buffer_commit *commits = buffer->header->commits, *newest = NULL;
+    int i;
+
+    for (i = 0; i < 2; i++)
+    {
+        if (commits[i].generation == 0
+            || commits[i].checksum != commit_checksum (&commits[i], buffer->count_bytes)
+            || commits[i].write_offset_bytes - commits[i].read_offset_bytes > buffer->count_bytes)
+            continue;
+        if (newest == NULL || commits[i].generation > newest->generation)
+            newest = &commits[i];
+    }
+    return newest;
+}
+
+/* Roll the live header back to the newest commit. Nobody else has the file mapped, so
+ * whatever the waiters and the sync lock say is left over from a crash.
+ */
+static int
+ring_buffer_recover (struct ring_buffer *buffer)
+{
+    struct ring_buffer_header *header = buffer->header;
+    struct ring_buffer_commit *commit = ring_buffer_newest_commit (buffer);
+    int i;
+
+    if (commit == NULL)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    header->write_offset_bytes = commit->write_offset_bytes;
+    header->read_offset_bytes = commit->read_offset_bytes;
+    header->end_offset_bytes = 0;
+    header->write_closed = 0;
+    header->read_waiters = 0;
+    header->write_waiters = 0;
+    header->sync_lock = 0;
+    // a cursor may have been written back ahead of the commit; it reads again from the slowest
+    for (i = 0; i < RING_BUFFER_MAX_CURSORS; i++)
+    {
+        if (header->cursors[i].state == RING_BUFFER_CURSOR_CLAIMED)
+            header->cursors[i].state = RING_BUFFER_CURSOR_FREE;
+        if (header->cursors[i].read_offset_bytes - commit->read_offset_bytes
+            > commit->write_offset_bytes - commit->read_offset_bytes)
+            header->cursors[i].read_offset_bytes = commit->read_offset_bytes;
+    }
+    buffer->cached_read_offset_bytes = commit->read_offset_bytes;
+    buffer->cached_write_offset_bytes = commit->write_offset_bytes;
+    buffer->claimed_read_offset_bytes = commit->read_offset_bytes;
+
+    return 0;
+}
+
+int
+ring_buffer_open_file (struct ring_buffer *buffer, const char *path, unsigned long order)
+{
+    int fd, exclusive, saved_errno;
+    struct stat st;
+
+    fd = open (path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return -1;
+
+    /* whoever has the file to itself creates or recovers it, the others wait for that on
+     * the shared lock and then map the live buffer
+     */
+    exclusive = flock (fd, LOCK_EX | LOCK_NB) == 0;
+    if (!exclusive && (errno != EWOULDBLOCK || flock (fd, LOCK_SH)))
+        goto fail;
+    if (fstat (fd, &st))
+        goto fail;
+
+    if (st.st_size == 0 && exclusive)
+    {
+        if (ring_buffer_init (buffer, fd, fd, order ? order : 12, sysconf(_SC_PAGESIZE)))
+            goto fail;
+        buffer->file_fd = fd;
+        if (ring_buffer_sync (buffer))
+            goto fail_mapped;
+    }
+    else
+    {
+        if (ring_buffer_map_fd (buffer, fd))
+            goto fail;
+        if (order && buffer->count_bytes != 1UL << order)
+        {
+            errno = EINVAL;
+            goto fail_mapped;
+        }
+        if (exclusive && ring_buffer_recover (buffer))
+            goto fail_mapped;
+        buffer->file_fd = fd;
+    }
+
+    if (exclusive)
+        flock (fd, LOCK_SH);
+    return 0;
+
+fail_mapped:
+    saved_errno = errno;
+    buffer->file_fd = -1; // nothing to commit
+    ring_buffer_free (buffer);
+    errno = saved_errno;
+
+fail:
+    saved_errno = errno;
+    close (fd);
+    errno = saved_errno;
+    return -1;
+}
+
+void
+ring_buffer_set_sync_policy (struct ring_buffer *buffer, int sync_policy, unsigned long interval_ns)
+{
+    buffer->sync_interval_ns = interval_ns;
+    buffer->last_sync_ns = monotonic_ns ();
+    buffer->sync_policy = buffer->file_fd >= 0 ? sync_policy : RING_BUFFER_SYNC_NONE;
+}
+
+/* Write back the data, then the offsets into the older commit slot. Data past the
+ * committed write offset, or a commit torn by a crash, is simply not recovered.
+ */
+int
+ring_buffer_sync (struct ring_buffer *buffer)
+{
+    struct ring_buffer_header *header = buffer->header;
+    struct ring_buffer_commit *newest, *next;
+    unsigned long write_offset_bytes, read_offset_bytes;
+    int status = -1;
+
+    if (buffer->file_fd < 0)
+        return 0;
+
+    while (__atomic_exchange_n (&header->sync_lock, 1, __ATOMIC_ACQUIRE))
+        sched_yield ();
+
+    /* an overwriting producer moves the read offset too; a read offset past the write
+     * offset loaded first means both moved, and a second look at the write offset covers it
+     */
+    write_offset_bytes = load_acquire (&header->write_offset_bytes);
+    read_offset_bytes = load_acquire (&header->read_offset_bytes);
+    if ((long)(write_offset_bytes - read_offset_bytes) < 0)
+        write_offset_bytes = load_acquire (&header->write_offset_bytes);
+
+    if (msync (buffer->address, buffer->count_bytes, MS_SYNC))
+        goto out;
+
+    newest = ring_buffer_newest_commit (buffer);
+    next = newest == &header->commits[0] ? &header->commits[1] : &header->commits[0];
+    next->generation = (newest ? newest->generation : 0) + 1;
+    next->write_offset_bytes = write_offset_bytes;
+    next->read_offset_bytes = read_offset_bytes;
+    next->checksum = commit_checksum (next, buffer->count_bytes);
+    if (msync (header, sysconf(_SC_PAGESIZE), MS_SYNC))
+        goto out;
+
+    buffer->last_sync_ns = monotonic_ns ();
+    status = 0;
+
+out:
+    __atomic_store_n (&header->sync_lock, 0, __ATOMIC_RELEASE);
+    return status;
+}
+
+/* Generation of the newest commit, 0 for a buffer that is not file-backed */
+unsigned long
+ring_buffer_generation (struct ring_buffer *buffer)
+{
+    struct ring_buffer_commit *commit;
+
+    if (buffer->file_fd < 0)
+        return 0;
+    commit = ring_buffer_newest_commit (buffer);
+    return commit ? commit->generation : 0;
+}
+
+/* Lift read_offset_bytes to the slowest open cursor. Any cursor's reader may do this, so
+ * it only ever moves forward; a stale look at another cursor just lifts it less.
+ */
+static void
+ring_buffer_cursors_release (struct ring_buffer *buffer)
+{
+    struct ring_buffer_header *header = buffer->header;
+    unsigned long slowest_offset_bytes = load_acquire (&header->write_offset_bytes);
+    unsigned long read_offset_bytes, offset_bytes;
+    int i;
+
+    for (i = 0; i < RING_BUFFER_MAX_CURSORS; i++)
+    {
+        if (load_acquire (&header->cursors[i].state) != RING_BUFFER_CURSOR_OPEN)
+            continue;
+        offset_bytes = load_acquire (&header->cursors[i].read_offset_bytes);
+        if ((long)(offset_bytes - slowest_offset_bytes) < 0)
+            slowest_offset_bytes = offset_bytes;
+    }
+
+    read_offset_bytes = load_acquire (&header->read_offset_bytes);
+    while ((long)(slowest_offset_bytes - read_offset_bytes) > 0)
+    {
+        if (__atomic_compare_exchange_n (&header->read_offset_bytes, &read_offset_bytes, slowest_offset_bytes,
+                                         0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        {
+            futex_wake_waiters (&header->writable_futex, &header->write_waiters);
+            break;
+        }
+    }
+}
+
+int
+ring_buffer_cursor_open (struct ring_buffer *buffer, const char *name)
+{
+    struct ring_buffer_header *header = buffer->header;
+    struct ring_buffer_cursor *cursor;
+    unsigned long read_offset_bytes;
+    size_t name_bytes = strlen (name);
+    int i, state;
+
+    if (name_bytes == 0 || name_bytes >= RING_BUFFER_CURSOR_NAME_BYTES)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for (i = 0; i < RING_BUFFER_MAX_CURSORS; i++)
+    {
+        if (load_acquire (&header->cursors[i].state) == RING_BUFFER_CURSOR_OPEN
+            && strcmp (header->cursors[i].name, name) == 0)
+            return i;
+    }
+
+    for (i = 0; i < RING_BUFFER_MAX_CURSORS; i++)
+    {
+        cursor = &header->cursors[i];
+        state = RING_BUFFER_CURSOR_FREE;
+        if (!__atomic_compare_exchange_n (&cursor->state, &state, RING_BUFFER_CURSOR_CLAIMED,
+                                          0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            continue;
+
+        memcpy (cursor->name, name, name_bytes + 1);
+        cursor->dropped_bytes = 0;
+        cursor->read_offset_bytes = load_acquire (&header->read_offset_bytes);
+        __atomic_store_n (&cursor->state, RING_BUFFER_CURSOR_OPEN, __ATOMIC_SEQ_CST);
+
+        /* a reader that looked at the cursors before this one opened may have lifted
+         * read_offset_bytes past it; start from there instead
+         */
+        read_offset_bytes = load_acquire (&header->read_offset_bytes);
+        if ((long)(read_offset_bytes - cursor->read_offset_bytes) > 0)
+            store_release (&cursor->read_offset_bytes, read_offset_bytes);
+        return i;
+    }
+
+    errno = ENOSPC;
+    return -1;
+}
+
+int
+ring_buffer_cursors_open (struct ring_buffer *buffer)
+{
+    int i, count = 0;
+
+    for (i = 0; i < RING_BUFFER_MAX_CURSORS; i++)
+    {
+        if (load_acquire (&buffer->header->cursors[i].state) != RING_BUFFER_CURSOR_FREE)
+            count++;
+    }
+    return count;
+}
+
+void
+ring_buffer_cursor_close (struct ring_buffer *buffer, int cursor)
+{
+    store_release (&buffer->header->cursors[cursor].state, RING_BUFFER_CURSOR_FREE);
+    ring_buffer_cursors_release (buffer);
+}
+
+/* The cursor's read offset, moved up past whatever an overwriting producer discarded */
+static unsigned long
+ring_buffer_cursor_offset (struct ring_buffer *buffer, struct ring_buffer_cursor *cursor)
+{
+    unsigned long offset_bytes = load_relaxed (&cursor->read_offset_bytes);
+    unsigned long read_offset_bytes = load_acquire (&buffer->header->read_offset_bytes);
+
+    if ((long)(read_offset_bytes - offset_bytes) > 0)
+    {
+        store_release (&cursor->dropped_bytes, load_relaxed (&cursor->dropped_bytes) + read_offset_bytes - offset_bytes);
+        store_release (&cursor->read_offset_bytes, read_offset_bytes);
+        offset_bytes = read_offset_bytes;
+    }
+    return offset_bytes;
+}
+
+unsigned long
+ring_buffer_cursor_count_bytes (struct ring_buffer *buffer, int cursor)
+{
+    unsigned long offset_bytes = ring_buffer_cursor_offset (buffer, &buffer->header->cursors[cursor]);
+
+    return load_acquire (&buffer->header->write_offset_bytes) - offset_bytes;
+}
+
+void *
+ring_buffer_cursor_read_address (struct ring_buffer *buffer, int cursor)
+{
+    unsigned long offset_bytes = ring_buffer_cursor_offset (buffer, &buffer->header->cursors[cursor]);
+
+    return buffer->address + (offset_bytes & (buffer->count_bytes - 1));
+}
+
+int
+ring_buffer_cursor_read_advance (struct ring_buffer *buffer, int cursor, unsigned long count_bytes)
+{
+    struct ring_buffer_cursor *state = &buffer->header->cursors[cursor];
+    unsigned long offset_bytes = load_relaxed (&state->read_offset_bytes);
+
+    // as in ring_buffer_snapshot: the copy, then a fresh look at what the producer discarded
+    if (load_relaxed (&buffer->header->overwrite))
+    {
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if ((long)(load_relaxed (&buffer->header->read_offset_bytes) - offset_bytes) > 0)
+            return -1;
+    }
+
+    store_release (&state->read_offset_bytes, offset_bytes + count_bytes);
+    buffer->consumer_stats.bytes_read += count_bytes;
+    buffer->consumer_stats.reads++;
+    ring_buffer_cursors_release (buffer);
+    return 0;
+}
+
+static int
+ring_buffer_cursor_is_readable (struct ring_buffer *buffer, int cursor, unsigned long min_bytes)
+{
+    return ring_buffer_cursor_count_bytes (buffer, cursor) >= min_bytes || ring_buffer_write_closed (buffer);
+}
+
+int
+ring_buffer_cursor_wait_readable (struct ring_buffer *buffer, int cursor, unsigned long min_bytes,
+                                  long timeout_ns)
+{
+    return ring_buffer_wait (buffer, &buffer->header->readable_futex, &buffer->header->read_waiters,
+                             ring_buffer_cursor_is_readable, cursor, min_bytes, timeout_ns,
+                             &buffer->consumer_stats.waits, &buffer->consumer_stats.wait_ns);
 }
@@ -1,36 +1,383 @@
 #ifndef BUFFER_H
 #define BUFFER_H
 
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define terminate_and_generate_core_dump() abort ()
 
+/* The producer only ever stores write_offset_bytes and the consumer only ever stores
+ * read_offset_bytes, so each side's counter gets its own cache line to avoid false sharing.
+ */
+#define RING_BUFFER_CACHE_LINE_BYTES 64
+#define ring_buffer_cache_aligned __attribute__ ((aligned (RING_BUFFER_CACHE_LINE_BYTES)))
 
-struct ring_buffer
-{
-    void *address;
 
-    unsigned long count_bytes; // buffer size in bytes
+#define RING_BUFFER_MAGIC 0x52494e4742554646UL // "RINGBUFF"
+
+/* Offsets of a file-backed buffer as of its last ring_buffer_sync, when every byte up to
+ * write_offset_bytes was on disk. The header keeps two and a sync overwrites the older
+ * one, so a crash halfway through a sync still leaves the other one to recover from.
+ */
+struct ring_buffer_commit
+{
+    unsigned long generation; // grows by one per sync, 0 for a slot never written
     unsigned long write_offset_bytes;
     unsigned long read_offset_bytes;
+    unsigned long checksum; // of the fields above and count_bytes, to detect torn writes
+};
+
+/* A named read position of a broadcast buffer, see ring_buffer_cursor_open */
+#define RING_BUFFER_MAX_CURSORS 8
+#define RING_BUFFER_CURSOR_NAME_BYTES 40
+
+#define RING_BUFFER_CURSOR_FREE 0
+#define RING_BUFFER_CURSOR_CLAIMED 1 // being set up by ring_buffer_cursor_open
+#define RING_BUFFER_CURSOR_OPEN 2
+
+struct ring_buffer_cursor
+{
+    unsigned long read_offset_bytes; // only its reader moves it
+    unsigned long dropped_bytes; // bytes an overwriting producer discarded before this reader got to them
+    int state;
+    char name[RING_BUFFER_CURSOR_NAME_BYTES];
+} ring_buffer_cache_aligned;
+
+/* Shared state of a ring buffer. It lives in the system page right in front of the data
+ * pages and, for shared buffers, in the first page of the shared object, so every process
+ * that maps the object sees the same offsets.
+ *
+ * The offsets are monotonic positions: they only ever grow and are masked by
+ * (count_bytes - 1) when turned into an address, so neither side has to rewrite the
+ * other side's counter when it wraps.
+ */
+struct ring_buffer_header
+{
+    unsigned long magic; // RING_BUFFER_MAGIC once the creator finished initializing the header
+    unsigned long count_bytes; // buffer size in bytes
     unsigned long end_offset_bytes; // when an IWriteEndpoint calls close(), the end_offset_bytes is assigned
                                     // the value of write_offset_bytes
-    long page_size; // unit of memory in bytes which is used by mmap to allocate memory
+    int write_closed;
+    int overwrite; // non-zero when the producer discards the oldest data instead of running full
+
+    /* producer cache line */
+    unsigned long write_offset_bytes ring_buffer_cache_aligned;
+    unsigned long dropped_bytes; // bytes the producer discarded in overwrite mode
+    unsigned long dropped_records; // whole records the producer discarded in overwrite mode
+
+    /* consumer cache line */
+    unsigned long read_offset_bytes ring_buffer_cache_aligned;
+
+    /* futex words, on their own line so the waiter checks in the advance calls only read a
+     * line that is written when somebody actually sleeps
+     */
+    unsigned int readable_futex ring_buffer_cache_aligned; // bumped by the producer to wake readers
+    unsigned int read_waiters; // consumers sleeping in ring_buffer_wait_readable
+    unsigned int writable_futex; // bumped by the consumer to wake writers
+    unsigned int write_waiters; // producers sleeping in ring_buffer_wait_writable
+
+    /* durable state of file-backed buffers, see ring_buffer_open_file */
+    struct ring_buffer_commit commits[2] ring_buffer_cache_aligned;
+    int sync_lock; // taken by whichever process or thread is in ring_buffer_sync
+
+    /* broadcast readers; read_offset_bytes then follows the slowest open cursor */
+    struct ring_buffer_cursor cursors[RING_BUFFER_MAX_CURSORS];
+};
+
+/* Counters each side keeps about itself, in this process only. Each set has a cache line
+ * of its own next to nothing the other side touches, so counting costs a few plain adds.
+ * Another thread reading them sees slightly stale values.
+ */
+struct ring_buffer_producer_stats
+{
+    unsigned long bytes_written;
+    unsigned long writes; // write advances
+    unsigned long full; // writes refused for lack of room
+    unsigned long high_water_bytes; // most readable bytes the producer saw when it had to look
+    unsigned long waits; // futex sleeps in ring_buffer_wait_writable
+    unsigned long wait_ns; // time spent in those sleeps
+};
+
+struct ring_buffer_consumer_stats
+{
+    unsigned long bytes_read;
+    unsigned long reads; // read advances
+    unsigned long empty; // reads that found too little data
+    unsigned long wraps; // read advances past the end of the first mapping
+    unsigned long high_water_bytes; // most readable bytes the consumer saw when it had to look
+    unsigned long waits; // futex sleeps in ring_buffer_wait_readable
+    unsigned long wait_ns; // time spent in those sleeps
+};
+
+/* Time-in-buffer sampling, see ring_buffer_enable_timestamps. The producer queues the write
+ * offset and time of each write advance, the consumer takes them off once its read offset
+ * passes them and counts now - then in a log2 histogram.
+ */
+#define RING_BUFFER_LATENCY_SAMPLES 1024
+#define RING_BUFFER_LATENCY_BUCKETS 64
+
+struct ring_buffer_latency
+{
+    unsigned long sample_offset_bytes[RING_BUFFER_LATENCY_SAMPLES];
+    unsigned long sample_ns[RING_BUFFER_LATENCY_SAMPLES];
+    unsigned long head ring_buffer_cache_aligned; // next sample the producer fills
+    unsigned long tail ring_buffer_cache_aligned; // next sample the consumer takes
+    unsigned long buckets[RING_BUFFER_LATENCY_BUCKETS]; // [i] counts latencies in [2^i, 2^(i+1)) ns
+};
+
+/* Delimiters up to this long get their scan position cached, see ring_buffer_find */
+#define RING_BUFFER_SCAN_DELIMITER_BYTES 16
+
+/* A single-producer/single-consumer ring buffer. One thread may call the write side
+ * (ring_buffer_write_*) while another thread calls the read side (ring_buffer_read_*)
+ * without external locking. With ring_buffer_create_shared and ring_buffer_attach the
+ * two sides may also be in different processes.
+ */
+struct ring_buffer
+{
+    void *address; // first data byte, the data is mapped twice back to back from here
+    struct ring_buffer_header *header;
+
+    unsigned long count_bytes; // buffer size in bytes, a local copy of header->count_bytes
+    long page_size; // unit of memory in bytes which is used by mmap to allocate the data
+    struct ring_buffer_latency *latency; // NULL until ring_buffer_enable_timestamps
+    int file_fd; // backing file of ring_buffer_open_file, -1 for memory-only buffers
+    int resizable; // a private memfd of normal pages, see ring_buffer_resize
+    int io_in_flight; // RING_BUFFER_IO_* operations an engine of uring.h has in flight, atomic
+    int sync_policy; // RING_BUFFER_SYNC_*, when the advances commit a file-backed buffer
+    unsigned long sync_interval_ns;
+    unsigned long last_sync_ns;
+
+    /* producer cache line */
+    unsigned long cached_read_offset_bytes ring_buffer_cache_aligned; // producer's last seen read_offset_bytes
+    int readable_fd; // eventfd the producer signals, -1 until ring_buffer_enable_eventfd
+    unsigned long readable_mark_bytes; // signal readable_fd when the readable bytes rise to this
+
+    /* consumer cache line */
+    unsigned long cached_write_offset_bytes ring_buffer_cache_aligned; // consumer's last seen write_offset_bytes
+    unsigned long claimed_read_offset_bytes; // read offset behind the last ring_buffer_read_address
+    int writable_fd; // eventfd the consumer signals, -1 until ring_buffer_enable_eventfd
+    unsigned long writable_mark_bytes; // signal writable_fd when the free bytes rise to this
+    unsigned long scan_offset_bytes; // no scan_delimiter starts between the read offset and this
+    unsigned long scan_delimiter_bytes; // 0 when nothing is cached
+    char scan_delimiter[RING_BUFFER_SCAN_DELIMITER_BYTES];
+
+    struct ring_buffer_producer_stats producer_stats ring_buffer_cache_aligned;
+    struct ring_buffer_consumer_stats consumer_stats ring_buffer_cache_aligned;
 };
 
+/* Allocation options for ring_buffer_create_with_options */
+struct ring_buffer_options
+{
+    unsigned long huge_page_bytes; // 0 for normal pages, or a huge page size such as 2 MiB or 1 GiB
+    int populate; // fault every page in up front instead of on first use
+    int lock; // mlock the data so it is never swapped out
+    int numa_node; // preferred NUMA node for the data, -1 for no preference
+};
+
+#define RING_BUFFER_DEFAULT_OPTIONS { 0, 0, 0, -1 }
+#define RING_BUFFER_MAX_NUMA_NODES 1024
+
 void ring_buffer_create (struct ring_buffer *buffer, unsigned long order);
+int ring_buffer_create_with_options (struct ring_buffer *buffer, unsigned long order,
+                                     const struct ring_buffer_options *options);
 void ring_buffer_free (struct ring_buffer *buffer);
+
+/* Change the capacity of a buffer from ring_buffer_create or ring_buffer_create_with_options
+ * (normal pages only) to 2^@order bytes, keeping what is readable. Only the readable bytes
+ * are copied, to where the unchanged offsets point in a new memfd mapped as usual, and the
+ * old pages go back to the system, so shrinking an idle buffer costs next to nothing.
+ * Neither side may run, wait or hold an address from the old mapping meanwhile, and the
+ * new pages are not prefaulted or locked. Fails with EINVAL for other buffers or an
+ * @order under the system page size, with ENOSPC when the readable bytes do not fit, and
+ * with EBUSY while a broadcast cursor is open or an I/O engine operation is in flight.
+ */
+int ring_buffer_resize (struct ring_buffer *buffer, unsigned long order);
+
+/* Give the pages that hold no readable byte back to the system. madvise(MADV_REMOVE)
+ * punches a hole in the memfd, shared memory object or file behind the data, so both
+ * mirror halves lose the page at once and it comes back zero-filled when next written.
+ * This belongs to the write side, like ring_buffer_write_advance: the free bytes can only
+ * grow under the producer, so the consumer may keep reading meanwhile, but the producer
+ * must not hold a ring_buffer_write_address it has not advanced. Return 0, or -1 with
+ * errno set, e.g. EINVAL for mlocked buffers, EOPNOTSUPP for files that cannot have holes
+ * or EBUSY while an I/O engine operation is in flight.
+ */
+int ring_buffer_trim (struct ring_buffer *buffer);
+
+/* Return how many data bytes are in memory (as per mincore, which counts both mirror
+ * halves once), or -1 with errno set.
+ */
+long ring_buffer_resident_bytes (struct ring_buffer *buffer);
+
+/* Named buffers in POSIX shared memory, for a producer and a consumer in different
+ * processes. These return 0 on success and -1 with errno set on failure.
+ */
+int ring_buffer_create_shared (struct ring_buffer *buffer, const char *name, unsigned long order);
+int ring_buffer_attach (struct ring_buffer *buffer, const char *name);
+int ring_buffer_unlink (const char *name);
+
 void * ring_buffer_write_address (struct ring_buffer *buffer);
 void ring_buffer_write_advance (struct ring_buffer *buffer, unsigned long count_bytes);
 void * ring_buffer_read_address (struct ring_buffer *buffer);
-void ring_buffer_read_advance (struct ring_buffer *buffer, unsigned long count_bytes);
+int ring_buffer_read_advance (struct ring_buffer *buffer, unsigned long count_bytes);
 unsigned long ring_buffer_count_bytes (struct ring_buffer *buffer);
 unsigned long ring_buffer_count_free_bytes (struct ring_buffer *buffer);
 void ring_buffer_clear (struct ring_buffer *buffer);
 
+/* Put a buffer back the way ring_buffer_create left it, to use it again without mapping a
+ * new one: empty, no open cursors, overwrite off, no eventfds, no timestamps and zeroed
+ * counters. Like ring_buffer_clear, not safe while either side is running.
+ */
+void ring_buffer_reset (struct ring_buffer *buffer);
+
+/* Side-local variants for the SPSC hot path: they only touch the other side's cache line
+ * when the cached offset says fewer than @count_bytes are available.
+ */
+unsigned long ring_buffer_producer_free_bytes (struct ring_buffer *buffer, unsigned long count_bytes);
+unsigned long ring_buffer_consumer_count_bytes (struct ring_buffer *buffer, unsigned long count_bytes);
+
+/* Sleep until at least @min_bytes are readable (or the producer closed the buffer) or
+ * writable. @timeout_ns < 0 waits forever. Return 0 when the condition holds, -1 with
+ * errno ETIMEDOUT, EINTR, or the futex error (such as EFAULT) otherwise. The other side
+ * only makes a futex syscall when somebody is waiting.
+ */
+int ring_buffer_wait_readable (struct ring_buffer *buffer, unsigned long min_bytes, long timeout_ns);
+int ring_buffer_wait_writable (struct ring_buffer *buffer, unsigned long min_bytes, long timeout_ns);
+
+/* Edge-triggered eventfds for event loops. readable_fd is signalled by this process'
+ * ring_buffer_write_advance when the readable bytes cross up to the readable mark (and
+ * by ring_buffer_write_close), writable_fd by ring_buffer_read_advance when the free
+ * bytes cross up to the writable mark. Both marks default to 1, i.e. empty to non-empty
+ * and full to non-full. After draining the eventfd, re-check the buffer before sleeping.
+ */
+int ring_buffer_enable_eventfd (struct ring_buffer *buffer);
+void ring_buffer_set_readable_mark (struct ring_buffer *buffer, unsigned long count_bytes);
+void ring_buffer_set_writable_mark (struct ring_buffer *buffer, unsigned long count_bytes);
+
 /* For libbrowzoo.python.interface.stream.IReadEndpoint and IWriteEndpoint */
 void ring_buffer_write (struct ring_buffer *buffer, char *data, unsigned long count_bytes);
 void ring_buffer_read (struct ring_buffer *buffer, char *data, unsigned long count_bytes);
 void ring_buffer_write_close (struct ring_buffer *buffer);
 int ring_buffer_eof (struct ring_buffer *buffer);
+int ring_buffer_write_closed (struct ring_buffer *buffer);
 void ring_buffer_peek (struct ring_buffer *buffer, char *data, int count_bytes);
 
+/* Scatter/gather copies. ring_buffer_writev copies every piece with one advance, or
+ * nothing and returns -1 if they do not all fit. ring_buffer_readv fills the pieces in
+ * order with as many readable bytes as there are. Both return the bytes copied.
+ */
+long ring_buffer_writev (struct ring_buffer *buffer, const struct iovec *iov, int iovcnt);
+long ring_buffer_readv (struct ring_buffer *buffer, const struct iovec *iov, int iovcnt);
+
+/* Move bytes between the buffer and a file descriptor without an intermediate copy:
+ * read(2) lands straight at ring_buffer_write_address and write(2) sends straight from
+ * ring_buffer_read_address. @max_bytes of 0 means as many as fit or are readable.
+ * Return the bytes moved (0 from ring_buffer_fill_from_fd is end of file), or -1 with
+ * errno set.
+ */
+long ring_buffer_fill_from_fd (struct ring_buffer *buffer, int fd, unsigned long max_bytes);
+long ring_buffer_drain_to_fd (struct ring_buffer *buffer, int fd, unsigned long max_bytes);
+
+/* Record framing: each record is a native-endian uint32 payload length followed by the
+ * payload, written with one advance so the consumer never sees half a record. Thanks to
+ * the mirror mapping a record is contiguous even when it wraps. Do not mix records and
+ * plain reads/writes on one buffer.
+ */
+#define RING_BUFFER_RECORD_HEADER_BYTES 4UL
+
+int ring_buffer_push_record (struct ring_buffer *buffer, const char *data, unsigned long count_bytes);
+void * ring_buffer_front_record (struct ring_buffer *buffer, unsigned long *count_bytes);
+int ring_buffer_pop_record (struct ring_buffer *buffer);
+
+/* Return how far from ring_buffer_read_address the first @delimiter starts, or -1 if the
+ * readable bytes hold none. Consumer side. The mirror mapping makes the readable bytes
+ * one run even across the wrap, so this is a single memchr/memmem, which glibc
+ * vectorizes. Where a miss stopped is remembered, so asking again for the same delimiter
+ * after more bytes came in only scans the new ones.
+ */
+long ring_buffer_find (struct ring_buffer *buffer, const char *delimiter, unsigned long delimiter_bytes);
+
+/* Broadcast: one producer, up to RING_BUFFER_MAX_CURSORS readers that each see every
+ * byte. ring_buffer_cursor_open returns the index of the cursor called @name (up to
+ * RING_BUFFER_CURSOR_NAME_BYTES - 1 bytes), resuming it if it is open, in this process or
+ * another one; a new cursor starts at the oldest byte the buffer still holds. It fails with
+ * ENOSPC when all cursors are in use.
+ *
+ * Every cursor advance lifts read_offset_bytes to the slowest open cursor, so the producer
+ * and its waits see the room the slowest reader left, and need no changes. In overwrite
+ * mode the producer does not wait for anybody: a cursor it passes skips ahead and counts
+ * what it missed in its dropped_bytes, and ring_buffer_cursor_read_advance returns -1 when
+ * the bytes were discarded while being copied, as ring_buffer_read_advance does.
+ *
+ * Once a cursor is open the plain read side must not be used. Each cursor has one reader
+ * at a time. Closing the last cursor frees everything that is still unread.
+ */
+int ring_buffer_cursor_open (struct ring_buffer *buffer, const char *name);
+int ring_buffer_cursors_open (struct ring_buffer *buffer); // cursors open in any process
+void ring_buffer_cursor_close (struct ring_buffer *buffer, int cursor);
+unsigned long ring_buffer_cursor_count_bytes (struct ring_buffer *buffer, int cursor);
+void * ring_buffer_cursor_read_address (struct ring_buffer *buffer, int cursor);
+int ring_buffer_cursor_read_advance (struct ring_buffer *buffer, int cursor, unsigned long count_bytes);
+int ring_buffer_cursor_wait_readable (struct ring_buffer *buffer, int cursor, unsigned long min_bytes,
+                                      long timeout_ns);
+
+/* Overwrite mode, for flight recorders that must never block the producer: writes that do
+ * not fit move the read offset forward over the oldest bytes, or the oldest whole records,
+ * and count what they dropped. Turn it on before either side runs.
+ *
+ * The producer and the consumer then both move read_offset_bytes, so the consumer's
+ * ring_buffer_read_advance and ring_buffer_pop_record become compare-and-swaps that return
+ * -1, consuming nothing, when the producer discarded the bytes the consumer just copied;
+ * the consumer copies again from the new ring_buffer_read_address. ring_buffer_read,
+ * ring_buffer_readv and the record calls retry on their own. ring_buffer_drain_to_fd
+ * cannot take back what it wrote, so do not use it in this mode.
+ */
+void ring_buffer_set_overwrite (struct ring_buffer *buffer, int overwrite);
+int ring_buffer_overwrite (struct ring_buffer *buffer);
+unsigned long ring_buffer_make_room (struct ring_buffer *buffer, unsigned long count_bytes, int whole_records);
+unsigned long ring_buffer_dropped_bytes (struct ring_buffer *buffer);
+unsigned long ring_buffer_dropped_records (struct ring_buffer *buffer);
+
+/* Start sampling time-in-buffer for this process' producer and consumer. Return 0, or -1
+ * with errno set. ring_buffer_reset_stats zeroes both sides' counters and the histogram.
+ */
+int ring_buffer_enable_timestamps (struct ring_buffer *buffer);
+void ring_buffer_reset_stats (struct ring_buffer *buffer);
+
+/* File-backed buffers, a spool that survives restarts. ring_buffer_open_file maps the
+ * regular file @path (header page, then 2^@order data bytes) as ring_buffer_create_shared
+ * maps a shared memory object, creating it if it does not exist; @order 0 takes the size
+ * of an existing file and makes a new one 4 KiB. The first process to open the file after
+ * everybody closed it (or crashed) rolls the offsets back to the last commit, so records
+ * written after it are lost and records read after it are read again. Later openers share
+ * the live buffer like ring_buffer_attach. Return 0, or -1 with errno set.
+ *
+ * ring_buffer_sync makes everything written so far durable, then commits both offsets.
+ * The sync policy makes the advances do it too: after every advance, or once
+ * @interval_ns passed since the last sync. ring_buffer_free always syncs.
+ */
+#define RING_BUFFER_SYNC_NONE 0
+#define RING_BUFFER_SYNC_ALWAYS 1
+#define RING_BUFFER_SYNC_INTERVAL 2
+
+int ring_buffer_open_file (struct ring_buffer *buffer, const char *path, unsigned long order);
+void ring_buffer_set_sync_policy (struct ring_buffer *buffer, int sync_policy, unsigned long interval_ns);
+int ring_buffer_sync (struct ring_buffer *buffer);
+unsigned long ring_buffer_generation (struct ring_buffer *buffer);
+
+/* Copy the readable bytes into @data, which holds at least count_bytes, without consuming
+ * them. The copy is one consistent window even while an overwriting producer laps the
+ * consumer; it starts on a record boundary when only records are pushed and popped.
+ * Return the bytes copied.
+ */
+unsigned long ring_buffer_snapshot (struct ring_buffer *buffer, char *data);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
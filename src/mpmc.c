@@ -0,0 +1,208 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE 1
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mpmc.h"
+
+#define load_relaxed(p) __atomic_load_n ((p), __ATOMIC_RELAXED)
+#define load_acquire(p) __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+
+/* A slot holds the record for position p when sequence == p + 1 and is free for position
+ * p when sequence == p. Popping position p frees the slot for p + capacity.
+ */
+struct mpmc_slot
+{
+    unsigned long sequence;
+    unsigned long count_bytes;
+    char data[];
+};
+
+#define slot_at(queue, position) \
+    ((struct mpmc_slot *)((queue)->slots + ((position) & ((queue)->capacity - 1)) * (queue)->slot_bytes))
+
+/* Construct an empty queue of 2^@order slots holding records of up to @max_record_bytes
+ */
+int
+mpmc_queue_create (struct mpmc_queue *queue, unsigned long order, unsigned long max_record_bytes)
+{
+    unsigned long position;
+    int status;
+
+    queue->capacity = 1UL << order;
+    queue->max_record_bytes = max_record_bytes;
+    // round every slot up to whole cache lines so neighbours do not false-share
+    queue->slot_bytes = (sizeof (struct mpmc_slot) + max_record_bytes + RING_BUFFER_CACHE_LINE_BYTES - 1)
+                        & ~(RING_BUFFER_CACHE_LINE_BYTES - 1UL);
+
+    status = posix_memalign ((void **)&queue->slots, RING_BUFFER_CACHE_LINE_BYTES,
+                             queue->capacity * queue->slot_bytes);
+    if (status)
+    {
+        queue->slots = NULL;
+        errno = status;
+        return -1;
+    }
+
+    for (position = 0; position < queue->capacity; position++)
+        slot_at (queue, position)->sequence = position;
+    queue->enqueue_position = 0;
+    queue->dequeue_position = 0;
+
+    return 0;
+}
+
+void
+mpmc_queue_free (struct mpmc_queue *queue)
+{
+    if (queue == NULL)
+        return;
+
+    free (queue->slots);
+    queue->slots = NULL;
+}
+
+/* Claim up to @count consecutive positions from *@position whose slots are ready, i.e.
+ * have sequence == position + @ready_offset. Store the first claimed position in @first
+ * and return how many were claimed, 0 when the next slot is not ready (full or empty).
+ */
+static unsigned long
+mpmc_queue_claim (struct mpmc_queue *queue, unsigned long *position, unsigned long ready_offset,
+                  unsigned long count, unsigned long *first)
+{
+    unsigned long start = load_relaxed (position);
+    unsigned long claimed;
+    long difference;
+
+    for (;;)
+    {
+        difference = 0;
+        for (claimed = 0; claimed < count; claimed++)
+        {
+            difference = (long)(load_acquire (&slot_at (queue, start + claimed)->sequence)
+                                - (start + claimed + ready_offset));
+            if (difference != 0)
+                break;
+        }
+
+        if (claimed == 0)
+        {
+            if (difference < 0)
+                return 0; // the slot is still a lap behind
+            start = load_relaxed (position); // another thread took this position
+            continue;
+        }
+
+        /* Nobody can take positions past @position without moving it, so the slots checked
+         * above stay ready until the CAS publishes the claim.
+         */
+        if (__atomic_compare_exchange_n (position, &start, start + claimed, 1,
+                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        {
+            *first = start;
+            return claimed;
+        }
+    }
+}
+
+int
+mpmc_queue_try_push (struct mpmc_queue *queue, const char *data, unsigned long count_bytes)
+{
+    struct iovec record;
+
+    record.iov_base = (void *)data;
+    record.iov_len = count_bytes;
+    if (count_bytes > queue->max_record_bytes)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    if (mpmc_queue_try_push_many (queue, &record, 1) == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return 0;
+}
+
+long
+mpmc_queue_try_pop (struct mpmc_queue *queue, char *data)
+{
+    struct iovec record;
+
+    record.iov_base = data;
+    if (mpmc_queue_try_pop_many (queue, &record, 1) == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+
+    return record.iov_len;
+}
+
+/* Records larger than max_record_bytes end the batch; they are not pushed.
+ */
+int
+mpmc_queue_try_push_many (struct mpmc_queue *queue, const struct iovec *records, int count)
+{
+    unsigned long first, claimed, i;
+    struct mpmc_slot *slot;
+    int fitting;
+
+    for (fitting = 0; fitting < count; fitting++)
+    {
+        if (records[fitting].iov_len > queue->max_record_bytes)
+            break;
+    }
+    if (fitting == 0)
+        return 0;
+
+    claimed = mpmc_queue_claim (queue, &queue->enqueue_position, 0, fitting, &first);
+    for (i = 0; i < claimed; i++)
+    {
+        slot = slot_at (queue, first + i);
+        slot->count_bytes = records[i].iov_len;
+        memcpy (slot->data, records[i].iov_base, records[i].iov_len);
+        store_release (&slot->sequence, first + i + 1);
+    }
+
+    return claimed;
+}
+
+int
+mpmc_queue_try_pop_many (struct mpmc_queue *queue, struct iovec *records, int count)
+{
+    unsigned long first, claimed, i;
+    struct mpmc_slot *slot;
+
+    if (count <= 0)
+        return 0;
+
+    claimed = mpmc_queue_claim (queue, &queue->dequeue_position, 1, count, &first);
+    for (i = 0; i < claimed; i++)
+    {
+        slot = slot_at (queue, first + i);
+        records[i].iov_len = slot->count_bytes;
+        memcpy (records[i].iov_base, slot->data, slot->count_bytes);
+        store_release (&slot->sequence, first + i + queue->capacity);
+    }
+
+    return claimed;
+}
+
+unsigned long
+mpmc_queue_count (struct mpmc_queue *queue)
+{
+    unsigned long dequeue_position = load_acquire (&queue->dequeue_position);
+    unsigned long enqueue_position = load_acquire (&queue->enqueue_position);
+
+    /* the two loads are not atomic together, so a racing pop can make this look negative */
+    if (enqueue_position < dequeue_position)
+        return 0;
+    return enqueue_position - dequeue_position;
+}
@@ -0,0 +1,60 @@
+#ifndef MPMC_H
+#define MPMC_H
+
+#include <sys/uio.h>
+
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A bounded multi-producer/multi-consumer queue of records of up to max_record_bytes,
+ * after Dmitry Vyukov's bounded MPMC queue. Every slot carries a sequence number that
+ * tells producers and consumers whose turn it is, so the only shared writes are one CAS
+ * on enqueue_position or dequeue_position per operation (or per batch). No locks.
+ */
+struct mpmc_queue
+{
+    char *slots;
+    unsigned long capacity; // number of slots, a power of two
+    unsigned long slot_bytes; // stride between slots, a multiple of the cache line
+    unsigned long max_record_bytes;
+
+    /* producers' cache line */
+    unsigned long enqueue_position ring_buffer_cache_aligned;
+
+    /* consumers' cache line */
+    unsigned long dequeue_position ring_buffer_cache_aligned;
+};
+
+/* These return 0 on success and -1 with errno set on failure */
+int mpmc_queue_create (struct mpmc_queue *queue, unsigned long order, unsigned long max_record_bytes);
+void mpmc_queue_free (struct mpmc_queue *queue);
+
+/* Append one record. Return 0, or -1 with errno EAGAIN when the queue is full or
+ * EMSGSIZE when @count_bytes exceeds max_record_bytes.
+ */
+int mpmc_queue_try_push (struct mpmc_queue *queue, const char *data, unsigned long count_bytes);
+
+/* Remove the oldest record into @data, which must hold max_record_bytes. Return its size,
+ * or -1 with errno EAGAIN when the queue is empty.
+ */
+long mpmc_queue_try_pop (struct mpmc_queue *queue, char *data);
+
+/* Batch variants: claim up to @count consecutive slots with a single CAS. push_many
+ * appends the records in order, pop_many fills @records[i].iov_base (each holding
+ * max_record_bytes) and sets iov_len to the record sizes. Both return the number of
+ * records moved, which may be 0.
+ */
+int mpmc_queue_try_push_many (struct mpmc_queue *queue, const struct iovec *records, int count);
+int mpmc_queue_try_pop_many (struct mpmc_queue *queue, struct iovec *records, int count);
+
+/* Approximate number of records, exact when nobody is pushing or popping */
+unsigned long mpmc_queue_count (struct mpmc_queue *queue);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,330 @@
+#ifndef RING_BUFFER_HPP
+#define RING_BUFFER_HPP
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+
+#include "buffer.h"
+
+/* Header-only C++ front end to the C ring buffer with the capacity as a template parameter,
+ * so the offset mask is a constant and the record push/pop hot paths inline into callers.
+ * The mapping, shared memory, waits and eventfds stay in buffer.c; records use the same
+ * framing as ring_buffer_push_record, so C, C++ and Python ends can share one buffer.
+ *
+ *     ringbuffer::RingBuffer<20> ring;                 // 1 MiB, one producer, one consumer
+ *     ring.try_push (sample);                          // any trivially copyable type
+ *     if (ring.try_pop (sample)) ...
+ *
+ * Errors creating or attaching throw std::system_error. A RingBuffer is cache-line aligned;
+ * before C++17 allocate it on the stack, statically or as a member, not with plain new.
+ */
+namespace ringbuffer
+{
+
+/* One producer thread and one consumer thread, no locks */
+struct Spsc
+{
+    static constexpr bool locked = false;
+    static constexpr bool lossy = false;
+};
+
+/* Any number of producer and consumer threads, serialized per side by a spin lock */
+struct Mpmc
+{
+    static constexpr bool locked = true;
+    static constexpr bool lossy = false;
+};
+
+/* One producer that drops the oldest records instead of running full, one consumer */
+struct Lossy
+{
+    static constexpr bool locked = false;
+    static constexpr bool lossy = true;
+};
+
+struct create_shared_t {};
+struct attach_t {};
+constexpr create_shared_t create_shared {};
+constexpr attach_t attach {};
+
+namespace detail
+{
+
+class SpinLock
+{
+public:
+    void lock () { while (flag_.test_and_set (std::memory_order_acquire)) std::this_thread::yield (); }
+    void unlock () { flag_.clear (std::memory_order_release); }
+
+private:
+    std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+};
+
+struct NoLock
+{
+    void lock () {}
+    void unlock () {}
+};
+
+template <class Lock>
+class Guard
+{
+public:
+    explicit Guard (Lock &lock) : lock_ (lock) { lock_.lock (); }
+    ~Guard () { lock_.unlock (); }
+
+private:
+    Lock &lock_;
+};
+
+/* Same as futex_wake_waiters in buffer.c: the caller's offset store, a full fence, then
+ * a syscall only if somebody sleeps.
+ */
+inline void
+wake_waiters (unsigned int *futex, unsigned int *waiters)
+{
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (__atomic_load_n (waiters, __ATOMIC_RELAXED) == 0)
+        return;
+
+    __atomic_add_fetch (futex, 1, __ATOMIC_RELEASE);
+    syscall (SYS_futex, futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+} // namespace detail
+
+template <unsigned Order, class Policy = Spsc>
+class RingBuffer
+{
+    static_assert (Order >= 12, "Order is too small, which has to be at least 12");
+    static_assert (Order < 8 * sizeof (unsigned long) - 1, "Order does not fit the offsets");
+    static_assert (!(Policy::locked && Policy::lossy), "a lossy buffer has one producer and one consumer");
+
+    typedef typename std::conditional<Policy::locked, detail::SpinLock, detail::NoLock>::type Lock;
+
+public:
+    static constexpr unsigned long capacity () { return 1UL << Order; }
+    static constexpr unsigned long mask () { return capacity () - 1; }
+    static constexpr unsigned long max_record_bytes () { return capacity () - RING_BUFFER_RECORD_HEADER_BYTES; }
+
+    template <class T>
+    static constexpr bool fits () { return sizeof (T) <= max_record_bytes (); }
+
+    RingBuffer () : RingBuffer (ring_buffer_options RING_BUFFER_DEFAULT_OPTIONS) {}
+
+    explicit RingBuffer (const ring_buffer_options &options)
+    {
+        if (ring_buffer_create_with_options (&buffer_, Order, &options))
+            throw std::system_error (errno, std::system_category (), "ring_buffer_create_with_options");
+        if (Policy::lossy)
+            ring_buffer_set_overwrite (&buffer_, 1);
+    }
+
+    RingBuffer (create_shared_t, const char *name)
+    {
+        if (ring_buffer_create_shared (&buffer_, name, Order))
+            throw std::system_error (errno, std::system_category (), name);
+        if (Policy::lossy)
+            ring_buffer_set_overwrite (&buffer_, 1);
+    }
+
+    /* Attach a buffer another process created; its size has to match Order */
+    RingBuffer (attach_t, const char *name)
+    {
+        if (ring_buffer_attach (&buffer_, name))
+            throw std::system_error (errno, std::system_category (), name);
+        if (buffer_.count_bytes != capacity ())
+        {
+            ring_buffer_free (&buffer_);
+            throw std::system_error (EINVAL, std::system_category (), name);
+        }
+    }
+
+    ~RingBuffer () { ring_buffer_free (&buffer_); }
+
+    RingBuffer (const RingBuffer &) = delete;
+    RingBuffer &operator= (const RingBuffer &) = delete;
+
+    /* Append one record. Return false if it does not fit right now (never for Lossy,
+     * unless it is bigger than max_record_bytes()).
+     */
+    bool try_push (const void *data, unsigned long count_bytes);
+
+    template <class T>
+    bool try_push (const T &record)
+    {
+        static_assert (std::is_trivially_copyable<T>::value, "records are copied bytewise");
+        static_assert (fits<T> (), "the record does not fit the buffer");
+        return try_push (&record, sizeof record);
+    }
+
+    /* Copy the oldest record into @data and drop it. Return its size, or -1 if there is no
+     * record. Throws std::length_error, leaving the record, if it is over @max_bytes.
+     */
+    long try_pop (void *data, unsigned long max_bytes) { return pop (data, max_bytes, false); }
+
+    /* Pop a record pushed as a T. Throws std::length_error, leaving the record, if its
+     * size is not sizeof (T).
+     */
+    template <class T>
+    bool try_pop (T &record)
+    {
+        static_assert (std::is_trivially_copyable<T>::value, "records are copied bytewise");
+        static_assert (fits<T> (), "the record does not fit the buffer");
+        return pop (&record, sizeof record, true) >= 0;
+    }
+
+    unsigned long size () const { return ring_buffer_count_bytes (const_cast<struct ring_buffer *> (&buffer_)); }
+    bool empty () const { return size () == 0; }
+
+    /* For the C API: waits, eventfds, stats, snapshots */
+    struct ring_buffer *c_buffer () { return &buffer_; }
+
+private:
+    long pop (void *data, unsigned long max_bytes, bool exact);
+    void publish (unsigned long write_offset_bytes, unsigned long count_bytes);
+    void release (unsigned long read_offset_bytes, unsigned long count_bytes);
+
+    static void check_length (unsigned long length, unsigned long max_bytes, bool exact)
+    {
+        if (exact ? length != max_bytes : length > max_bytes)
+            throw std::length_error ("record size does not match the destination");
+    }
+
+    struct ring_buffer buffer_;
+    alignas (RING_BUFFER_CACHE_LINE_BYTES) Lock producer_lock_;
+    alignas (RING_BUFFER_CACHE_LINE_BYTES) Lock consumer_lock_;
+};
+
+template <unsigned Order, class Policy>
+inline bool
+RingBuffer<Order, Policy>::try_push (const void *data, unsigned long count_bytes)
+{
+    unsigned long record_bytes = RING_BUFFER_RECORD_HEADER_BYTES + count_bytes;
+    std::uint32_t length = count_bytes;
+
+    if (count_bytes > max_record_bytes ())
+        return false;
+
+    detail::Guard<Lock> guard (producer_lock_);
+    unsigned long write_offset_bytes = __atomic_load_n (&buffer_.header->write_offset_bytes, __ATOMIC_RELAXED);
+
+    // the cached read offset decides the common case without touching the consumer's line
+    if (capacity () - (write_offset_bytes - buffer_.cached_read_offset_bytes) < record_bytes)
+    {
+        if (Policy::lossy)
+            ring_buffer_make_room (&buffer_, record_bytes, 1);
+        if (ring_buffer_producer_free_bytes (&buffer_, record_bytes) < record_bytes)
+        {
+            buffer_.producer_stats.full++;
+            return false;
+        }
+    }
+
+    char *address = static_cast<char *> (buffer_.address) + (write_offset_bytes & mask ());
+    std::memcpy (address, &length, RING_BUFFER_RECORD_HEADER_BYTES);
+    std::memcpy (address + RING_BUFFER_RECORD_HEADER_BYTES, data, count_bytes);
+    publish (write_offset_bytes + record_bytes, record_bytes);
+
+    return true;
+}
+
+template <unsigned Order, class Policy>
+inline long
+RingBuffer<Order, Policy>::pop (void *data, unsigned long max_bytes, bool exact)
+{
+    unsigned long length;
+
+    detail::Guard<Lock> guard (consumer_lock_);
+
+    // the producer moves the read offset too, so the C calls do the compare-and-swap
+    if (Policy::lossy)
+    {
+        for (;;)
+        {
+            const char *record = static_cast<const char *> (ring_buffer_front_record (&buffer_, &length));
+            if (record == NULL)
+                return -1;
+            if (exact ? length != max_bytes : length > max_bytes)
+            {
+                // only a length the producer did not overwrite meanwhile is worth an exception
+                if (__atomic_load_n (&buffer_.header->read_offset_bytes, __ATOMIC_ACQUIRE) == buffer_.claimed_read_offset_bytes)
+                    check_length (length, max_bytes, exact);
+                continue;
+            }
+            std::memcpy (data, record, length);
+            if (ring_buffer_pop_record (&buffer_) == 0)
+                return length;
+        }
+    }
+
+    unsigned long read_offset_bytes = __atomic_load_n (&buffer_.header->read_offset_bytes, __ATOMIC_RELAXED);
+    if (buffer_.cached_write_offset_bytes - read_offset_bytes < RING_BUFFER_RECORD_HEADER_BYTES
+        && ring_buffer_consumer_count_bytes (&buffer_, RING_BUFFER_RECORD_HEADER_BYTES) < RING_BUFFER_RECORD_HEADER_BYTES)
+    {
+        buffer_.consumer_stats.empty++;
+        return -1;
+    }
+
+    const char *address = static_cast<const char *> (buffer_.address) + (read_offset_bytes & mask ());
+    std::uint32_t header_length;
+    std::memcpy (&header_length, address, RING_BUFFER_RECORD_HEADER_BYTES);
+    length = header_length;
+    check_length (length, max_bytes, exact);
+
+    std::memcpy (data, address + RING_BUFFER_RECORD_HEADER_BYTES, length);
+    release (read_offset_bytes + RING_BUFFER_RECORD_HEADER_BYTES + length, RING_BUFFER_RECORD_HEADER_BYTES + length);
+
+    return length;
+}
+
+/* ring_buffer_write_advance, inlined. Eventfds, timestamps and syncs take the C call. */
+template <unsigned Order, class Policy>
+inline void
+RingBuffer<Order, Policy>::publish (unsigned long write_offset_bytes, unsigned long count_bytes)
+{
+    if (buffer_.readable_fd >= 0 || buffer_.latency || buffer_.sync_policy != RING_BUFFER_SYNC_NONE)
+    {
+        ring_buffer_write_advance (&buffer_, count_bytes);
+        return;
+    }
+
+    __atomic_store_n (&buffer_.header->write_offset_bytes, write_offset_bytes, __ATOMIC_RELEASE);
+    buffer_.producer_stats.bytes_written += count_bytes;
+    buffer_.producer_stats.writes++;
+    detail::wake_waiters (&buffer_.header->readable_futex, &buffer_.header->read_waiters);
+}
+
+/* ring_buffer_read_advance, inlined. Eventfds, timestamps and syncs take the C call. */
+template <unsigned Order, class Policy>
+inline void
+RingBuffer<Order, Policy>::release (unsigned long read_offset_bytes, unsigned long count_bytes)
+{
+    if (buffer_.writable_fd >= 0 || buffer_.latency || buffer_.sync_policy != RING_BUFFER_SYNC_NONE)
+    {
+        ring_buffer_read_advance (&buffer_, count_bytes);
+        return;
+    }
+
+    __atomic_store_n (&buffer_.header->read_offset_bytes, read_offset_bytes, __ATOMIC_RELEASE);
+    buffer_.claimed_read_offset_bytes = read_offset_bytes;
+    buffer_.consumer_stats.bytes_read += count_bytes;
+    buffer_.consumer_stats.reads++;
+    if (((read_offset_bytes - count_bytes) ^ read_offset_bytes) & ~mask ())
+        buffer_.consumer_stats.wraps++;
+    detail::wake_waiters (&buffer_.header->writable_futex, &buffer_.header->write_waiters);
+}
+
+} // namespace ringbuffer
+
+#endif
@@ -0,0 +1,416 @@
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE 1
+#endif
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#define load_acquire(p) __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+
+/* Submissions are batched, so a queue this deep covers most polls with one syscall */
+#define RING_BUFFER_IO_MAX_SQ_ENTRIES 256U
+
+/* glibc has no wrappers for these */
+static int
+io_uring_setup (unsigned int entries, struct io_uring_params *params)
+{
+    return syscall (__NR_io_uring_setup, entries, params);
+}
+
+static int
+io_uring_enter (int ring_fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags,
+                void *arg, size_t arg_bytes)
+{
+    return syscall (__NR_io_uring_enter, ring_fd, to_submit, min_complete, flags, arg, arg_bytes);
+}
+
+/* Map the rings of a new io_uring. Return 0, or -1 with errno set and nothing mapped. */
+static int
+ring_buffer_io_setup (struct ring_buffer_io *io, unsigned int max_ops)
+{
+    struct io_uring_params params;
+    unsigned int sq_entries = max_ops < RING_BUFFER_IO_MAX_SQ_ENTRIES ? max_ops : RING_BUFFER_IO_MAX_SQ_ENTRIES;
+    int saved_errno;
+
+    /* every operation in flight may complete before the next poll, so the completion
+     * queue holds them all and never overflows
+     */
+    memset (&params, 0, sizeof params);
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = max_ops;
+    io->ring_fd = io_uring_setup (sq_entries, &params);
+    if (io->ring_fd < 0)
+        return -1;
+    io->features = params.features;
+
+    io->sq_ring_bytes = params.sq_off.array + params.sq_entries * sizeof (unsigned int);
+    io->cq_ring_bytes = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+    if (io->features & IORING_FEAT_SINGLE_MMAP && io->cq_ring_bytes > io->sq_ring_bytes)
+        io->sq_ring_bytes = io->cq_ring_bytes;
+
+    io->sq_ring = mmap (NULL, io->sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        io->ring_fd, IORING_OFF_SQ_RING);
+    if (io->sq_ring == MAP_FAILED)
+        goto fail;
+    if (io->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        io->cq_ring = io->sq_ring;
+    }
+    else
+    {
+        io->cq_ring = mmap (NULL, io->cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                            io->ring_fd, IORING_OFF_CQ_RING);
+        if (io->cq_ring == MAP_FAILED)
+        {
+            munmap (io->sq_ring, io->sq_ring_bytes);
+            goto fail;
+        }
+    }
+    io->sqes_bytes = params.sq_entries * sizeof (struct io_uring_sqe);
+    io->sqes = mmap (NULL, io->sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     io->ring_fd, IORING_OFF_SQES);
+    if (io->sqes == MAP_FAILED)
+    {
+        if (io->cq_ring != io->sq_ring)
+            munmap (io->cq_ring, io->cq_ring_bytes);
+        munmap (io->sq_ring, io->sq_ring_bytes);
+        goto fail;
+    }
+
+    io->sq_head = io->sq_ring + params.sq_off.head;
+    io->sq_tail = io->sq_ring + params.sq_off.tail;
+    io->sq_mask = *(unsigned int *)(io->sq_ring + params.sq_off.ring_mask);
+    io->sq_array = io->sq_ring + params.sq_off.array;
+    io->sq_entries = params.sq_entries;
+    io->cq_head = io->cq_ring + params.cq_off.head;
+    io->cq_tail = io->cq_ring + params.cq_off.tail;
+    io->cq_mask = *(unsigned int *)(io->cq_ring + params.cq_off.ring_mask);
+    io->cqes = io->cq_ring + params.cq_off.cqes;
+    return 0;
+
+fail:
+    saved_errno = errno;
+    close (io->ring_fd);
+    io->ring_fd = -1;
+    errno = saved_errno;
+    return -1;
+}
+
+int
+ring_buffer_io_create (struct ring_buffer_io *io, unsigned int max_ops, int flags)
+{
+    unsigned int i;
+
+    memset (io, 0, sizeof *io);
+    io->ring_fd = -1;
+    if (max_ops == 0)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    io->max_ops = max_ops;
+    io->ops = calloc (max_ops, sizeof *io->ops);
+    io->free_ops = malloc (max_ops * sizeof *io->free_ops);
+    if (io->ops == NULL || io->free_ops == NULL)
+    {
+        free (io->ops);
+        free (io->free_ops);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < max_ops; i++)
+        io->free_ops[i] = max_ops - 1 - i;
+    io->free_count = max_ops;
+
+    // anything that keeps io_uring from working leaves the engine on the fallback
+    if (!(flags & RING_BUFFER_IO_FALLBACK))
+        ring_buffer_io_setup (io, max_ops);
+
+    return 0;
+}
+
+void
+ring_buffer_io_free (struct ring_buffer_io *io)
+{
+    if (io->ring_fd >= 0)
+    {
+        munmap (io->sqes, io->sqes_bytes);
+        if (io->cq_ring != io->sq_ring)
+            munmap (io->cq_ring, io->cq_ring_bytes);
+        munmap (io->sq_ring, io->sq_ring_bytes);
+        close (io->ring_fd);
+        io->ring_fd = -1;
+    }
+    free (io->ops);
+    free (io->free_ops);
+    io->ops = NULL;
+    io->free_ops = NULL;
+}
+
+int
+ring_buffer_io_uses_uring (struct ring_buffer_io *io)
+{
+    return io->ring_fd >= 0;
+}
+
+unsigned int
+ring_buffer_io_pending (struct ring_buffer_io *io)
+{
+    return io->max_ops - io->free_count;
+}
+
+int
+ring_buffer_io_in_flight (struct ring_buffer *buffer)
+{
+    return load_acquire (&buffer->io_in_flight);
+}
+
+/* Hand the queued SQEs to the kernel and wait for @min_complete completions, up to
+ * @timeout_ns if it is positive.
+ */
+static int
+ring_buffer_io_enter (struct ring_buffer_io *io, unsigned int min_complete, long timeout_ns)
+{
+    struct __kernel_timespec timeout;
+    struct io_uring_getevents_arg arg;
+    unsigned int flags = min_complete ? IORING_ENTER_GETEVENTS : 0;
+    int submitted;
+
+    memset (&arg, 0, sizeof arg);
+    if (min_complete && timeout_ns > 0)
+    {
+        if (!(io->features & IORING_FEAT_EXT_ARG))
+        {
+            errno = EINVAL;
+            return -1;
+        }
+        timeout.tv_sec = timeout_ns / 1000000000L;
+        timeout.tv_nsec = timeout_ns % 1000000000L;
+        arg.ts = (unsigned long)&timeout;
+        flags |= IORING_ENTER_EXT_ARG;
+    }
+
+    submitted = io_uring_enter (io->ring_fd, io->to_submit, min_complete, flags,
+                                flags & IORING_ENTER_EXT_ARG ? &arg : NULL,
+                                flags & IORING_ENTER_EXT_ARG ? sizeof arg : 0);
+    if (submitted < 0)
+        return errno == ETIME ? 0 : -1;
+    io->to_submit -= submitted;
+    return 0;
+}
+
+/* Take a free op slot and, with io_uring, fill an SQE for it */
+static int
+ring_buffer_io_submit (struct ring_buffer_io *io, struct ring_buffer *buffer, int fd, int op,
+                       void *address, unsigned long count_bytes, void *user_data)
+{
+    struct ring_buffer_io_op *slot;
+    struct io_uring_sqe *sqe;
+    unsigned int index, tail;
+
+    if (count_bytes == 0)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    if (ring_buffer_io_in_flight (buffer) & op)
+    {
+        errno = EBUSY;
+        return -1;
+    }
+    if (io->free_count == 0)
+    {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    index = io->free_ops[io->free_count - 1];
+    if (io->ring_fd >= 0)
+    {
+        tail = *io->sq_tail;
+        // the queue only fills up between polls; hand the batch over to make room
+        if (tail - load_acquire (io->sq_head) == io->sq_entries && ring_buffer_io_enter (io, 0, 0))
+            return -1;
+
+        sqe = &io->sqes[tail & io->sq_mask];
+        memset (sqe, 0, sizeof *sqe);
+        sqe->opcode = op == RING_BUFFER_IO_RECV ? IORING_OP_READ : IORING_OP_WRITE;
+        sqe->fd = fd;
+        sqe->off = (unsigned long)-1; // the file position, as read(2) and write(2) use
+        sqe->addr = (unsigned long)address;
+        sqe->len = count_bytes > UINT32_MAX ? UINT32_MAX : count_bytes;
+        sqe->user_data = index;
+        io->sq_array[tail & io->sq_mask] = tail & io->sq_mask;
+        store_release (io->sq_tail, tail + 1);
+        io->to_submit++;
+    }
+
+    io->free_count--;
+    slot = &io->ops[index];
+    slot->buffer = buffer;
+    slot->user_data = user_data;
+    slot->fd = fd;
+    slot->op = op;
+    slot->count_bytes = count_bytes;
+    __atomic_fetch_or (&buffer->io_in_flight, op, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int
+ring_buffer_io_submit_recv (struct ring_buffer_io *io, struct ring_buffer *buffer, int fd,
+                            unsigned long max_bytes, void *user_data)
+{
+    unsigned long count_bytes = ring_buffer_producer_free_bytes (buffer, max_bytes ? max_bytes : buffer->count_bytes);
+
+    if (max_bytes && count_bytes > max_bytes)
+        count_bytes = max_bytes;
+    return ring_buffer_io_submit (io, buffer, fd, RING_BUFFER_IO_RECV, ring_buffer_write_address (buffer),
+                                  count_bytes, user_data);
+}
+
+int
+ring_buffer_io_submit_send (struct ring_buffer_io *io, struct ring_buffer *buffer, int fd,
+                            unsigned long max_bytes, void *user_data)
+{
+    unsigned long count_bytes = ring_buffer_consumer_count_bytes (buffer, max_bytes ? max_bytes : buffer->count_bytes);
+
+    if (max_bytes && count_bytes > max_bytes)
+        count_bytes = max_bytes;
+    return ring_buffer_io_submit (io, buffer, fd, RING_BUFFER_IO_SEND, ring_buffer_read_address (buffer),
+                                  count_bytes, user_data);
+}
+
+/* Advance past what op slot @index moved, free the slot and describe it in @completion */
+static void
+ring_buffer_io_complete (struct ring_buffer_io *io, unsigned int index, long result,
+                         struct ring_buffer_io_completion *completion)
+{
+    struct ring_buffer_io_op *slot = &io->ops[index];
+
+    if (result > 0 && slot->op == RING_BUFFER_IO_RECV)
+        ring_buffer_write_advance (slot->buffer, result);
+    else if (result > 0)
+        ring_buffer_read_advance (slot->buffer, result);
+    // after the advance, so a side that sees the operation done sees its bytes too
+    __atomic_fetch_and (&slot->buffer->io_in_flight, ~slot->op, __ATOMIC_RELEASE);
+
+    completion->buffer = slot->buffer;
+    completion->user_data = slot->user_data;
+    completion->fd = slot->fd;
+    completion->op = slot->op;
+    completion->result = result;
+    slot->buffer = NULL;
+    io->free_ops[io->free_count++] = index;
+}
+
+static int
+ring_buffer_io_reap (struct ring_buffer_io *io, struct ring_buffer_io_completion *completions,
+                     int max_completions)
+{
+    unsigned int head = *io->cq_head;
+    unsigned int tail = load_acquire (io->cq_tail);
+    struct io_uring_cqe *cqe;
+    int count = 0;
+
+    while (head != tail && count < max_completions)
+    {
+        cqe = &io->cqes[head & io->cq_mask];
+        ring_buffer_io_complete (io, cqe->user_data, cqe->res, &completions[count++]);
+        head++;
+    }
+    store_release (io->cq_head, head);
+    return count;
+}
+
+/* The fallback: poll(2) every descriptor with an operation in flight, then read or write
+ * on the ready ones. With the mirror mapping one call moves the whole span, so there is
+ * no need for readv/writev.
+ */
+static int
+ring_buffer_io_poll_fallback (struct ring_buffer_io *io, struct ring_buffer_io_completion *completions,
+                              int max_completions, long timeout_ns)
+{
+    struct pollfd *fds = malloc (io->max_ops * sizeof *fds);
+    unsigned int *indexes = malloc (io->max_ops * sizeof *indexes);
+    struct ring_buffer_io_op *slot;
+    unsigned int i, count_fds = 0;
+    int count = 0, ready, timeout_ms = -1;
+    long result;
+
+    if (io->free_count == io->max_ops)
+    {
+        free (fds);
+        free (indexes);
+        return 0;
+    }
+    if (fds == NULL || indexes == NULL)
+    {
+        free (fds);
+        free (indexes);
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; i < io->max_ops; i++)
+    {
+        if (io->ops[i].buffer == NULL)
+            continue;
+        fds[count_fds].fd = io->ops[i].fd;
+        fds[count_fds].events = io->ops[i].op == RING_BUFFER_IO_RECV ? POLLIN : POLLOUT;
+        indexes[count_fds++] = i;
+    }
+
+    // round up to whole milliseconds, and wait at most INT_MAX of them
+    if (timeout_ns >= 0)
+        timeout_ms = timeout_ns / 1000000 >= INT_MAX ? INT_MAX : (int)((timeout_ns + 999999) / 1000000);
+    ready = poll (fds, count_fds, timeout_ms);
+    for (i = 0; ready > 0 && i < count_fds && count < max_completions; i++)
+    {
+        if (fds[i].revents == 0)
+            continue;
+        slot = &io->ops[indexes[i]];
+        if (slot->op == RING_BUFFER_IO_RECV)
+            result = read (slot->fd, ring_buffer_write_address (slot->buffer), slot->count_bytes);
+        else
+            result = write (slot->fd, ring_buffer_read_address (slot->buffer), slot->count_bytes);
+        if (result < 0 && (errno == EAGAIN || errno == EINTR))
+            continue; // stays in flight, as io_uring would keep it
+        ring_buffer_io_complete (io, indexes[i], result < 0 ? -errno : result, &completions[count++]);
+    }
+
+    free (fds);
+    free (indexes);
+    return ready < 0 ? -1 : count;
+}
+
+int
+ring_buffer_io_poll (struct ring_buffer_io *io, struct ring_buffer_io_completion *completions,
+                     int max_completions, long timeout_ns)
+{
+    int count;
+
+    if (io->ring_fd < 0)
+        return ring_buffer_io_poll_fallback (io, completions, max_completions, timeout_ns);
+
+    // completions that are already there need no syscall, unless SQEs wait to be submitted
+    count = ring_buffer_io_reap (io, completions, max_completions);
+    if (count == max_completions || (count > 0 && io->to_submit == 0))
+        return count;
+    if (io->to_submit == 0 && (timeout_ns == 0 || io->free_count == io->max_ops))
+        return count;
+
+    if (ring_buffer_io_enter (io, count == 0 && timeout_ns != 0 ? 1 : 0, timeout_ns))
+        return count > 0 ? count : -1;
+    return count + ring_buffer_io_reap (io, completions + count, max_completions - count);
+}
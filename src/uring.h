@@ -0,0 +1,122 @@
+#ifndef URING_H
+#define URING_H
+
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* An I/O engine that moves bytes between file descriptors and ring buffers with io_uring,
+ * for event loops serving many connections. A recv reads straight into
+ * ring_buffer_write_address and a send writes straight from ring_buffer_read_address; the
+ * mirror mapping makes either span one address range even across the wrap, so every
+ * operation is a single SQE. Submissions only fill SQEs: ring_buffer_io_poll hands them
+ * all to the kernel and reaps the completions with one io_uring_enter, and each
+ * completion advances the offsets as ring_buffer_write_advance or ring_buffer_read_advance
+ * would, waking waiters and signalling eventfds.
+ *
+ * Without io_uring (an old kernel, or a seccomp filter that refuses it) the engine falls
+ * back to poll(2) and read/write on the descriptors that are ready, with the same API.
+ *
+ * One thread drives an engine. A buffer has at most one recv and one send in flight; while
+ * its recv is in flight nothing else may write to it, and while its send is, nothing else
+ * may read from it; ring_buffer_clear and ring_buffer_reset count as both. Completions
+ * run on the engine's thread, so the other sides check ring_buffer_io_in_flight. Do not
+ * use sends on overwrite-mode buffers, as for ring_buffer_drain_to_fd.
+ */
+#define RING_BUFFER_IO_RECV 1
+#define RING_BUFFER_IO_SEND 2
+
+#define RING_BUFFER_IO_FALLBACK 1 // ring_buffer_io_create flag: do not try io_uring
+
+struct ring_buffer_io_op
+{
+    struct ring_buffer *buffer; // NULL when the slot is free
+    void *user_data;
+    int fd;
+    int op; // RING_BUFFER_IO_RECV or RING_BUFFER_IO_SEND
+    unsigned long count_bytes;
+};
+
+struct ring_buffer_io_completion
+{
+    struct ring_buffer *buffer;
+    void *user_data;
+    int fd;
+    int op;
+    long result; // bytes moved, 0 at end of file for a recv, or -errno
+};
+
+struct ring_buffer_io
+{
+    int ring_fd; // the io_uring, -1 in the poll(2) fallback
+    unsigned int features; // IORING_FEAT_* of the kernel
+
+    /* submission queue, shared with the kernel */
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned int sq_entries;
+    unsigned int to_submit; // SQEs filled since the last io_uring_enter
+
+    /* completion queue, shared with the kernel */
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    unsigned long sq_ring_bytes;
+    void *cq_ring; // sq_ring when the kernel maps both rings at once
+    unsigned long cq_ring_bytes;
+    unsigned long sqes_bytes;
+
+    /* operations in flight, indexed by SQE user_data */
+    struct ring_buffer_io_op *ops;
+    unsigned int max_ops;
+    unsigned int *free_ops; // stack of free slots in ops
+    unsigned int free_count;
+};
+
+/* Set up an engine for up to @max_ops operations in flight. Return 0, or -1 with errno set;
+ * the lack of io_uring is not an error, see ring_buffer_io_uses_uring.
+ */
+int ring_buffer_io_create (struct ring_buffer_io *io, unsigned int max_ops, int flags);
+void ring_buffer_io_free (struct ring_buffer_io *io);
+int ring_buffer_io_uses_uring (struct ring_buffer_io *io);
+
+/* Queue a read of up to @max_bytes (0 for as many as fit) from @fd into @buffer, or a
+ * write of up to @max_bytes of its readable bytes to @fd. @user_data comes back with the
+ * completion. Return 0, or -1 with errno EAGAIN when the buffer is full (recv) or empty
+ * (send), EBUSY when the buffer already has that operation in flight, or ENOSPC when the
+ * engine has max_ops in flight.
+ */
+int ring_buffer_io_submit_recv (struct ring_buffer_io *io, struct ring_buffer *buffer, int fd,
+                                unsigned long max_bytes, void *user_data);
+int ring_buffer_io_submit_send (struct ring_buffer_io *io, struct ring_buffer *buffer, int fd,
+                                unsigned long max_bytes, void *user_data);
+
+/* Submit what was queued and fill @completions with up to @max_completions finished
+ * operations, whose bytes are already advanced past. @timeout_ns < 0 waits for at least
+ * one, 0 does not wait. Return the number of completions, or -1 with errno set (EINTR
+ * when a signal interrupted the wait).
+ */
+int ring_buffer_io_poll (struct ring_buffer_io *io, struct ring_buffer_io_completion *completions,
+                         int max_completions, long timeout_ns);
+
+/* Operations in flight */
+unsigned int ring_buffer_io_pending (struct ring_buffer_io *io);
+
+/* RING_BUFFER_IO_* operations in flight on @buffer, from any thread. An operation reads as
+ * done only once the completion has advanced the offsets past its bytes.
+ */
+int ring_buffer_io_in_flight (struct ring_buffer *buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
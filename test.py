@@ -1,3 +1,13 @@
+import os
+import pickle
+import select
+import socket
+import struct
+import sys
+import tempfile
+import threading
+import time
+
 import ring_buffer
 import unittest
 
@@ -13,7 +23,7 @@ class BufferTestCase(unittest.TestCase):
         data = b'1234'
         self.buffer.write(data)
         r_data = self.buffer.read(length=4)
-        self.assertEquals(data, r_data)
+        self.assertEqual(data, r_data)
 
     def testReadWriteCloseException(self):
         data = b'1234'
@@ -28,6 +38,22 @@ class BufferTestCase(unittest.TestCase):
         with self.assertRaises(ring_buffer.InsufficientDataError):
             self.buffer.read(length=5)
 
+    def testWriteBytesLike(self):
+        self.buffer.write(bytearray(b'12'))
+        self.buffer.write(memoryview(b'3456')[:2])
+        self.buffer.push(data=bytearray(b'x'))
+        self.assertEqual(b'1234', self.buffer.read(4))
+        self.assertEqual(b'x', self.buffer.pop(timeout=None))
+        self.assertRaises(TypeError, self.buffer.write, u'text')
+
+    def testArguments(self):
+        self.assertRaises(TypeError, self.buffer.read)
+        self.assertRaises(TypeError, self.buffer.read, 1, 0, 0)
+        self.assertRaises(TypeError, self.buffer.read, 1, bogus=0)
+        self.assertRaises(TypeError, self.buffer.read, 1, length=1)
+        self.assertRaises(TypeError, self.buffer.read, 1.0)
+        self.assertRaises(ValueError, self.buffer.read, -1)
+
     def testEOF(self):
         data = b'1234'
         self.buffer.write(data)
@@ -39,7 +65,7 @@ class BufferTestCase(unittest.TestCase):
         data = b'1234'
         self.buffer.write(data)
         pr_data = self.buffer.read(length=4)
-        self.assertEquals(pr_data, data)
+        self.assertEqual(pr_data, data)
         with self.assertRaises(ring_buffer.InsufficientDataError):
             self.buffer.read(length=4)
 
@@ -47,7 +73,7 @@ class BufferTestCase(unittest.TestCase):
         data = b'1234'
         self.buffer.write(data)
         r_data = self.buffer.read_piece()
-        self.assertEquals(r_data, data)
+        self.assertEqual(r_data, data)
         with self.assertRaises(ring_buffer.InsufficientDataError):
             self.buffer.read_piece()
 
@@ -57,9 +83,9 @@ class BufferTestCase(unittest.TestCase):
         self.buffer.write(data_1)
         self.buffer.write(data_2)
         r_data_1 = self.buffer.read(length=3)
-        self.assertEquals(b'123', r_data_1)
+        self.assertEqual(b'123', r_data_1)
         r_data_2 = self.buffer.read(length=5)
-        self.assertEquals(b'45678', r_data_2)
+        self.assertEqual(b'45678', r_data_2)
 
     def testMixedReadWrite(self):
         data_1 = b'1234'
@@ -67,20 +93,1075 @@ class BufferTestCase(unittest.TestCase):
         data_3 = b'890'
         self.buffer.write(data_1)
         r_data_1 = self.buffer.read(length=3)
-        self.assertEquals(b'123', r_data_1)
+        self.assertEqual(b'123', r_data_1)
         self.buffer.write(data_2)
         r_data_2 = self.buffer.read(length=2)
-        self.assertEquals(b'45', r_data_2)
+        self.assertEqual(b'45', r_data_2)
         self.buffer.write(data_3)
         r_data_3 = self.buffer.peek_read(length=3)
-        self.assertEquals(b'678', r_data_3)
+        self.assertEqual(b'678', r_data_3)
         r_data_4 = self.buffer.read_piece()
-        self.assertEquals(b'67890', r_data_4)
+        self.assertEqual(b'67890', r_data_4)
 
     def testLen(self):
-        self.assertEquals(0, len(self.buffer))
+        self.assertEqual(0, len(self.buffer))
         data_1 = b'1234'
         self.buffer.write(data_1)
-        self.assertEquals(4, len(self.buffer))
+        self.assertEqual(4, len(self.buffer))
         self.buffer.read(4)
-        self.assertEquals(0, len(self.buffer))
+        self.assertEqual(0, len(self.buffer))
+
+    def testWrapAround(self):
+        self.buffer.write(b'a' * 3000)
+        self.buffer.read(length=3000)
+        data = b'0123456789' * 200
+        self.buffer.write(data)
+        r_data_1 = self.buffer.read(length=1500)
+        r_data_2 = self.buffer.read(length=500)
+        self.assertEqual(data, r_data_1 + r_data_2)
+
+    def testReserveCommit(self):
+        view = self.buffer.reserve(4)
+        self.assertEqual(4, len(view))
+        view[:] = b'1234'
+        self.assertEqual(0, len(self.buffer))
+        self.buffer.commit(4)
+        self.assertEqual(b'1234', self.buffer.read(length=4))
+        self.assertRaises(ValueError, self.buffer.commit, 1)
+        with self.assertRaises(ring_buffer.FullError):
+            self.buffer.reserve(4097)
+
+    def testAcquireRelease(self):
+        self.buffer.write(b'1234')
+        view = self.buffer.acquire(3)
+        self.assertTrue(view.readonly)
+        self.assertEqual(b'123', view.tobytes())
+        self.buffer.release(3)
+        self.assertEqual(b'4', self.buffer.read(length=1))
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            self.buffer.acquire(1)
+
+    def testMemoryview(self):
+        self.buffer.write(b'1234')
+        self.assertEqual(b'1234', memoryview(self.buffer).tobytes())
+        self.assertEqual(4, len(self.buffer))
+
+
+class SharedBufferTestCase(unittest.TestCase):
+    def setUp(self):
+        self.name = '/ring_buffer_test_%d' % os.getpid()
+        self.producer = ring_buffer.Buffer.create_shared(self.name, order=12)
+
+    def tearDown(self):
+        try:
+            ring_buffer.unlink_shared(self.name)
+        except OSError:
+            pass
+
+    def testOpenShared(self):
+        consumer = ring_buffer.Buffer.open_shared(self.name)
+        self.assertEqual(12, consumer.order)
+        self.producer.write(b'1234')
+        self.assertEqual(4, len(consumer))
+        self.assertEqual(b'1234', consumer.read(length=4))
+        self.assertEqual(0, len(self.producer))
+
+    def testOpenSharedAcrossFork(self):
+        pid = os.fork()
+        if pid == 0:
+            child = ring_buffer.Buffer.open_shared(self.name)
+            child.write(b'from child')
+            child.close()
+            os._exit(0)
+        os.waitpid(pid, 0)
+        self.assertEqual(b'from child', self.producer.read(length=10))
+        self.assertTrue(self.producer.eof())
+
+    def testCreateSharedExists(self):
+        self.assertRaises(OSError, ring_buffer.Buffer.create_shared, self.name)
+
+    def testOpenSharedMissing(self):
+        ring_buffer.unlink_shared(self.name)
+        self.assertRaises(OSError, ring_buffer.Buffer.open_shared, self.name)
+
+
+class BlockingBufferTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer()
+
+    def testReadTimeout(self):
+        start = time.time()
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            self.buffer.read(4, timeout=0.05)
+        self.assertTrue(time.time() - start >= 0.04)
+
+    def testWriteTimeout(self):
+        self.buffer.write(b'A' * 4096)
+        with self.assertRaises(ring_buffer.FullError):
+            self.buffer.write(b'B', timeout=0.01)
+
+    def testReadWokenByWriter(self):
+        writer = threading.Timer(0.01, self.buffer.write, [b'1234'])
+        writer.start()
+        self.assertEqual(b'1234', self.buffer.read(4, timeout=None))
+        writer.join()
+
+    def testWriteWokenByReader(self):
+        self.buffer.write(b'A' * 4096)
+        reader = threading.Timer(0.01, self.buffer.read, [4])
+        reader.start()
+        self.buffer.write(b'1234', timeout=5)
+        reader.join()
+        self.assertEqual(4096, len(self.buffer))
+
+    def testWaitReadable(self):
+        self.assertFalse(self.buffer.wait_readable(timeout=0.01))
+        self.buffer.write(b'12')
+        self.assertTrue(self.buffer.wait_readable(2, timeout=0))
+        self.assertFalse(self.buffer.wait_readable(3, timeout=0.01))
+        self.buffer.close()
+        self.assertFalse(self.buffer.wait_readable(3))
+
+
+class EventfdTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer()
+
+    def testReadableFileno(self):
+        fd = self.buffer.fileno()
+        self.assertEqual(fd, self.buffer.readable_fileno())
+        self.assertEqual(([], [], []), select.select([fd], [], [], 0))
+        self.buffer.write(b'1234')
+        self.assertEqual(([fd], [], []), select.select([fd], [], [], 0))
+
+    def testWritableFileno(self):
+        fd = self.buffer.writable_fileno()
+        self.buffer.write(b'A' * 4096)
+        self.buffer.read(1)
+        self.assertEqual(([fd], [], []), select.select([fd], [], [], 0))
+
+    def testReadableMark(self):
+        fd = self.buffer.fileno()
+        self.buffer.readable_mark = 8
+        self.assertEqual(8, self.buffer.readable_mark)
+        self.buffer.write(b'1234')
+        self.assertEqual(([], [], []), select.select([fd], [], [], 0))
+        self.buffer.write(b'5678')
+        self.assertEqual(([fd], [], []), select.select([fd], [], [], 0))
+        with self.assertRaises(ValueError):
+            self.buffer.readable_mark = 0
+
+
+@unittest.skipIf(sys.version_info < (3, 5), 'asyncio wrapper needs async/await')
+class AsyncioReaderTestCase(unittest.TestCase):
+    def setUp(self):
+        import asyncio
+        import ring_buffer_asyncio
+        self.loop = asyncio.new_event_loop()
+        self.buffer = ring_buffer.Buffer()
+        self.reader = ring_buffer_asyncio.BufferReader(self.buffer, loop=self.loop)
+
+    def tearDown(self):
+        self.reader.close()
+        self.loop.close()
+
+    def testReadexactlyFromThread(self):
+        writer = threading.Timer(0.01, self.buffer.write, [b'12345678'])
+        writer.start()
+        data = self.loop.run_until_complete(self.reader.readexactly(8))
+        writer.join()
+        self.assertEqual(b'12345678', data)
+
+    def testReadAtEof(self):
+        self.buffer.write(b'12')
+        self.buffer.close()
+        self.assertEqual(b'12', self.loop.run_until_complete(self.reader.read(10)))
+        self.assertEqual(b'', self.loop.run_until_complete(self.reader.read(10)))
+        self.assertTrue(self.reader.at_eof())
+
+
+class RecordBufferTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer()
+
+    def testPushPop(self):
+        self.buffer.push(b'1234')
+        self.buffer.push(b'')
+        self.buffer.push(b'56')
+        self.assertEqual(b'1234', self.buffer.pop())
+        self.assertEqual(b'', self.buffer.pop())
+        self.assertEqual(b'56', self.buffer.pop())
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            self.buffer.pop()
+
+    def testPushFull(self):
+        self.buffer.push(b'A' * 4000)
+        with self.assertRaises(ring_buffer.FullError):
+            self.buffer.push(b'B' * 100)
+
+    def testPopMany(self):
+        for i in range(100):
+            self.buffer.push(str(i).encode())
+        records = self.buffer.pop_many(60)
+        self.assertEqual(60, len(records))
+        self.assertEqual(b'59', records[-1])
+        self.assertEqual(40, len(self.buffer.pop_many()))
+        self.assertEqual([], self.buffer.pop_many())
+
+    def testPopTimeout(self):
+        writer = threading.Timer(0.01, self.buffer.push, [b'late'])
+        writer.start()
+        self.assertEqual(b'late', self.buffer.pop(timeout=5))
+        writer.join()
+
+
+class VectoredBufferTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer()
+
+    def testWriteMany(self):
+        self.buffer.write_many([b'12', b'', bytearray(b'34'), memoryview(b'56')])
+        self.assertEqual(b'123456', self.buffer.read(6))
+        self.buffer.write_many(iter([b'7', b'8']))
+        self.assertEqual(b'78', self.buffer.read(2))
+
+    def testWriteManyFull(self):
+        with self.assertRaises(ring_buffer.FullError):
+            self.buffer.write_many([b'A' * 4000, b'B' * 100])
+        self.assertEqual(0, len(self.buffer))
+        self.assertRaises(TypeError, self.buffer.write_many, [b'A', 1])
+
+    def testReadInto(self):
+        self.buffer.write(b'123456')
+        target = bytearray(4)
+        self.assertEqual(4, self.buffer.read_into(target))
+        self.assertEqual(bytearray(b'1234'), target)
+        self.assertEqual(1, self.buffer.read_into(target, 1))
+        self.assertEqual(1, self.buffer.read_into(target))
+        self.assertEqual(bytearray(b'6234'), target)
+        self.assertEqual(0, self.buffer.read_into(target))
+
+
+class FdBufferTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer()
+        self.read_fd, self.write_fd = os.pipe()
+
+    def tearDown(self):
+        os.close(self.read_fd)
+        os.close(self.write_fd)
+
+    def testRecvFrom(self):
+        os.write(self.write_fd, b'123456')
+        self.assertEqual(4, self.buffer.recv_from(self.read_fd, 4))
+        self.assertEqual(2, self.buffer.recv_from(self.read_fd))
+        self.assertEqual(b'123456', self.buffer.read(6))
+
+    def testSendTo(self):
+        self.buffer.write(b'123456')
+        self.assertEqual(6, self.buffer.send_to(self.write_fd))
+        self.assertEqual(b'123456', os.read(self.read_fd, 6))
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            self.buffer.send_to(self.write_fd)
+
+    def testRecvFromSocket(self):
+        left, right = socket.socketpair()
+        try:
+            left.sendall(b'1234')
+            self.assertEqual(4, self.buffer.recv_from(right))
+            self.assertEqual(4, self.buffer.send_to(right))
+            self.assertEqual(b'1234', left.recv(4))
+        finally:
+            left.close()
+            right.close()
+
+    def testRecvFromFull(self):
+        self.buffer.write(b'A' * 4096)
+        with self.assertRaises(ring_buffer.FullError):
+            self.buffer.recv_from(self.read_fd)
+
+
+class BufferOptionsTestCase(unittest.TestCase):
+    def testHugePagesFallBack(self):
+        # one 2 MiB huge page cannot back a 4 KiB buffer
+        buf = ring_buffer.Buffer(order=12, huge_pages=2 << 20)
+        self.assertEqual(os.sysconf('SC_PAGESIZE'), buf.page_size)
+        buf.write(b'1234')
+        self.assertEqual(b'1234', buf.read(4))
+
+    def testPopulateAndLock(self):
+        buf = ring_buffer.Buffer(order=16, populate=True, lock=True)
+        buf.write(b'1234')
+        self.assertEqual(b'1234', buf.read(4))
+
+    def testBadNumaNode(self):
+        self.assertRaises(OSError, ring_buffer.Buffer, numa_node=1 << 20)
+
+
+class OverwriteBufferTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer(overwrite=True)
+
+    def testWriteDiscardsOldest(self):
+        self.assertTrue(self.buffer.overwrite)
+        self.buffer.write(b'a' * 3000)
+        self.buffer.write(b'b' * 3000)
+        self.assertEqual(1904, self.buffer.dropped_bytes)
+        self.assertEqual(b'a' * 1096 + b'b' * 3000, self.buffer.snapshot())
+        self.assertEqual(4096, len(self.buffer))
+        self.assertEqual(b'a' * 1096, self.buffer.read(1096))
+
+    def testPushDiscardsWholeRecords(self):
+        for i in range(10):
+            self.buffer.push(str(i).encode() * 1000)
+        self.assertEqual(6, self.buffer.dropped_records)
+        self.assertEqual(6 * 1004, self.buffer.dropped_bytes)
+        expected = [str(i).encode() * 1000 for i in range(6, 10)]
+        self.assertEqual(expected, self.buffer.snapshot(records=True))
+        self.assertEqual(expected, self.buffer.pop_many())
+
+    def testTooLarge(self):
+        with self.assertRaises(ring_buffer.FullError):
+            self.buffer.write(b'x' * 4097)
+
+    def testRecvDiscardsOldest(self):
+        self.buffer.write(b'a' * 4096)
+        r, w = os.pipe()
+        try:
+            os.write(w, b'b' * 100)
+            self.assertEqual(100, self.buffer.recv_from(r, max_bytes=100))
+        finally:
+            os.close(r)
+            os.close(w)
+        self.assertEqual(100, self.buffer.dropped_bytes)
+        self.assertEqual(b'a' * 3996 + b'b' * 100, self.buffer.snapshot())
+
+    def testReleaseOverwritten(self):
+        self.buffer.write(b'a' * 4096)
+        view = self.buffer.acquire(10)
+        self.buffer.write(b'b' * 10)
+        del view
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            self.buffer.release(10)
+
+    def testPopWhileLapped(self):
+        done = []
+
+        def produce():
+            for i in range(20000):
+                self.buffer.push(('%d:' % i).encode() * 20)
+            done.append(True)
+
+        producer = threading.Thread(target=produce)
+        producer.start()
+        last = -1
+        while not done or len(self.buffer):
+            try:
+                record = self.buffer.pop()
+            except ring_buffer.InsufficientDataError:
+                continue
+            number = int(record.split(b':')[0])
+            self.assertEqual(('%d:' % number).encode() * 20, record)
+            self.assertTrue(number > last)
+            last = number
+        producer.join()
+        self.assertEqual(19999, last)
+
+
+class StatsTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer()
+
+    def testCounters(self):
+        self.buffer.write(b'A' * 3000)
+        self.buffer.read(3000)
+        self.buffer.write(b'B' * 3000)
+        with self.assertRaises(ring_buffer.FullError):
+            self.buffer.write(b'C' * 3000)
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            self.buffer.read(4000)
+        stats = self.buffer.stats()
+        self.assertEqual(4096, stats['count_bytes'])
+        self.assertEqual(6000, stats['bytes_written'])
+        self.assertEqual(2, stats['writes'])
+        self.assertEqual(1, stats['full'])
+        self.assertEqual(3000, stats['bytes_read'])
+        self.assertEqual(1, stats['empty'])
+        self.assertEqual(3000, stats['high_water_bytes'])
+        self.assertFalse('latency_ns' in stats)
+
+        self.buffer.reset_stats()
+        self.assertEqual(0, self.buffer.stats()['bytes_written'])
+
+    def testEmptyPop(self):
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            self.buffer.pop()
+        self.assertEqual(1, self.buffer.stats()['empty'])
+
+    def testWaits(self):
+        writer = threading.Timer(0.01, self.buffer.write, [b'1234'])
+        writer.start()
+        self.buffer.read(4, timeout=None)
+        writer.join()
+        stats = self.buffer.stats()
+        self.assertTrue(stats['read_waits'] >= 1)
+        self.assertTrue(stats['read_wait_ns'] > 0)
+
+    def testLatencyHistogram(self):
+        self.buffer.enable_timestamps()
+        for i in range(10):
+            self.buffer.push(b'x' * 100)
+        self.buffer.pop_many()
+        histogram = self.buffer.stats()['latency_ns']
+        self.assertEqual(10, sum(histogram.values()))
+        for bound in histogram:
+            self.assertEqual(0, bound & (bound - 1))
+
+
+class ThreadedBufferTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer(order=16)
+
+    def testLargeCopiesAcrossThreads(self):
+        self.buffer.gil_release_threshold = 0
+        pieces = [chr(ord('a') + i % 26).encode() * 20000 for i in range(50)]
+
+        def produce():
+            for piece in pieces:
+                self.buffer.write(piece, timeout=5)
+
+        writer = threading.Thread(target=produce)
+        writer.start()
+        received = [self.buffer.read(20000, timeout=5) for piece in pieces]
+        writer.join()
+        self.assertEqual(pieces, received)
+
+    def testConcurrentPushes(self):
+        def produce(name):
+            for i in range(300):
+                self.buffer.push(('%s%d' % (name, i)).encode() * 10, timeout=5)
+
+        threads = [threading.Thread(target=produce, args=(name,)) for name in 'ab']
+        for thread in threads:
+            thread.start()
+        popped = [self.buffer.pop(timeout=5) for i in range(600)]
+        for thread in threads:
+            thread.join()
+
+        for name in 'ab':
+            expected = [('%s%d' % (name, i)).encode() * 10 for i in range(300)]
+            self.assertEqual(expected, [record for record in popped if record[:1] == name.encode()])
+
+
+class TypedRecordTestCase(unittest.TestCase):
+    TICK = struct.Struct('<qd16s')
+
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer(record_format=self.TICK.format)
+
+    def ticks(self, start, count):
+        return b''.join(self.TICK.pack(i, i / 2.0, b'tick') for i in range(start, start + count))
+
+    def testRecordFormat(self):
+        self.assertEqual('<qd16s', self.buffer.record_format)
+        self.assertEqual(32, self.buffer.record_size)
+        self.assertEqual(None, ring_buffer.Buffer().record_format)
+        with self.assertRaises(struct.error):
+            ring_buffer.Buffer(record_format='z')
+
+    def testReadArray(self):
+        self.buffer.write_array(self.ticks(0, 10))
+        view = self.buffer.read_array(4)
+        self.assertEqual('<qd16s', view.format)
+        self.assertEqual(32, view.itemsize)
+        self.assertEqual((4,), view.shape)
+        self.assertTrue(view.readonly)
+        self.assertEqual(self.ticks(0, 4), view.tobytes())
+        self.assertEqual((3, 1.5, b'tick' + b'\0' * 12), self.TICK.unpack_from(view.tobytes(), 3 * 32))
+        del view
+        self.buffer.release_array(4)
+        self.assertEqual(6 * 32, len(self.buffer))
+        view = self.buffer.read_array()
+        self.assertEqual((6,), view.shape)
+        del view
+        self.buffer.release_array(6)
+        self.assertEqual((0,), self.buffer.read_array().shape)
+
+    def testReadArrayAcrossWrap(self):
+        self.buffer.write_array(self.ticks(0, 100))
+        self.buffer.release_array(len(self.buffer.read_array(100)))
+        self.buffer.write_array(self.ticks(100, 100))
+        self.assertEqual(self.ticks(100, 100), self.buffer.read_array().tobytes())
+
+    def testWriteArrayChecks(self):
+        with self.assertRaises(ValueError):
+            self.buffer.write_array(b'x' * 33)
+        with self.assertRaises(ring_buffer.FullError):
+            self.buffer.write_array(self.ticks(0, 200))
+        with self.assertRaises(ValueError):
+            self.buffer.release_array(1)
+        with self.assertRaises(ValueError):
+            ring_buffer.Buffer().read_array()
+
+    def testRecordFormatLockedByViews(self):
+        view = self.buffer.read_array()
+        with self.assertRaises(ValueError):
+            self.buffer.record_format = 'q'
+        del view
+        self.buffer.record_format = 'q'
+        self.assertEqual(8, self.buffer.record_size)
+
+    def testOverwriteDropsWholeRecords(self):
+        buf = ring_buffer.Buffer(overwrite=True, record_format='<qd16s')
+        for i in range(300):
+            buf.write_array(self.ticks(i, 1))
+        self.assertEqual(0, buf.dropped_bytes % 32)
+        self.assertEqual(self.ticks(300 - 128, 128), buf.read_array().tobytes())
+
+
+class FileBackedTestCase(unittest.TestCase):
+    def setUp(self):
+        self.path = os.path.join(tempfile.mkdtemp(), 'spool')
+
+    def tearDown(self):
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+        os.rmdir(os.path.dirname(self.path))
+
+    def testResumeAfterClose(self):
+        buf = ring_buffer.Buffer.open_file(self.path, order=13)
+        self.assertEqual(8192, os.path.getsize(self.path) - 4096)
+        buf.push(b'first')
+        buf.push(b'second')
+        self.assertEqual(b'first', buf.pop())
+        del buf
+        buf = ring_buffer.Buffer.open_file(self.path)
+        self.assertEqual(13, buf.order)
+        self.assertEqual([b'second'], buf.pop_many())
+
+    def testResumeAfterCrash(self):
+        pid = os.fork()
+        if pid == 0:
+            buf = ring_buffer.Buffer.open_file(self.path)
+            buf.write(b'kept')
+            buf.sync()
+            buf.write(b'lost')
+            os._exit(0)
+        os.waitpid(pid, 0)
+        buf = ring_buffer.Buffer.open_file(self.path)
+        self.assertEqual(b'kept', buf.read(len(buf)))
+
+    def testSyncPolicies(self):
+        buf = ring_buffer.Buffer.open_file(self.path, sync=True)
+        generation = buf.generation
+        buf.write(b'x')
+        buf.read(1)
+        self.assertEqual(generation + 2, buf.generation)
+        del buf
+        buf = ring_buffer.Buffer.open_file(self.path, sync=3600)
+        generation = buf.generation
+        buf.write(b'x')
+        self.assertEqual(generation, buf.generation)
+        with self.assertRaises(ValueError):
+            ring_buffer.Buffer.open_file(self.path, sync=-1)
+
+    def testOrderMismatch(self):
+        ring_buffer.Buffer.open_file(self.path, order=12)
+        with self.assertRaises(OSError):
+            ring_buffer.Buffer.open_file(self.path, order=14)
+
+    def testMemoryBuffer(self):
+        buf = ring_buffer.Buffer()
+        buf.sync()
+        self.assertEqual(0, buf.generation)
+
+
+class LineBufferTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer()
+
+    def testFind(self):
+        self.buffer.write(b'GET / HTTP/1.1\r\nHost: x\r\n')
+        self.assertEqual(14, self.buffer.find(b'\r\n'))
+        self.assertEqual(-1, self.buffer.find(b'\r\n\r\n'))
+        self.buffer.write(b'\r\n')
+        self.assertEqual(23, self.buffer.find(b'\r\n\r\n'))
+
+    def testReadline(self):
+        self.buffer.write(b'one\ntwo\nthr')
+        self.assertEqual(b'one\n', self.buffer.readline())
+        self.assertEqual(b'two\n', self.buffer.readline())
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            self.buffer.readline()
+        self.buffer.write(b'ee\n')
+        self.assertEqual(b'three\n', self.buffer.readline())
+
+    def testReadUntil(self):
+        self.buffer.write(b'a\0bc\0')
+        self.assertEqual(b'a\0', self.buffer.read_until(b'\0'))
+        self.assertEqual(b'bc\0', self.buffer.read_until(b'\0'))
+        with self.assertRaises(ValueError):
+            self.buffer.read_until(b'')
+
+    def testReadlineAcrossWrap(self):
+        self.buffer.write(b'x' * 4000)
+        self.buffer.read(4000)
+        self.buffer.write(b'y' * 200 + b'\n')
+        self.assertEqual(b'y' * 200 + b'\n', self.buffer.readline())
+
+    def testReadlineWaits(self):
+        def produce():
+            time.sleep(0.01)
+            self.buffer.write(b'par')
+            time.sleep(0.01)
+            self.buffer.write(b'tial\n')
+
+        thread = threading.Thread(target=produce)
+        thread.start()
+        self.assertEqual(b'partial\n', self.buffer.readline(timeout=5))
+        thread.join()
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            self.buffer.readline(timeout=0.01)
+
+    def testIterLines(self):
+        self.buffer.write(b'a\nb\nc\nd')
+        self.assertEqual([b'a\n', b'b\n'], list(self.buffer.iter_lines(max_lines=2)))
+        self.assertEqual([b'c\n'], list(self.buffer.iter_lines()))
+        self.buffer.close()
+        self.assertEqual([b'd'], list(self.buffer.iter_lines()))
+        self.assertEqual(b'', self.buffer.readline())
+
+
+class BroadcastTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer()
+
+    def testEveryReaderSeesEveryByte(self):
+        first = self.buffer.reader('first')
+        second = self.buffer.reader('second')
+        self.buffer.write(b'abcdef')
+        self.assertEqual(b'abc', first.read(3))
+        self.assertEqual(b'abcdef', second.read(6))
+        self.assertEqual(3, len(first))
+        self.assertEqual(0, len(second))
+        self.assertEqual(b'def', first.peek_read(3))
+        self.assertEqual(b'def', first.read(3))
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            first.read(1)
+
+    def testSlowestReaderHoldsBackWriter(self):
+        fast = self.buffer.reader('fast')
+        slow = self.buffer.reader('slow')
+        self.buffer.write(b'x' * 4096)
+        fast.read(4096)
+        with self.assertRaises(ring_buffer.FullError):
+            self.buffer.write(b'y')
+        slow.read(1)
+        self.buffer.write(b'y')
+        slow.close()
+        self.buffer.write(b'z' * 4094)
+        self.assertEqual(b'y' + b'z' * 4094, fast.read(4095))
+
+    def testReaderResumesByName(self):
+        self.buffer.reader('tail')
+        self.buffer.write(b'12345')
+        self.buffer.reader('tail').read(2)
+        reader = self.buffer.reader('tail')
+        self.assertEqual('tail', reader.name)
+        self.assertEqual(b'345', reader.read(3))
+
+    def testReaderWaits(self):
+        reader = self.buffer.reader('waiting')
+
+        def produce():
+            time.sleep(0.01)
+            self.buffer.write(b'late')
+
+        thread = threading.Thread(target=produce)
+        thread.start()
+        self.assertEqual(b'late', reader.read(4, timeout=5))
+        thread.join()
+
+    def testOverwriteSkipsSlowReader(self):
+        buffer = ring_buffer.Buffer(overwrite=True)
+        reader = buffer.reader('slow')
+        buffer.write(b'a' * 3000)
+        buffer.write(b'b' * 3000)
+        self.assertEqual(b'a' * 1096, reader.read(1096))
+        self.assertEqual(1904, reader.dropped_bytes)
+
+    def testReaderLimits(self):
+        readers = [self.buffer.reader('r%d' % i) for i in range(8)]
+        self.assertRaises(OSError, self.buffer.reader, 'one too many')
+        readers[0].close()
+        self.assertRaises(ValueError, readers[0].read, 1)
+        self.assertRaises(ValueError, self.buffer.reader, 'x' * 40)
+        self.buffer.reader('one too many')
+
+    def testPlainReadsRefused(self):
+        reader = self.buffer.reader('audit')
+        self.buffer.write(b'line\n')
+        self.assertRaises(BufferError, self.buffer.read, 1)
+        self.assertRaises(BufferError, self.buffer.pop)
+        self.assertRaises(BufferError, self.buffer.readline)
+        self.assertRaises(BufferError, self.buffer.read_into, bytearray(1))
+        self.assertEqual(b'line\n', reader.read(5))
+        self.assertRaises(ValueError, self.buffer.reader, 'x' * 40)
+        reader.close()
+        self.buffer.write(b'test')
+        self.assertEqual(b'test', self.buffer.read(4))
+
+
+class ResizeTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer()
+
+    def testResize(self):
+        self.buffer.write(b'x' * 3000)
+        self.buffer.read(3000)
+        self.buffer.write(b'0123456789' * 400)
+        self.buffer.resize(14)
+        self.assertEqual(14, self.buffer.order)
+        self.buffer.write(b'y' * 10000)
+        self.assertEqual(b'0123456789' * 400 + b'y' * 10000, self.buffer.read(14000))
+        self.buffer.resize(12)
+        self.assertEqual(4096, self.buffer.stats()['count_bytes'])
+
+    def testResizeRefuses(self):
+        self.buffer.write(b'x' * 4000)
+        view = self.buffer.acquire(1)
+        self.assertRaises(BufferError, self.buffer.resize, 13)
+        view.release()
+        self.buffer.resize(13)
+        self.buffer.write(b'x' * 1000)
+        self.assertRaises(OSError, self.buffer.resize, 12)
+        self.assertRaises(ValueError, self.buffer.resize, 11)
+        self.assertEqual(13, self.buffer.order)
+
+        name = '/ring_buffer_test_resize'
+        shared = ring_buffer.Buffer.create_shared(name)
+        ring_buffer.unlink_shared(name)
+        self.assertRaises(OSError, shared.resize, 13)
+
+    def testAutoGrow(self):
+        buffer = ring_buffer.Buffer(max_order=14)
+        buffer.write(b'a' * 4096)
+        buffer.write(b'b' * 4096)
+        self.assertEqual(13, buffer.order)
+        buffer.push(b'c' * 6000)
+        self.assertEqual(14, buffer.order)
+        with self.assertRaises(ring_buffer.FullError):
+            buffer.write(b'd' * 8192)
+        self.assertEqual(b'a' * 4096 + b'b' * 4096, buffer.read(8192))
+        self.assertEqual(b'c' * 6000, buffer.pop())
+
+    def testAutoShrink(self):
+        buffer = ring_buffer.Buffer(max_order=14)
+        buffer.shrink_after = 0.01
+        buffer.write(b'a' * 16384)
+        self.assertEqual(14, buffer.order)
+        buffer.read(16000)
+        time.sleep(0.02)
+        buffer.write(b'b')
+        self.assertEqual(13, buffer.order)
+        time.sleep(0.02)
+        buffer.write(b'c')
+        time.sleep(0.02)
+        buffer.write(b'd')
+        self.assertEqual(12, buffer.order)
+        self.assertEqual(b'a' * 384 + b'bcd', buffer.read(387))
+
+    def testOrderArguments(self):
+        with self.assertRaises(AttributeError):
+            self.buffer.order = 13
+        self.assertRaises(ValueError, ring_buffer.Buffer, order=13, max_order=12)
+        self.assertRaises(ValueError, ring_buffer.Buffer, max_order=41)
+        self.assertRaises(ValueError, ring_buffer.Buffer, order=100)
+        self.assertRaises(ValueError, ring_buffer.Buffer.create_shared, '/rb-order', order=41)
+        self.assertRaises(ValueError, ring_buffer.Buffer.open_file, '/nonexistent', order=41)
+        with self.assertRaises(ValueError):
+            self.buffer.max_order = 11
+        self.buffer.max_order = 0
+        self.assertEqual(0, self.buffer.max_order)
+
+    def testFailedShrinkKeepsError(self):
+        buffer = ring_buffer.Buffer(order=12, max_order=14)
+        buffer.shrink_after = 0
+        buffer.write(b'x' * 10000)
+        buffer.read(10000)
+        view = memoryview(buffer)
+        self.assertRaises(ring_buffer.InsufficientDataError, buffer.pop, timeout=0.01)
+        view.release()
+
+
+class TrimTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer(order=16)
+        for i in range(15):
+            self.buffer.write(b'x' * 4096)
+            self.buffer.read(4096)
+
+    def testTrim(self):
+        self.assertTrue(self.buffer.resident_bytes() >= 15 * 4096)
+        self.buffer.write(b'0123456789' * 800)
+        self.buffer.trim()
+        self.assertTrue(self.buffer.resident_bytes() <= 3 * 4096)
+        self.assertEqual(b'0123456789' * 800, self.buffer.read(8000))
+        self.buffer.write(b'y' * 30000)
+        self.assertEqual(b'y' * 30000, self.buffer.read(30000))
+
+    def testTrimRefusesReserved(self):
+        view = self.buffer.reserve(100)
+        self.assertRaises(BufferError, self.buffer.trim)
+        view.release()
+        self.buffer.commit(0)
+        self.buffer.trim()
+
+    def testAutoTrim(self):
+        self.buffer.trim_after = 0.01
+        self.buffer.trim_below = 16
+        self.buffer.write(b'a')
+        time.sleep(0.02)
+        self.assertTrue(self.buffer.resident_bytes() >= 15 * 4096)
+        self.buffer.write(b'b')
+        self.assertTrue(self.buffer.resident_bytes() <= 4096)
+        self.assertEqual(b'ab', self.buffer.read(2))
+
+
+class BufferPoolTestCase(unittest.TestCase):
+    def testRecycle(self):
+        pool = ring_buffer.BufferPool(order=13, prealloc=2, max_cached=2)
+        self.assertEqual(2, len(pool))
+        first = pool.acquire()
+        self.assertEqual(13, first.order)
+        first.write(b'test')
+        first.reader('audit')
+        first.close()
+        del first
+        self.assertEqual(2, len(pool))
+
+        second = pool.acquire(overwrite=True)
+        self.assertEqual(0, len(second))
+        self.assertFalse(second.eof())
+        self.assertEqual(0, second.stats()['writes'])
+        second.write(b'x' * 5000)
+        second.write(b'y' * 5000)
+        self.assertEqual(b'x' * 3192 + b'y' * 5000, second.read(8192))
+        second.reader('audit').close()
+
+        others = [pool.acquire() for i in range(3)]
+        del others, second
+        self.assertEqual(2, len(pool))
+        stats = pool.stats()
+        self.assertEqual(3, stats['hits'])
+        self.assertEqual(2, stats['misses'])
+        self.assertEqual(0.6, stats['hit_rate'])
+        self.assertEqual(3, stats['recycled'])
+        self.assertEqual(2, stats['discarded'])
+
+    def testResizedBuffersAreNotCached(self):
+        pool = ring_buffer.BufferPool(order=12)
+        buffer = pool.acquire(record_format='<q')
+        self.assertEqual(8, buffer.record_size)
+        buffer.resize(13)
+        del buffer
+        self.assertEqual(0, len(pool))
+        self.assertEqual(1, pool.stats()['discarded'])
+
+    def testArguments(self):
+        self.assertRaises(ValueError, ring_buffer.BufferPool, order=11)
+        self.assertRaises(ValueError, ring_buffer.BufferPool, prealloc=2, max_cached=1)
+
+
+class SubmitTestCase(unittest.TestCase):
+    def setUp(self):
+        self.buffer = ring_buffer.Buffer()
+        self.sock, self.peer = socket.socketpair()
+
+    def tearDown(self):
+        self.sock.close()
+        self.peer.close()
+
+    def testRecv(self):
+        self.assertIn(ring_buffer.io_backend(), ('io_uring', 'poll'))
+        self.buffer.submit_recv(self.sock)
+        self.assertEqual([], ring_buffer.poll_completions())
+        self.peer.sendall(b'hello')
+        completions = ring_buffer.poll_completions(timeout=None)
+        self.assertEqual([(self.buffer, 'recv', self.sock.fileno(), 5)], completions)
+        self.assertEqual(b'hello', self.buffer.read(5))
+
+        self.buffer.submit_recv(self.sock.fileno(), max_bytes=2)
+        self.peer.sendall(b'more')
+        self.assertEqual(2, ring_buffer.poll_completions(timeout=1.0)[0][3])
+        self.assertEqual(b'mo', self.buffer.read(2))
+
+        self.buffer.submit_recv(self.sock)
+        self.assertEqual(2, ring_buffer.poll_completions(timeout=float('inf'))[0][3])
+        self.assertEqual(b're', self.buffer.read(2))
+
+    def testSend(self):
+        self.buffer.write(b'x' * 4000)
+        self.buffer.read(4000)
+        self.buffer.write(b'0123456789' * 10)
+        self.buffer.submit_send(self.sock)
+        self.assertEqual([(self.buffer, 'send', self.sock.fileno(), 100)],
+                         ring_buffer.poll_completions(timeout=None))
+        self.assertEqual(0, len(self.buffer))
+        self.assertEqual(b'0123456789' * 10, self.peer.recv(200))
+
+    def testEngineKeepsBuffer(self):
+        buffer = ring_buffer.Buffer()
+        buffer.submit_recv(self.sock)
+        references = sys.getrefcount(buffer)
+        del buffer
+        self.peer.close()
+        (buffer, op, fd, result), = ring_buffer.poll_completions(timeout=None)
+        self.assertEqual(('recv', 0), (op, result))
+        self.assertEqual(references - 1, sys.getrefcount(buffer))
+
+    def testRefuses(self):
+        self.buffer.submit_recv(self.sock)
+        self.assertRaises(OSError, self.buffer.submit_recv, self.sock)
+        self.assertRaises(OSError, self.buffer.trim)
+        self.assertRaises(ring_buffer.InsufficientDataError, self.buffer.submit_send, self.sock)
+        self.peer.sendall(b'x' * 4096)
+        ring_buffer.poll_completions(timeout=None)
+        while len(self.buffer) < 4096:
+            self.buffer.submit_recv(self.sock)
+            ring_buffer.poll_completions(timeout=None)
+        self.assertRaises(ring_buffer.FullError, self.buffer.submit_recv, self.sock)
+
+    def testSidesInFlight(self):
+        self.buffer.write(b'queued')
+        self.buffer.submit_recv(self.sock)
+        self.assertRaises(BufferError, self.buffer.write, b'test')
+        self.assertRaises(BufferError, self.buffer.push, b'test')
+        self.assertRaises(BufferError, self.buffer.reserve, 4)
+        self.assertEqual(b'queued', self.buffer.read(6))
+
+        self.peer.sendall(b'hello')
+        ring_buffer.poll_completions(timeout=None)
+        self.buffer.submit_send(self.sock)
+        self.assertRaises(BufferError, self.buffer.read, 1)
+        self.assertRaises(BufferError, self.buffer.acquire, 1)
+        self.assertRaises(BufferError, self.buffer.readline)
+        self.buffer.write(b'test')
+        ring_buffer.poll_completions(timeout=None)
+        self.assertEqual(b'hello', self.peer.recv(5))
+        self.assertEqual(b'test', self.buffer.read(4))
+
+
+class ObjectTestCase(unittest.TestCase):
+    def testRoundTrip(self):
+        buffer = ring_buffer.Buffer(18)
+        payload = bytearray(b'x' * 100000)
+        buffer.put_object({'id': 1, 'data': pickle.PickleBuffer(payload), 'tail': b'y' * 70000})
+        buffer.put_object(('second', None))
+        obj = buffer.get_object()
+        self.assertEqual(1, obj['id'])
+        self.assertEqual(payload, obj['data'])
+        self.assertIsInstance(obj['data'], bytearray)
+        self.assertEqual(b'y' * 70000, obj['tail'])
+        self.assertEqual(('second', None), buffer.get_object(timeout=0.1))
+        self.assertEqual(0, len(buffer))
+        self.assertRaises(ring_buffer.InsufficientDataError, buffer.get_object, timeout=0.01)
+        self.assertEqual(1, buffer.stats()['empty'])
+        overwriting = ring_buffer.Buffer(overwrite=True)
+        self.assertRaises(ring_buffer.InsufficientDataError, overwriting.get_object)
+        self.assertEqual(1, overwriting.stats()['empty'])
+
+    def testZeroCopy(self):
+        buffer = ring_buffer.Buffer(18)
+        buffer.put_object([pickle.PickleBuffer(b'z' * 100000)])
+        obj = buffer.get_object(zero_copy=True)
+        self.assertIsInstance(obj[0], memoryview)
+        self.assertTrue(obj[0].readonly)
+        self.assertEqual(b'z' * 100000, obj[0])
+        self.assertRaises(BufferError, buffer.get_object, zero_copy=True)
+        self.assertGreater(len(buffer), 100000)
+        del obj
+        buffer.release_object()
+        self.assertEqual(0, len(buffer))
+        self.assertRaises(ValueError, buffer.release_object)
+
+    def testRecords(self):
+        buffer = ring_buffer.Buffer(12)
+        buffer.push(b'test')
+        self.assertRaises(ValueError, buffer.get_object)
+        self.assertEqual(b'test', buffer.pop())
+        buffer.put_object('test')
+        self.assertEqual('test', pickle.loads(buffer.pop()[8:]))
+
+    def testFull(self):
+        buffer = ring_buffer.Buffer(12)
+        self.assertRaises(ring_buffer.FullError, buffer.put_object, b'x' * 5000)
+        self.assertRaises(TypeError, buffer.put_object, threading.Lock())
+        self.assertEqual(0, len(buffer))
+        self.assertEqual(1, buffer.stats()['full'])
+
+    def testOverwrite(self):
+        buffer = ring_buffer.Buffer(12, overwrite=True)
+        for i in range(10):
+            buffer.put_object((i, b'p' * 1000))
+        self.assertEqual((7, b'p' * 1000), buffer.get_object())
+        self.assertRaises(ValueError, buffer.get_object, zero_copy=True)
+
+
+class MPMCQueueTestCase(unittest.TestCase):
+    def setUp(self):
+        self.queue = ring_buffer.MPMCQueue(order=2, max_record_bytes=8)
+
+    def testPushPop(self):
+        self.queue.push(b'1234')
+        self.assertTrue(self.queue.try_push(b''))
+        self.assertEqual(2, len(self.queue))
+        self.assertEqual(b'1234', self.queue.pop())
+        self.assertEqual(b'', self.queue.try_pop())
+        self.assertEqual(None, self.queue.try_pop())
+        with self.assertRaises(ring_buffer.InsufficientDataError):
+            self.queue.pop()
+
+    def testFull(self):
+        for i in range(4):
+            self.queue.push(b'x')
+        self.assertFalse(self.queue.try_push(b'y'))
+        with self.assertRaises(ring_buffer.FullError):
+            self.queue.push(b'y')
+        self.assertRaises(ValueError, self.queue.push, b'123456789')
+
+    def testReinit(self):
+        self.queue.push(b'1234')
+        self.assertRaises(RuntimeError, self.queue.__init__, order=3)
+        self.assertEqual(b'1234', self.queue.pop())
+
+    def testBatches(self):
+        self.assertEqual(4, self.queue.push_many([b'a', b'b', b'c', b'd', b'e']))
+        self.assertEqual([b'a', b'b'], self.queue.pop_many(2))
+        self.assertEqual([b'c', b'd'], self.queue.pop_many())
+        self.assertEqual([], self.queue.pop_many())
+
+    def testThreads(self):
+        queue = ring_buffer.MPMCQueue(order=4, max_record_bytes=16)
+        popped = []
+
+        def produce(name):
+            for i in range(500):
+                while not queue.try_push(('%s%d' % (name, i)).encode()):
+                    time.sleep(0)
+
+        def consume():
+            while len(popped) < 1000:
+                record = queue.try_pop()
+                if record is None:
+                    time.sleep(0)
+                else:
+                    popped.append(record)
+
+        threads = [threading.Thread(target=produce, args=(name,)) for name in 'ab']
+        threads.append(threading.Thread(target=consume))
+        for thread in threads:
+            thread.start()
+        for thread in threads:
+            thread.join()
+        self.assertEqual(1000, len(set(popped)))
@@ -1,5 +1,15 @@
+#define _DEFAULT_SOURCE // posix_memalign, usleep
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
 #include "minunit.h"
 #include "../src/buffer.h"
 
@@ -9,7 +19,8 @@ static struct ring_buffer *
 construct_buffer()
 {
     struct ring_buffer *buffer;
-    buffer = malloc(sizeof *buffer);
+    if (posix_memalign((void **)&buffer, RING_BUFFER_CACHE_LINE_BYTES, sizeof *buffer))
+        return NULL;
 
     return buffer;
 }
@@ -36,12 +47,13 @@ test_address_ret()
 
     void *write_address = ring_buffer_write_address (buffer);
     mu_assert("ring_buffer write_address is correctly returned",
-              buffer->address + buffer->write_offset_bytes == write_address);
+              buffer->address + buffer->header->write_offset_bytes == write_address);
     void *read_address = ring_buffer_read_address (buffer);
     mu_assert("ring_buffer read_address is correctly returned",
-              buffer->address + buffer->read_offset_bytes == read_address);
+              buffer->address + buffer->header->read_offset_bytes == read_address);
 
     ring_buffer_free (buffer);
+    return 0;
 }
 
 static char *
@@ -64,6 +76,7 @@ test_address_advance()
               read_address + 1024 == read_advanced_address);
 
     ring_buffer_free (buffer);
+    return 0;
 }
 
 static char *
@@ -81,6 +94,7 @@ test_write()
               start_write_address + 4 == end_write_address);
 
     ring_buffer_free (buffer);
+    return 0;
 }
 
 static char *
@@ -108,6 +122,7 @@ test_read()
               is_the_same == 0);
 
     ring_buffer_free (buffer);
+    return 0;
 }
 
 static char *
@@ -121,10 +136,11 @@ test_write_close()
     ring_buffer_write (buffer, data, 4UL);
     ring_buffer_write_close (buffer);
 
-    mu_assert("ring_buffer_write_close sets the buffer->end_offset_bytes to buffer->write_offset_bytes",
-              buffer->end_offset_bytes == buffer->write_offset_bytes);
+    mu_assert("ring_buffer_write_close sets the buffer->header->end_offset_bytes to buffer->header->write_offset_bytes",
+              buffer->header->end_offset_bytes == buffer->header->write_offset_bytes);
 
     ring_buffer_free (buffer);
+    return 0;
 }
 
 static char *
@@ -143,6 +159,7 @@ test_eof()
               ring_buffer_eof (buffer));
 
     ring_buffer_free (buffer);
+    return 0;
 }
 
 static char *
@@ -171,6 +188,798 @@ test_peek()
               is_the_same);
 
     ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_wrap_mirror()
+{
+    struct ring_buffer *buffer = construct_buffer();
+
+    ring_buffer_create (buffer, 12);
+
+    char data[1024];
+    char read_data[1024];
+    memset (data, 'a', 1024);
+    ring_buffer_write (buffer, data, 1024UL);
+    ring_buffer_write (buffer, data, 1024UL);
+    ring_buffer_write (buffer, data, 1024UL);
+    ring_buffer_read (buffer, read_data, 1024UL);
+    ring_buffer_read (buffer, read_data, 1024UL);
+    ring_buffer_read (buffer, read_data, 1024UL);
+
+    int i;
+    for (i=0; i<1024; i++)
+        data[i] = (char)i;
+    ring_buffer_write (buffer, data, 1024UL); // straddles the end of the first mapping
+    ring_buffer_write (buffer, data, 1024UL);
+    ring_buffer_read (buffer, read_data, 512UL);
+    ring_buffer_read (buffer, read_data + 512, 512UL);
+
+    mu_assert("ring_buffer data written across the end is read back from the mirror",
+              memcmp (data, read_data, 1024) == 0);
+    mu_assert("ring_buffer offsets are monotonic and keep counting past count_bytes",
+              buffer->header->read_offset_bytes == 4096UL);
+    mu_assert("ring_buffer_count_bytes is the difference of the monotonic offsets",
+              ring_buffer_count_bytes (buffer) == 1024UL);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+#define SPSC_TOTAL_BYTES (1UL << 24)
+
+static void *
+spsc_producer(void *arg)
+{
+    struct ring_buffer *buffer = arg;
+    unsigned long sent = 0;
+
+    while (sent < SPSC_TOTAL_BYTES) {
+        unsigned long free_bytes = ring_buffer_producer_free_bytes (buffer, 1);
+        unsigned char *address = ring_buffer_write_address (buffer);
+        unsigned long i;
+
+        if (free_bytes == 0)
+            sched_yield (); // let the consumer run on a single CPU
+        if (free_bytes > SPSC_TOTAL_BYTES - sent)
+            free_bytes = SPSC_TOTAL_BYTES - sent;
+        for (i=0; i<free_bytes; i++)
+            address[i] = (unsigned char)(sent + i);
+        ring_buffer_write_advance (buffer, free_bytes);
+        sent += free_bytes;
+    }
+
+    return NULL;
+}
+
+static char *
+test_spsc_threads()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    pthread_t producer;
+    unsigned long received = 0;
+    int is_in_order = 1;
+
+    ring_buffer_create (buffer, 12);
+    pthread_create (&producer, NULL, spsc_producer, buffer);
+
+    while (received < SPSC_TOTAL_BYTES) {
+        unsigned long count_bytes = ring_buffer_consumer_count_bytes (buffer, 1);
+        unsigned char *address = ring_buffer_read_address (buffer);
+        unsigned long i;
+
+        if (count_bytes == 0)
+            sched_yield ();
+        for (i=0; i<count_bytes; i++) {
+            if (address[i] != (unsigned char)(received + i))
+                is_in_order = 0;
+        }
+        ring_buffer_read_advance (buffer, count_bytes);
+        received += count_bytes;
+    }
+    pthread_join (producer, NULL);
+
+    mu_assert("ring_buffer consumer thread sees the producer thread's bytes in order",
+              is_in_order);
+    mu_assert("ring_buffer is empty after the consumer drained it",
+              ring_buffer_count_bytes (buffer) == 0);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_shared_attach()
+{
+    struct ring_buffer *producer = construct_buffer();
+    struct ring_buffer *consumer = construct_buffer();
+    char name[64];
+
+    snprintf (name, sizeof name, "/ring_buffer_test_%d", (int)getpid ());
+    mu_assert("ring_buffer_create_shared creates a named buffer",
+              ring_buffer_create_shared (producer, name, 12) == 0);
+    mu_assert("ring_buffer_create_shared refuses an existing name",
+              ring_buffer_create_shared (consumer, name, 12) == -1);
+    mu_assert("ring_buffer_attach maps the named buffer a second time",
+              ring_buffer_attach (consumer, name) == 0);
+    ring_buffer_unlink (name);
+
+    char data[] = "test";
+    char read_data[4];
+    ring_buffer_write (producer, data, 4UL);
+    ring_buffer_write_close (producer);
+    mu_assert("ring_buffer_attach sees the creator's write offset",
+              ring_buffer_count_bytes (consumer) == 4UL);
+    ring_buffer_read (consumer, read_data, 4UL);
+    mu_assert("ring_buffer_attach reads the bytes the creator wrote",
+              memcmp (data, read_data, 4) == 0);
+    mu_assert("ring_buffer_attach sees the creator's write_close",
+              ring_buffer_write_closed (consumer) && ring_buffer_eof (producer));
+    mu_assert("ring_buffer_attach fails for a removed name",
+              ring_buffer_attach (construct_buffer (), name) == -1);
+
+    ring_buffer_free (producer);
+    ring_buffer_free (consumer);
+    return 0;
+}
+
+static void *
+delayed_producer(void *arg)
+{
+    struct ring_buffer *buffer = arg;
+    char data[] = "test";
+
+    usleep (10000);
+    ring_buffer_write (buffer, data, 4UL);
+    return NULL;
+}
+
+static char *
+test_wait_readable()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    pthread_t producer;
+
+    ring_buffer_create (buffer, 12);
+
+    mu_assert("ring_buffer_wait_readable times out on an empty buffer",
+              ring_buffer_wait_readable (buffer, 1, 1000000L) == -1 && errno == ETIMEDOUT);
+    mu_assert("ring_buffer_wait_writable returns at once when there is room",
+              ring_buffer_wait_writable (buffer, 4096, 0) == 0);
+
+    pthread_create (&producer, NULL, delayed_producer, buffer);
+    mu_assert("ring_buffer_wait_readable is woken by the producer",
+              ring_buffer_wait_readable (buffer, 4, -1) == 0);
+    mu_assert("ring_buffer_wait_readable returns with the bytes readable",
+              ring_buffer_count_bytes (buffer) == 4UL);
+    pthread_join (producer, NULL);
+
+    mu_assert("ring_buffer_wait_writable times out when there is not enough room",
+              ring_buffer_wait_writable (buffer, 4096, 1000000L) == -1 && errno == ETIMEDOUT);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_eventfd()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    eventfd_t value;
+    char data[4096];
+
+    ring_buffer_create (buffer, 12);
+    mu_assert("ring_buffer_enable_eventfd creates the eventfds",
+              ring_buffer_enable_eventfd (buffer) == 0 && buffer->readable_fd >= 0);
+
+    ring_buffer_write (buffer, data, 4UL);
+    mu_assert("ring_buffer_write_advance signals readable_fd when the buffer becomes non-empty",
+              eventfd_read (buffer->readable_fd, &value) == 0 && value == 1);
+    ring_buffer_write (buffer, data, 4UL);
+    mu_assert("ring_buffer_write_advance does not signal readable_fd without a crossing",
+              eventfd_read (buffer->readable_fd, &value) == -1 && errno == EAGAIN);
+
+    ring_buffer_set_readable_mark (buffer, 16);
+    ring_buffer_write (buffer, data, 4UL);
+    ring_buffer_write (buffer, data, 4UL);
+    mu_assert("ring_buffer_write_advance signals readable_fd when the readable mark is reached",
+              eventfd_read (buffer->readable_fd, &value) == 0 && value == 1);
+
+    ring_buffer_write (buffer, data, 4096UL - 16UL);
+    ring_buffer_read (buffer, data, 1UL);
+    mu_assert("ring_buffer_read_advance signals writable_fd when the buffer stops being full",
+              eventfd_read (buffer->writable_fd, &value) == 0 && value == 1);
+
+    ring_buffer_free (buffer);
+    mu_assert("ring_buffer_free closes the eventfds", buffer->readable_fd == -1);
+    return 0;
+}
+
+static char *
+test_records()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    char data[1000];
+    unsigned long count_bytes;
+    char *record;
+    int i, is_in_order = 1;
+
+    ring_buffer_create (buffer, 12);
+    mu_assert("ring_buffer_front_record returns NULL on an empty buffer",
+              ring_buffer_front_record (buffer, &count_bytes) == NULL);
+
+    /* 1004-byte records do not divide 4096, so they end up straddling the mirror */
+    for (i=0; i<20; i++) {
+        memset (data, 'a' + i, sizeof data);
+        mu_assert("ring_buffer_push_record fits while there is room",
+                  ring_buffer_push_record (buffer, data, (unsigned long)(i % 2 ? 1000 : 10)) == 0);
+        record = ring_buffer_front_record (buffer, &count_bytes);
+        if (count_bytes != (unsigned long)(i % 2 ? 1000 : 10) || record[count_bytes - 1] != 'a' + i)
+            is_in_order = 0;
+        ring_buffer_pop_record (buffer);
+    }
+    mu_assert("ring_buffer_front_record returns each record whole",
+              is_in_order);
+
+    for (i=0; i<4; i++)
+        ring_buffer_push_record (buffer, data, 1000UL);
+    mu_assert("ring_buffer_push_record refuses a record that does not fit",
+              ring_buffer_push_record (buffer, data, 100UL) == -1);
+    mu_assert("ring_buffer_push_record leaves the buffer alone when full",
+              ring_buffer_count_bytes (buffer) == 4016UL);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_writev_readv()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    char first[] = "te", second[] = "st", big[4096];
+    char read_first[3], read_second[8];
+    struct iovec iov[3];
+
+    ring_buffer_create (buffer, 12);
+
+    iov[0].iov_base = first;
+    iov[0].iov_len = 2;
+    iov[1].iov_base = second;
+    iov[1].iov_len = 2;
+    iov[2].iov_base = first;
+    iov[2].iov_len = 1;
+    mu_assert("ring_buffer_writev copies every piece",
+              ring_buffer_writev (buffer, iov, 3) == 5 && ring_buffer_count_bytes (buffer) == 5UL);
+
+    iov[0].iov_base = read_first;
+    iov[0].iov_len = 3;
+    iov[1].iov_base = read_second;
+    iov[1].iov_len = 8;
+    mu_assert("ring_buffer_readv copies no more than is readable",
+              ring_buffer_readv (buffer, iov, 2) == 5 && ring_buffer_count_bytes (buffer) == 0UL);
+    mu_assert("ring_buffer_readv fills the pieces in order",
+              memcmp (read_first, "tes", 3) == 0 && memcmp (read_second, "tt", 2) == 0);
+
+    iov[0].iov_base = big;
+    iov[0].iov_len = 4096;
+    iov[1].iov_base = first;
+    iov[1].iov_len = 1;
+    mu_assert("ring_buffer_writev writes nothing when the pieces do not all fit",
+              ring_buffer_writev (buffer, iov, 2) == -1 && ring_buffer_count_bytes (buffer) == 0UL);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_fd_io()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    int fds[2];
+    char data[4096];
+
+    ring_buffer_create (buffer, 12);
+    pipe (fds);
+
+    memset (data, 'a', sizeof data);
+    write (fds[1], data, 3000);
+    mu_assert("ring_buffer_fill_from_fd reads no more than max_bytes",
+              ring_buffer_fill_from_fd (buffer, fds[0], 1000) == 1000);
+    mu_assert("ring_buffer_fill_from_fd reads what the fd has",
+              ring_buffer_fill_from_fd (buffer, fds[0], 0) == 2000 && ring_buffer_count_bytes (buffer) == 3000UL);
+
+    mu_assert("ring_buffer_drain_to_fd writes every readable byte",
+              ring_buffer_drain_to_fd (buffer, fds[1], 0) == 3000 && ring_buffer_count_bytes (buffer) == 0UL);
+
+    /* the buffer's write offset is now at 3000, so this fill wraps */
+    mu_assert("ring_buffer_fill_from_fd fills across the end of the mapping",
+              ring_buffer_fill_from_fd (buffer, fds[0], 0) == 3000);
+    ring_buffer_read (buffer, data, 3000UL);
+    mu_assert("ring_buffer_fill_from_fd keeps the bytes in order",
+              data[0] == 'a' && data[2999] == 'a');
+
+    close (fds[1]);
+    mu_assert("ring_buffer_fill_from_fd returns 0 at end of file",
+              ring_buffer_fill_from_fd (buffer, fds[0], 0) == 0);
+    close (fds[0]);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_create_with_options()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    struct ring_buffer_options options = RING_BUFFER_DEFAULT_OPTIONS;
+    char data[] = "test";
+    char read_data[4];
+
+    /* a 2 MiB huge page cannot back a 4 KiB buffer, so this has to fall back */
+    options.huge_page_bytes = 2UL << 20;
+    options.populate = 1;
+    options.lock = 1;
+    mu_assert("ring_buffer_create_with_options creates the buffer",
+              ring_buffer_create_with_options (buffer, 12, &options) == 0);
+    mu_assert("ring_buffer_create_with_options falls back to normal pages",
+              buffer->page_size == sysconf (_SC_PAGESIZE));
+
+    ring_buffer_write (buffer, data, 4UL);
+    ring_buffer_read (buffer, read_data, 4UL);
+    mu_assert("ring_buffer_create_with_options buffer reads back what was written",
+              memcmp (data, read_data, 4) == 0);
+    ring_buffer_free (buffer);
+
+    options = (struct ring_buffer_options)RING_BUFFER_DEFAULT_OPTIONS;
+    options.numa_node = RING_BUFFER_MAX_NUMA_NODES;
+    mu_assert("ring_buffer_create_with_options rejects an impossible NUMA node",
+              ring_buffer_create_with_options (buffer, 12, &options) == -1 && errno == EINVAL);
+
+    return 0;
+}
+
+static char *
+test_overwrite()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    char data[3000], snapshot[4096];
+    unsigned long count_bytes;
+    char *record;
+
+    ring_buffer_create (buffer, 12);
+    ring_buffer_set_overwrite (buffer, 1);
+
+    memset (data, 'a', sizeof data);
+    ring_buffer_write (buffer, data, 3000UL);
+    memset (data, 'b', sizeof data);
+    ring_buffer_write (buffer, data, 3000UL);
+    mu_assert("ring_buffer_write discards the oldest bytes in overwrite mode",
+              ring_buffer_dropped_bytes (buffer) == 1904UL && ring_buffer_count_bytes (buffer) == 4096UL);
+    mu_assert("ring_buffer_snapshot copies the whole window",
+              ring_buffer_snapshot (buffer, snapshot) == 4096UL);
+    mu_assert("ring_buffer_snapshot keeps the newest bytes",
+              snapshot[1095] == 'a' && snapshot[1096] == 'b' && snapshot[4095] == 'b');
+    mu_assert("ring_buffer_snapshot does not consume",
+              ring_buffer_count_bytes (buffer) == 4096UL);
+
+    /* a stale claim must not consume the bytes the producer gave up */
+    ring_buffer_read_address (buffer);
+    ring_buffer_write (buffer, data, 10UL);
+    mu_assert("ring_buffer_read_advance fails after the producer discarded the bytes",
+              ring_buffer_read_advance (buffer, 10UL) == -1);
+
+    ring_buffer_clear (buffer);
+    memset (data, 'c', sizeof data);
+    ring_buffer_push_record (buffer, data, 1000UL);
+    memset (data, 'd', sizeof data);
+    ring_buffer_push_record (buffer, data, 2000UL);
+    memset (data, 'e', sizeof data);
+    ring_buffer_push_record (buffer, data, 1500UL);
+    mu_assert("ring_buffer_push_record discards whole records in overwrite mode",
+              ring_buffer_dropped_records (buffer) == 1UL && ring_buffer_dropped_bytes (buffer) == 1004UL);
+
+    record = ring_buffer_front_record (buffer, &count_bytes);
+    mu_assert("ring_buffer_front_record starts at the oldest surviving record",
+              count_bytes == 2000UL && record[0] == 'd');
+    mu_assert("ring_buffer_pop_record pops a record nobody discarded",
+              ring_buffer_pop_record (buffer) == 0);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+#define OVERWRITE_RECORDS 100000U
+
+static int overwrite_producer_done;
+
+static void *
+overwrite_producer(void *arg)
+{
+    struct ring_buffer *buffer = arg;
+    unsigned char data[4 + 255];
+    uint32_t sequence;
+
+    for (sequence = 0; sequence < OVERWRITE_RECORDS; sequence++) {
+        memcpy (data, &sequence, sizeof sequence);
+        memset (data + 4, (unsigned char)sequence, sequence % 256);
+        ring_buffer_push_record (buffer, (char *)data, 4 + sequence % 256);
+    }
+    __atomic_store_n (&overwrite_producer_done, 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+static char *
+test_overwrite_threads()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    pthread_t producer;
+    unsigned char copy[4 + 255];
+    unsigned long count_bytes, i;
+    uint32_t sequence;
+    long last = -1;
+    int is_intact = 1;
+    char *record;
+
+    ring_buffer_create (buffer, 12);
+    ring_buffer_set_overwrite (buffer, 1);
+    overwrite_producer_done = 0;
+    pthread_create (&producer, NULL, overwrite_producer, buffer);
+
+    for (;;) {
+        record = ring_buffer_front_record (buffer, &count_bytes);
+        if (record == NULL) {
+            if (__atomic_load_n (&overwrite_producer_done, __ATOMIC_ACQUIRE)
+                && ring_buffer_count_bytes (buffer) == 0)
+                break;
+            sched_yield ();
+            continue;
+        }
+        memcpy (copy, record, count_bytes < sizeof copy ? count_bytes : sizeof copy);
+        if (ring_buffer_pop_record (buffer) < 0)
+            continue;
+
+        memcpy (&sequence, copy, sizeof sequence);
+        if (count_bytes != 4 + sequence % 256 || (long)sequence <= last)
+            is_intact = 0;
+        for (i=4; i<count_bytes; i++) {
+            if (copy[i] != (unsigned char)sequence)
+                is_intact = 0;
+        }
+        last = sequence;
+    }
+    pthread_join (producer, NULL);
+
+    mu_assert("ring_buffer consumer pops only whole, newer records while the producer laps it",
+              is_intact);
+    mu_assert("ring_buffer consumer ends with the last record",
+              last == OVERWRITE_RECORDS - 1);
+    mu_assert("ring_buffer counts every record the consumer did not get as dropped",
+              ring_buffer_dropped_records (buffer) > 0);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_stats()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    char data[3000];
+    struct iovec iov = { data, sizeof data };
+    unsigned long count_bytes = 0;
+    int i;
+
+    ring_buffer_create (buffer, 12);
+    mu_assert("ring_buffer_enable_timestamps allocates the sample queue",
+              ring_buffer_enable_timestamps (buffer) == 0);
+
+    for (i=0; i<3; i++) {
+        ring_buffer_write (buffer, data, sizeof data);
+        ring_buffer_read (buffer, data, sizeof data);
+    }
+    mu_assert("ring_buffer counts the bytes and advances on both sides",
+              buffer->producer_stats.bytes_written == 9000UL && buffer->producer_stats.writes == 3UL
+              && buffer->consumer_stats.bytes_read == 9000UL && buffer->consumer_stats.reads == 3UL);
+    mu_assert("ring_buffer counts reads past the end of the first mapping",
+              buffer->consumer_stats.wraps == 2UL);
+
+    ring_buffer_write (buffer, data, sizeof data);
+    mu_assert("ring_buffer_writev counts a write refused for lack of room",
+              ring_buffer_writev (buffer, &iov, 1) == -1 && buffer->producer_stats.full == 1UL);
+    mu_assert("ring_buffer records the fullest buffer it saw",
+              buffer->producer_stats.high_water_bytes == 3000UL);
+
+    for (i=0; i<RING_BUFFER_LATENCY_BUCKETS; i++)
+        count_bytes += buffer->latency->buckets[i];
+    mu_assert("ring_buffer puts every write the consumer finished in the latency histogram",
+              count_bytes == 3UL);
+
+    ring_buffer_reset_stats (buffer);
+    mu_assert("ring_buffer_reset_stats zeroes the counters",
+              buffer->producer_stats.bytes_written == 0 && buffer->consumer_stats.wraps == 0);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_file_backed()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    struct ring_buffer *second = construct_buffer();
+    char path[64], data[8];
+    pid_t pid;
+
+    snprintf (path, sizeof path, "/tmp/ring_buffer_test_%d", (int)getpid ());
+    unlink (path);
+    mu_assert("ring_buffer_open_file creates a file-backed buffer",
+              ring_buffer_open_file (buffer, path, 12) == 0 && buffer->count_bytes == 4096UL);
+    mu_assert("ring_buffer_open_file commits the empty buffer",
+              ring_buffer_generation (buffer) == 1UL);
+    mu_assert("ring_buffer_open_file shares a file that is already open",
+              ring_buffer_open_file (second, path, 0) == 0);
+    ring_buffer_write (buffer, "abcd", 4UL);
+    mu_assert("ring_buffer_open_file sees the live offsets of a shared file",
+              ring_buffer_count_bytes (second) == 4UL);
+    ring_buffer_free (second);
+    ring_buffer_free (buffer);
+    mu_assert("ring_buffer_open_file refuses a file of another order",
+              ring_buffer_open_file (buffer, path, 13) == -1 && errno == EINVAL);
+
+    // a child that dies without ring_buffer_free loses what it did after its last sync
+    pid = fork ();
+    if (pid == 0) {
+        ring_buffer_open_file (buffer, path, 0);
+        ring_buffer_read (buffer, data, 2UL);
+        ring_buffer_write (buffer, "efgh", 4UL);
+        ring_buffer_sync (buffer);
+        ring_buffer_read (buffer, data, 2UL);
+        ring_buffer_write (buffer, "ijkl", 4UL);
+        _exit (0);
+    }
+    waitpid (pid, NULL, 0);
+
+    mu_assert("ring_buffer_open_file recovers the last commit",
+              ring_buffer_open_file (buffer, path, 0) == 0 && ring_buffer_count_bytes (buffer) == 6UL);
+    ring_buffer_read (buffer, data, 6UL);
+    mu_assert("ring_buffer_open_file resumes from the committed read offset",
+              memcmp (data, "cdefgh", 6) == 0);
+
+    ring_buffer_set_sync_policy (buffer, RING_BUFFER_SYNC_ALWAYS, 0);
+    ring_buffer_write (buffer, "mn", 2UL);
+    mu_assert("RING_BUFFER_SYNC_ALWAYS commits every advance",
+              ring_buffer_generation (buffer) == 5UL);
+    ring_buffer_set_sync_policy (buffer, RING_BUFFER_SYNC_INTERVAL, 1000000000UL);
+    ring_buffer_write (buffer, "op", 2UL);
+    mu_assert("RING_BUFFER_SYNC_INTERVAL waits for the interval",
+              ring_buffer_generation (buffer) == 5UL);
+
+    ring_buffer_free (buffer);
+    unlink (path);
+    return 0;
+}
+
+static char *
+test_find()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    char data[4096];
+
+    ring_buffer_create (buffer, 12);
+    ring_buffer_write (buffer, "abc\ndef\r", 8UL);
+    mu_assert("ring_buffer_find finds a byte",
+              ring_buffer_find (buffer, "\n", 1UL) == 3);
+    mu_assert("ring_buffer_find returns -1 without a match",
+              ring_buffer_find (buffer, "\r\n", 2UL) == -1);
+    mu_assert("ring_buffer_find remembers where a miss stopped",
+              buffer->scan_offset_bytes == 7UL && buffer->scan_delimiter_bytes == 2UL);
+    ring_buffer_write (buffer, "\n", 1UL);
+    mu_assert("ring_buffer_find finds a delimiter split across two writes",
+              ring_buffer_find (buffer, "\r\n", 2UL) == 7);
+
+    // a line that wraps around the end of the first mapping
+    ring_buffer_read (buffer, data, 9UL);
+    memset (data, 'x', sizeof data);
+    ring_buffer_write (buffer, data, 4091UL);
+    ring_buffer_read (buffer, data, 4079UL);
+    ring_buffer_write (buffer, "yy\n", 3UL);
+    mu_assert("ring_buffer_find scans across the wrap",
+              ring_buffer_find (buffer, "\n", 1UL) == 14 && ring_buffer_find (buffer, "xyy", 3UL) == 11);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_broadcast()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    char data[4096], name[16];
+    int archiver, parser, i;
+
+    ring_buffer_create (buffer, 12);
+    archiver = ring_buffer_cursor_open (buffer, "archiver");
+    parser = ring_buffer_cursor_open (buffer, "parser");
+    mu_assert("ring_buffer_cursor_open opens cursors",
+              archiver >= 0 && parser >= 0 && archiver != parser);
+    mu_assert("ring_buffer_cursor_open resumes a cursor by name",
+              ring_buffer_cursor_open (buffer, "parser") == parser);
+
+    memset (data, 'x', sizeof data);
+    ring_buffer_write (buffer, data, 4096UL);
+    memcpy (data, ring_buffer_cursor_read_address (buffer, archiver), 4096UL);
+    ring_buffer_cursor_read_advance (buffer, archiver, 4096UL);
+    mu_assert("every cursor reads every byte",
+              ring_buffer_cursor_count_bytes (buffer, archiver) == 0
+              && ring_buffer_cursor_count_bytes (buffer, parser) == 4096UL);
+    mu_assert("the slowest cursor bounds the producer",
+              ring_buffer_count_free_bytes (buffer) == 0);
+    ring_buffer_cursor_read_advance (buffer, parser, 1024UL);
+    mu_assert("the slowest cursor advancing frees room",
+              ring_buffer_count_free_bytes (buffer) == 1024UL);
+    mu_assert("ring_buffer_cursor_wait_readable times out on a drained cursor",
+              ring_buffer_cursor_wait_readable (buffer, archiver, 1, 1000000L) == -1 && errno == ETIMEDOUT);
+
+    for (i = 2; i < RING_BUFFER_MAX_CURSORS; i++) {
+        snprintf (name, sizeof name, "reader%d", i);
+        ring_buffer_cursor_open (buffer, name);
+    }
+    mu_assert("ring_buffer_cursor_open fails with ENOSPC when all cursors are in use",
+              ring_buffer_cursor_open (buffer, "one too many") == -1 && errno == ENOSPC);
+    for (i = 0; i < RING_BUFFER_MAX_CURSORS; i++)
+        ring_buffer_cursor_close (buffer, i);
+    mu_assert("closing the last cursor frees everything",
+              ring_buffer_count_free_bytes (buffer) == 4096UL);
+
+    // an overwriting producer passes a slow cursor, which skips ahead and counts the loss
+    ring_buffer_set_overwrite (buffer, 1);
+    archiver = ring_buffer_cursor_open (buffer, "archiver");
+    ring_buffer_write (buffer, data, 4096UL);
+    ring_buffer_write (buffer, data, 100UL);
+    mu_assert("a lapped cursor skips to the oldest byte left",
+              ring_buffer_cursor_count_bytes (buffer, archiver) == 4096UL
+              && buffer->header->cursors[archiver].dropped_bytes == 100UL);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_resize()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    struct ring_buffer *shared = construct_buffer();
+    const char *name = "/ring_buffer_test_resize";
+    char data[8192], out[8192];
+    int i;
+
+    for (i = 0; i < (int)sizeof data; i++)
+        data[i] = i % 251;
+
+    // put the readable bytes across the wrap, so they land in both halves of a bigger buffer
+    ring_buffer_create (buffer, 12);
+    ring_buffer_write (buffer, data, 3000UL);
+    ring_buffer_read (buffer, out, 3000UL);
+    ring_buffer_write (buffer, data, 4000UL);
+    mu_assert("ring_buffer_resize grows a buffer",
+              ring_buffer_resize (buffer, 14) == 0 && buffer->count_bytes == 16384UL
+              && ring_buffer_count_bytes (buffer) == 4000UL);
+    ring_buffer_write (buffer, data + 4000, 4192UL);
+    ring_buffer_read (buffer, out, 8192UL);
+    mu_assert("a grown buffer keeps the readable bytes in order",
+              memcmp (out, data, 8192UL) == 0);
+
+    ring_buffer_write (buffer, data, 5000UL);
+    mu_assert("ring_buffer_resize refuses to drop readable bytes",
+              ring_buffer_resize (buffer, 12) == -1 && errno == ENOSPC);
+    ring_buffer_read (buffer, out, 2000UL);
+    mu_assert("ring_buffer_resize shrinks a buffer",
+              ring_buffer_resize (buffer, 12) == 0 && buffer->count_bytes == 4096UL
+              && ring_buffer_count_bytes (buffer) == 3000UL);
+    ring_buffer_read (buffer, out, 3000UL);
+    mu_assert("a shrunk buffer keeps the readable bytes in order",
+              memcmp (out, data + 2000, 3000UL) == 0 && ring_buffer_count_free_bytes (buffer) == 4096UL);
+
+    // the producer's cached read offset stays behind the 9000 bytes read before the shrink
+    ring_buffer_resize (buffer, 14);
+    ring_buffer_write (buffer, data, 8000UL);
+    ring_buffer_write (buffer, data, 2000UL);
+    ring_buffer_read (buffer, out, 8000UL);
+    ring_buffer_read (buffer, out, 1000UL);
+    ring_buffer_resize (buffer, 12);
+    mu_assert("a shrunk buffer counts the free bytes against the pending ones",
+              ring_buffer_producer_free_bytes (buffer, 4096UL) == 3096UL);
+    for (i = 0; i < 8192 && ring_buffer_producer_free_bytes (buffer, 1UL) >= 1; i++)
+        ring_buffer_write (buffer, data + i % 251, 1UL);
+    mu_assert("a shrunk buffer with pending bytes runs full without overwriting them",
+              i == 3096 && ring_buffer_count_bytes (buffer) == 4096UL
+              && (ring_buffer_read (buffer, out, 1000UL), memcmp (out, data + 1000, 1000UL) == 0));
+    ring_buffer_clear (buffer);
+
+    mu_assert("ring_buffer_resize refuses an order under the page size",
+              ring_buffer_resize (buffer, 11) == -1 && errno == EINVAL);
+    ring_buffer_cursor_open (buffer, "reader");
+    mu_assert("ring_buffer_resize refuses while cursors are open",
+              ring_buffer_resize (buffer, 13) == -1 && errno == EBUSY);
+
+    ring_buffer_create_shared (shared, name, 12);
+    ring_buffer_unlink (name);
+    mu_assert("ring_buffer_resize refuses a buffer other processes map",
+              ring_buffer_resize (shared, 13) == -1 && errno == EINVAL);
+
+    ring_buffer_free (shared);
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_trim()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    char data[8192], out[8192];
+    unsigned long i;
+
+    for (i = 0; i < sizeof data; i++)
+        data[i] = i % 251;
+
+    ring_buffer_create (buffer, 16);
+    for (i = 0; i < 7; i++)
+        ring_buffer_write (buffer, data, 8192UL);
+    for (i = 0; i < 7; i++)
+        ring_buffer_read (buffer, out, 8192UL);
+    ring_buffer_write (buffer, data, 5000UL);
+    ring_buffer_read (buffer, out, 5000UL);
+    mu_assert("ring_buffer_resident_bytes counts the pages written",
+              ring_buffer_resident_bytes (buffer) >= 7 * 8192L);
+    mu_assert("ring_buffer_trim gives back the pages of an empty buffer",
+              ring_buffer_trim (buffer) == 0 && ring_buffer_resident_bytes (buffer) <= 4096L);
+
+    // the readable bytes wrap, and the pages they are on stay
+    ring_buffer_write (buffer, data, 8192UL);
+    mu_assert("ring_buffer_trim keeps the readable bytes",
+              ring_buffer_trim (buffer) == 0 && ring_buffer_resident_bytes (buffer) <= 3 * 4096L);
+    ring_buffer_read (buffer, out, 8192UL);
+    mu_assert("a trimmed buffer reads back what was written",
+              memcmp (out, data, 8192UL) == 0);
+    ring_buffer_write (buffer, data, 8192UL);
+    ring_buffer_read (buffer, out, 8192UL);
+    mu_assert("a trimmed buffer takes writes on the pages it gave back",
+              memcmp (out, data, 8192UL) == 0);
+
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_reset()
+{
+    struct ring_buffer *buffer = construct_buffer();
+    char data[100];
+
+    ring_buffer_create (buffer, 12);
+    ring_buffer_enable_timestamps (buffer);
+    ring_buffer_enable_eventfd (buffer);
+    ring_buffer_set_overwrite (buffer, 1);
+    ring_buffer_cursor_open (buffer, "reader");
+    ring_buffer_cursor_open (buffer, "other");
+    ring_buffer_write (buffer, data, sizeof data);
+    ring_buffer_write_close (buffer);
+
+    ring_buffer_reset (buffer);
+    mu_assert("ring_buffer_reset empties the buffer and reopens it for writes",
+              ring_buffer_count_bytes (buffer) == 0 && !ring_buffer_write_closed (buffer));
+    mu_assert("ring_buffer_reset turns off overwrite mode, eventfds and timestamps",
+              !ring_buffer_overwrite (buffer) && buffer->readable_fd == -1 && buffer->writable_fd == -1
+              && buffer->latency == NULL);
+    mu_assert("ring_buffer_reset zeroes the counters",
+              buffer->producer_stats.writes == 0 && buffer->producer_stats.bytes_written == 0);
+    mu_assert("ring_buffer_reset closes every cursor",
+              ring_buffer_cursor_open (buffer, "other") == 0);
+
+    ring_buffer_free (buffer);
+    return 0;
 }
 
 static char *all_tests()
@@ -183,6 +992,24 @@ static char *all_tests()
     mu_run_test(test_write_close);
     mu_run_test(test_eof);
     mu_run_test(test_peek);
+    mu_run_test(test_wrap_mirror);
+    mu_run_test(test_spsc_threads);
+    mu_run_test(test_shared_attach);
+    mu_run_test(test_wait_readable);
+    mu_run_test(test_eventfd);
+    mu_run_test(test_records);
+    mu_run_test(test_writev_readv);
+    mu_run_test(test_fd_io);
+    mu_run_test(test_create_with_options);
+    mu_run_test(test_overwrite);
+    mu_run_test(test_overwrite_threads);
+    mu_run_test(test_stats);
+    mu_run_test(test_file_backed);
+    mu_run_test(test_find);
+    mu_run_test(test_broadcast);
+    mu_run_test(test_resize);
+    mu_run_test(test_trim);
+    mu_run_test(test_reset);
     return 0;
 }
 
@@ -0,0 +1,173 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "minunit.h"
+#include "../src/mpmc.h"
+
+int tests_run = 0;
+
+static char *
+test_push_pop()
+{
+    struct mpmc_queue queue;
+    char data[16];
+
+    mu_assert("mpmc_queue_create creates a queue",
+              mpmc_queue_create (&queue, 2, 16) == 0);
+    mu_assert("mpmc_queue_try_pop fails on an empty queue",
+              mpmc_queue_try_pop (&queue, data) == -1 && errno == EAGAIN);
+
+    mu_assert("mpmc_queue_try_push appends a record",
+              mpmc_queue_try_push (&queue, "test", 4UL) == 0);
+    mu_assert("mpmc_queue_try_push appends an empty record",
+              mpmc_queue_try_push (&queue, "", 0UL) == 0);
+    mu_assert("mpmc_queue_try_push refuses a record above max_record_bytes",
+              mpmc_queue_try_push (&queue, data, 17UL) == -1 && errno == EMSGSIZE);
+    mpmc_queue_try_push (&queue, "a", 1UL);
+    mpmc_queue_try_push (&queue, "b", 1UL);
+    mu_assert("mpmc_queue_try_push fails on a full queue",
+              mpmc_queue_try_push (&queue, "c", 1UL) == -1 && errno == EAGAIN);
+    mu_assert("mpmc_queue_count counts the records",
+              mpmc_queue_count (&queue) == 4UL);
+
+    mu_assert("mpmc_queue_try_pop returns the oldest record",
+              mpmc_queue_try_pop (&queue, data) == 4 && memcmp (data, "test", 4) == 0);
+    mu_assert("mpmc_queue_try_pop returns an empty record",
+              mpmc_queue_try_pop (&queue, data) == 0);
+
+    mpmc_queue_free (&queue);
+    return 0;
+}
+
+static char *
+test_batches()
+{
+    struct mpmc_queue queue;
+    char storage[8][8];
+    struct iovec records[8];
+    int i;
+
+    mpmc_queue_create (&queue, 2, 8);
+    for (i=0; i<8; i++) {
+        records[i].iov_base = "abcdefgh" + i;
+        records[i].iov_len = 1;
+    }
+    mu_assert("mpmc_queue_try_push_many pushes as many as fit",
+              mpmc_queue_try_push_many (&queue, records, 6) == 4);
+
+    for (i=0; i<8; i++)
+        records[i].iov_base = storage[i];
+    mu_assert("mpmc_queue_try_pop_many pops no more than asked",
+              mpmc_queue_try_pop_many (&queue, records, 3) == 3);
+    mu_assert("mpmc_queue_try_pop_many pops in order",
+              storage[0][0] == 'a' && storage[2][0] == 'c' && records[2].iov_len == 1);
+    mu_assert("mpmc_queue_try_pop_many pops what is left",
+              mpmc_queue_try_pop_many (&queue, records, 8) == 1 && storage[0][0] == 'd');
+    mu_assert("mpmc_queue_try_pop_many returns 0 on an empty queue",
+              mpmc_queue_try_pop_many (&queue, records, 8) == 0);
+
+    mpmc_queue_free (&queue);
+    return 0;
+}
+
+#define THREADS 4
+#define RECORDS_PER_PRODUCER 20000
+
+struct stress
+{
+    struct mpmc_queue queue;
+    unsigned long popped;
+    unsigned char *seen;
+};
+
+static struct stress stress;
+
+static void *
+stress_producer(void *arg)
+{
+    unsigned long record[2];
+
+    record[0] = (unsigned long)arg;
+    for (record[1] = 0; record[1] < RECORDS_PER_PRODUCER; ) {
+        if (mpmc_queue_try_push (&stress.queue, (char *)record, sizeof record) == 0)
+            record[1]++;
+        else
+            sched_yield ();
+    }
+    return NULL;
+}
+
+static void *
+stress_consumer(void *arg)
+{
+    unsigned long record[2];
+
+    while (__atomic_load_n (&stress.popped, __ATOMIC_RELAXED) < THREADS * RECORDS_PER_PRODUCER) {
+        if (mpmc_queue_try_pop (&stress.queue, (char *)record) == sizeof record) {
+            __atomic_add_fetch (&stress.seen[record[0] * RECORDS_PER_PRODUCER + record[1]], 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch (&stress.popped, 1, __ATOMIC_RELAXED);
+        } else {
+            sched_yield ();
+        }
+    }
+    return NULL;
+}
+
+static char *
+test_threads()
+{
+    pthread_t producers[THREADS], consumers[THREADS];
+    unsigned long i;
+    int exactly_once = 1;
+
+    mpmc_queue_create (&stress.queue, 6, 2 * sizeof (unsigned long));
+    stress.seen = calloc (THREADS * RECORDS_PER_PRODUCER, 1);
+    for (i=0; i<THREADS; i++) {
+        pthread_create (&producers[i], NULL, stress_producer, (void *)i);
+        pthread_create (&consumers[i], NULL, stress_consumer, NULL);
+    }
+    for (i=0; i<THREADS; i++) {
+        pthread_join (producers[i], NULL);
+        pthread_join (consumers[i], NULL);
+    }
+
+    for (i=0; i<THREADS * RECORDS_PER_PRODUCER; i++) {
+        if (stress.seen[i] != 1)
+            exactly_once = 0;
+    }
+    mu_assert("mpmc_queue delivers every record exactly once across threads",
+              exactly_once);
+
+    free (stress.seen);
+    mpmc_queue_free (&stress.queue);
+    return 0;
+}
+
+static char *all_tests()
+{
+    mu_run_test(test_push_pop);
+    mu_run_test(test_batches);
+    mu_run_test(test_threads);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+        char *result = all_tests();
+        if (result != 0)
+        {
+            printf("%s\n", result);
+        }
+        else
+        {
+            printf("ALL TESTS PASSED\n");
+        }
+        printf("Tests run: %d\n", tests_run);
+
+        return result != 0;
+}
@@ -0,0 +1,204 @@
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdexcept>
+#include <system_error>
+#include "minunit.h"
+#include "../src/ring_buffer.hpp"
+
+int tests_run = 0;
+
+struct sample
+{
+    unsigned long sequence;
+    double value;
+};
+
+static_assert (ringbuffer::RingBuffer<12>::capacity () == 4096, "capacity is 2**Order");
+static_assert (ringbuffer::RingBuffer<12>::fits<sample> (), "a sample fits a page");
+static_assert (!ringbuffer::RingBuffer<12>::fits<char[4096]> (), "the record header takes room");
+
+static char *
+test_push_pop()
+{
+    ringbuffer::RingBuffer<12> ring;
+    sample in = { 1, 0.5 }, out = { 0, 0 };
+    char data[16];
+    bool threw = false;
+
+    mu_assert("RingBuffer starts empty",
+              ring.empty () && !ring.try_pop (out));
+    mu_assert("RingBuffer::try_push appends a typed record",
+              ring.try_push (in) && ring.size () == RING_BUFFER_RECORD_HEADER_BYTES + sizeof in);
+    mu_assert("RingBuffer::try_pop returns the typed record",
+              ring.try_pop (out) && out.sequence == 1 && out.value == 0.5 && ring.empty ());
+
+    ring.try_push ("test", 4);
+    try {
+        ring.try_pop (out);
+    } catch (std::length_error &) {
+        threw = true;
+    }
+    mu_assert("RingBuffer::try_pop refuses a record of another size and leaves it",
+              threw && ring.try_pop (data, sizeof data) == 4 && memcmp (data, "test", 4) == 0);
+
+    while (ring.try_push (in))
+        in.sequence++;
+    mu_assert("RingBuffer::try_push fails on a full buffer",
+              ring.size () > ring.capacity () - RING_BUFFER_RECORD_HEADER_BYTES - sizeof in);
+    mu_assert("RingBuffer counts the pushes and the full buffer",
+              ring.c_buffer ()->producer_stats.writes == in.sequence + 1 && ring.c_buffer ()->producer_stats.full == 1);
+    return 0;
+}
+
+static char *
+test_interoperates()
+{
+    ringbuffer::RingBuffer<12> ring;
+    unsigned long count_bytes;
+    char data[16];
+
+    ring_buffer_push_record (ring.c_buffer (), "from c", 6);
+    mu_assert("RingBuffer::try_pop reads a record from ring_buffer_push_record",
+              ring.try_pop (data, sizeof data) == 6 && memcmp (data, "from c", 6) == 0);
+
+    ring.try_push ("from c++", 8);
+    mu_assert("ring_buffer_front_record reads a record from RingBuffer::try_push",
+              memcmp (ring_buffer_front_record (ring.c_buffer (), &count_bytes), "from c++", 8) == 0
+              && count_bytes == 8);
+    return 0;
+}
+
+static char *
+test_shared()
+{
+    const char *name = "/ring_buffer_test_hpp";
+    ringbuffer::RingBuffer<13> creator (ringbuffer::create_shared, name);
+    ringbuffer::RingBuffer<13> attached (ringbuffer::attach, name);
+    unsigned long value = 0;
+    bool threw = false;
+
+    try {
+        ringbuffer::RingBuffer<12> wrong (ringbuffer::attach, name);
+    } catch (std::system_error &error) {
+        threw = error.code ().value () == EINVAL;
+    }
+    ring_buffer_unlink (name);
+
+    mu_assert("RingBuffer refuses to attach a buffer of another order",
+              threw);
+    creator.try_push (42UL);
+    mu_assert("RingBuffer shares records through ring_buffer_create_shared",
+              attached.try_pop (value) && value == 42);
+    return 0;
+}
+
+static char *
+test_lossy()
+{
+    ringbuffer::RingBuffer<12, ringbuffer::Lossy> ring;
+    unsigned long i, first = 0, last = 0;
+
+    for (i=0; i<1000; i++)
+        mu_assert("RingBuffer<Lossy>::try_push never runs full",
+                  ring.try_push (i));
+    ring.try_pop (first);
+    while (ring.try_pop (last))
+        ;
+    mu_assert("RingBuffer<Lossy> keeps the newest records",
+              first > 0 && last == 999);
+    mu_assert("RingBuffer<Lossy> counts the dropped records",
+              ring_buffer_dropped_records (ring.c_buffer ()) == first);
+    return 0;
+}
+
+#define THREADS 4
+#define RECORDS_PER_PRODUCER 20000
+
+static ringbuffer::RingBuffer<12, ringbuffer::Mpmc> mpmc_ring;
+static unsigned long mpmc_popped;
+static unsigned char mpmc_seen[THREADS * RECORDS_PER_PRODUCER];
+
+static void *
+mpmc_producer(void *arg)
+{
+    unsigned long record = (unsigned long)arg * RECORDS_PER_PRODUCER;
+    unsigned long end = record + RECORDS_PER_PRODUCER;
+
+    while (record < end) {
+        if (mpmc_ring.try_push (record))
+            record++;
+        else
+            sched_yield ();
+    }
+    return NULL;
+}
+
+static void *
+mpmc_consumer(void *arg)
+{
+    unsigned long record;
+
+    while (__atomic_load_n (&mpmc_popped, __ATOMIC_RELAXED) < THREADS * RECORDS_PER_PRODUCER) {
+        if (mpmc_ring.try_pop (record)) {
+            __atomic_add_fetch (&mpmc_seen[record], 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch (&mpmc_popped, 1, __ATOMIC_RELAXED);
+        } else {
+            sched_yield ();
+        }
+    }
+    return NULL;
+}
+
+static char *
+test_mpmc_threads()
+{
+    pthread_t producers[THREADS], consumers[THREADS];
+    unsigned long i;
+    int exactly_once = 1;
+
+    for (i=0; i<THREADS; i++) {
+        pthread_create (&producers[i], NULL, mpmc_producer, (void *)i);
+        pthread_create (&consumers[i], NULL, mpmc_consumer, NULL);
+    }
+    for (i=0; i<THREADS; i++) {
+        pthread_join (producers[i], NULL);
+        pthread_join (consumers[i], NULL);
+    }
+
+    for (i=0; i<THREADS * RECORDS_PER_PRODUCER; i++) {
+        if (mpmc_seen[i] != 1)
+            exactly_once = 0;
+    }
+    mu_assert("RingBuffer<Mpmc> delivers every record exactly once across threads",
+              exactly_once && mpmc_ring.empty ());
+    return 0;
+}
+
+static char *all_tests()
+{
+    mu_run_test(test_push_pop);
+    mu_run_test(test_interoperates);
+    mu_run_test(test_shared);
+    mu_run_test(test_lossy);
+    mu_run_test(test_mpmc_threads);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+        char *result = all_tests();
+        if (result != 0)
+        {
+            printf("%s\n", result);
+        }
+        else
+        {
+            printf("ALL TESTS PASSED\n");
+        }
+        printf("Tests run: %d\n", tests_run);
+
+        return result != 0;
+}
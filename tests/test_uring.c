@@ -0,0 +1,169 @@
+#define _DEFAULT_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include "minunit.h"
+#include "../src/uring.h"
+
+int tests_run = 0;
+
+static struct ring_buffer *
+construct_buffer()
+{
+    struct ring_buffer *buffer;
+    if (posix_memalign((void **)&buffer, RING_BUFFER_CACHE_LINE_BYTES, sizeof *buffer))
+        return NULL;
+
+    return buffer;
+}
+
+/* Run the same checks on io_uring, where the kernel has it, and on the poll(2) fallback */
+static char *
+check_engine(int flags)
+{
+    struct ring_buffer_io io;
+    struct ring_buffer *buffer = construct_buffer();
+    struct ring_buffer_io_completion completions[4];
+    char data[4096], out[4096];
+    int fds[2], i;
+
+    for (i = 0; i < (int)sizeof data; i++)
+        data[i] = i % 251;
+    socketpair (AF_UNIX, SOCK_STREAM, 0, fds);
+    ring_buffer_create (buffer, 12);
+    mu_assert("ring_buffer_io_create sets up an engine",
+              ring_buffer_io_create (&io, 4, flags) == 0);
+
+    mu_assert("ring_buffer_io_poll returns nothing when nothing is in flight",
+              ring_buffer_io_poll (&io, completions, 4, -1) == 0);
+
+    // leave the write offset near the end, so the recv spans the wrap
+    ring_buffer_write (buffer, data, 4000UL);
+    ring_buffer_read (buffer, out, 4000UL);
+    mu_assert("ring_buffer_io_submit_recv queues a read into the buffer",
+              ring_buffer_io_submit_recv (&io, buffer, fds[0], 0, data) == 0
+              && ring_buffer_io_pending (&io) == 1);
+    mu_assert("ring_buffer_io_submit_recv refuses a second recv for a buffer",
+              ring_buffer_io_submit_recv (&io, buffer, fds[0], 0, NULL) == -1 && errno == EBUSY);
+    mu_assert("ring_buffer_trim refuses while a recv is in flight",
+              ring_buffer_trim (buffer) == -1 && errno == EBUSY);
+    mu_assert("ring_buffer_io_poll waits up to the timeout",
+              ring_buffer_io_poll (&io, completions, 4, 10000000L) == 0);
+
+    write (fds[1], data, 1000);
+    mu_assert("ring_buffer_io_poll completes the recv",
+              ring_buffer_io_poll (&io, completions, 4, -1) == 1
+              && completions[0].buffer == buffer && completions[0].user_data == data
+              && completions[0].fd == fds[0] && completions[0].op == RING_BUFFER_IO_RECV
+              && completions[0].result == 1000);
+    mu_assert("a completed recv advances the write offset across the wrap",
+              ring_buffer_count_bytes (buffer) == 1000UL && buffer->io_in_flight == 0
+              && memcmp (ring_buffer_read_address (buffer), data, 1000UL) == 0);
+
+    mu_assert("ring_buffer_io_submit_send queues a write from the buffer",
+              ring_buffer_io_submit_send (&io, buffer, fds[0], 600, NULL) == 0);
+    mu_assert("ring_buffer_io_poll completes the send",
+              ring_buffer_io_poll (&io, completions, 4, -1) == 1
+              && completions[0].op == RING_BUFFER_IO_SEND && completions[0].result == 600);
+    mu_assert("a completed send advances the read offset",
+              ring_buffer_count_bytes (buffer) == 400UL
+              && read (fds[1], out, sizeof out) == 600 && memcmp (out, data, 600) == 0);
+
+    ring_buffer_write (buffer, data, 3696UL);
+    mu_assert("ring_buffer_io_submit_recv refuses a full buffer",
+              ring_buffer_io_submit_recv (&io, buffer, fds[0], 0, NULL) == -1 && errno == EAGAIN);
+    ring_buffer_clear (buffer);
+    mu_assert("ring_buffer_io_submit_send refuses an empty buffer",
+              ring_buffer_io_submit_send (&io, buffer, fds[0], 0, NULL) == -1 && errno == EAGAIN);
+
+    ring_buffer_io_submit_recv (&io, buffer, fds[0], 0, NULL);
+    close (fds[1]);
+    mu_assert("a recv completes with 0 at end of file",
+              ring_buffer_io_poll (&io, completions, 4, -1) == 1 && completions[0].result == 0
+              && ring_buffer_count_bytes (buffer) == 0);
+
+    close (fds[0]);
+    ring_buffer_io_free (&io);
+    ring_buffer_free (buffer);
+    return 0;
+}
+
+static char *
+test_uring()
+{
+    struct ring_buffer_io io;
+
+    ring_buffer_io_create (&io, 4, 0);
+    if (!ring_buffer_io_uses_uring (&io))
+        printf ("io_uring is not available, only the fallback is tested\n");
+    ring_buffer_io_free (&io);
+    return check_engine (0);
+}
+
+static char *
+test_fallback()
+{
+    return check_engine (RING_BUFFER_IO_FALLBACK);
+}
+
+static char *
+test_many_buffers()
+{
+    struct ring_buffer_io io;
+    struct ring_buffer buffers[64], extra;
+    struct ring_buffer_io_completion completions[64];
+    int fds[64][2], i, completed = 0, status;
+
+    ring_buffer_io_create (&io, 64, 0);
+    for (i = 0; i < 64; i++) {
+        socketpair (AF_UNIX, SOCK_STREAM, 0, fds[i]);
+        ring_buffer_create (&buffers[i], 12);
+        ring_buffer_io_submit_recv (&io, &buffers[i], fds[i][0], 0, NULL);
+        write (fds[i][1], "ping", 4);
+    }
+    ring_buffer_create (&extra, 12);
+    mu_assert("ring_buffer_io_submit_recv refuses more than max_ops in flight",
+              ring_buffer_io_submit_recv (&io, &extra, fds[0][0], 0, NULL) == -1 && errno == ENOSPC);
+    ring_buffer_free (&extra);
+    while (completed < 64 && (status = ring_buffer_io_poll (&io, completions, 64, -1)) > 0)
+        completed += status;
+    mu_assert("ring_buffer_io_poll completes a recv for every buffer",
+              completed == 64 && ring_buffer_io_pending (&io) == 0);
+    for (i = 0; i < 64; i++) {
+        mu_assert("every buffer received its bytes",
+                  ring_buffer_count_bytes (&buffers[i]) == 4UL);
+        ring_buffer_free (&buffers[i]);
+        close (fds[i][0]);
+        close (fds[i][1]);
+    }
+    ring_buffer_io_free (&io);
+    return 0;
+}
+
+static char *all_tests()
+{
+    mu_run_test(test_uring);
+    mu_run_test(test_fallback);
+    mu_run_test(test_many_buffers);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+        char *result = all_tests();
+        if (result != 0)
+        {
+            printf("%s\n", result);
+        }
+        else
+        {
+            printf("ALL TESTS PASSED\n");
+        }
+        printf("Tests run: %d\n", tests_run);
+
+        return result != 0;
+}
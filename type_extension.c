@@ -1,6 +1,11 @@
+#define PY_SSIZE_T_CLEAN
 #include <Python.h>
 #include <structmember.h>
+#include <pythread.h>
+#include <time.h>
 #include "src/buffer.h"
+#include "src/mpmc.h"
+#include "src/uring.h"
 
 static PyObject *InsufficientDataError;
 static PyObject *FullError;
@@ -11,13 +16,67 @@ typedef struct {
     struct ring_buffer *buffer;
     int order;
     int closed;
+    Py_ssize_t reserved_bytes; // writable span handed out by reserve(), published by commit()
+    Py_ssize_t acquired_bytes; // readable span handed out by acquire(), given back by release()
+    Py_ssize_t exports; // number of live memoryviews over the mapping
+    /* span exposed by the next Buffer_getbuffer call, see Buffer_memoryview */
+    void *view_address;
+    Py_ssize_t view_bytes;
+    int view_readonly;
+    int view_records; // export the span as an array of records, see Buffer_array_view
+    /* The ring is single-producer/single-consumer, so writers serialize on write_lock and
+     * readers on read_lock, and one writer and one reader thread run concurrently.
+     */
+    PyThread_type_lock write_lock;
+    PyThread_type_lock read_lock;
+    Py_ssize_t gil_release_threshold; // copies of at least this many bytes run without the GIL
+    /* record-typed mode: a struct format string and its size, see read_array() */
+    PyObject *record_format;
+    Py_ssize_t record_bytes;
+    /* auto-resize: grow up to max_order instead of running full, and shrink back towards
+     * min_order after a quarter full or less for shrink_after seconds, see resize()
+     */
+    int min_order;
+    int max_order;
+    double shrink_after;
+    unsigned long low_since_ns; // when the buffer was last seen going a quarter full or less, 0 if not
+    /* idle trimming: give the free pages back once at most trim_below bytes were readable
+     * for trim_after seconds, see trim()
+     */
+    double trim_after; // negative never trims
+    Py_ssize_t trim_below;
+    unsigned long trim_since_ns; // when the readable bytes were last seen dropping to trim_below, 0 if not
+    int trimmed; // nothing more to give back until the readable bytes rise over trim_below
+    int shared; // a shared memory object, which other processes may write to
+    PyObject *pool; // the BufferPool the ring goes back to, NULL when the buffer mapped its own
 } Buffer;
 
+/* Copies this large take long enough that letting other threads run pays for the GIL
+ * round trip.
+ */
+#define BUFFER_GIL_RELEASE_THRESHOLD (64 * 1024)
+
+/* Seconds of low occupancy before an auto-grown buffer halves */
+#define BUFFER_SHRINK_AFTER 1.0
+
+static void BufferPool_recycle(PyObject *pool, struct ring_buffer *ring);
+
 static void
 Buffer_dealloc(Buffer* self)
 {
-    ring_buffer_free (self->buffer);
-    self->ob_type->tp_free ((PyObject*) self);
+    if (self->pool && self->buffer) {
+        BufferPool_recycle(self->pool, self->buffer);
+    } else {
+        ring_buffer_free (self->buffer);
+        free (self->buffer);
+    }
+    Py_XDECREF(self->pool);
+    if (self->write_lock)
+        PyThread_free_lock (self->write_lock);
+    if (self->read_lock)
+        PyThread_free_lock (self->read_lock);
+    Py_XDECREF(self->record_format);
+    Py_TYPE(self)->tp_free ((PyObject*) self);
 }
 
 static PyObject *
@@ -26,183 +85,3511 @@ Buffer_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
     Buffer* self;
     self = (Buffer*)type->tp_alloc(type, 0);
 
-    return (PyObject *)self;
+    return (PyObject *)self;
+}
+
+static int Buffer_alloc_locks(Buffer *self);
+
+/* Allocate the struct ring_buffer and the side locks for @self. */
+static int
+Buffer_alloc_ring(Buffer *self)
+{
+    // struct ring_buffer is cache-line aligned, plain malloc only guarantees 16 bytes
+    if (posix_memalign((void **)&self->buffer, RING_BUFFER_CACHE_LINE_BYTES, sizeof *self->buffer)) {
+        self->buffer = NULL;
+        PyErr_NoMemory();
+        return -1;
+    }
+    memset (self->buffer, 0, sizeof *self->buffer);
+
+    return Buffer_alloc_locks(self);
+}
+
+/* Allocate the side locks for @self and set the defaults that do not come from the ring. */
+static int
+Buffer_alloc_locks(Buffer *self)
+{
+    self->write_lock = PyThread_allocate_lock();
+    self->read_lock = PyThread_allocate_lock();
+    if (self->write_lock == NULL || self->read_lock == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    self->gil_release_threshold = BUFFER_GIL_RELEASE_THRESHOLD;
+    self->shrink_after = BUFFER_SHRINK_AFTER;
+    self->trim_after = -1.0;
+    return 0;
+}
+
+/* Take a side lock, letting other threads run while it is contended. */
+static void
+Buffer_lock(PyThread_type_lock lock)
+{
+    if (!PyThread_acquire_lock(lock, NOWAIT_LOCK)) {
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+    }
+}
+
+#define Buffer_unlock(lock) PyThread_release_lock(lock)
+
+/* Refuse to write to (@op RING_BUFFER_IO_RECV) or read from (RING_BUFFER_IO_SEND) a buffer
+ * whose submitted recv or send is still in flight: the kernel fills or drains that span
+ * and the completion advances the offsets over it. The caller holds the matching side
+ * lock, which submit_recv() and submit_send() take too, so no new operation starts
+ * meanwhile. Return 0, or -1 with a BufferError set.
+ */
+static int
+Buffer_check_io(Buffer *self, int op)
+{
+    if (!(ring_buffer_io_in_flight (self->buffer) & op))
+        return 0;
+    PyErr_SetString (PyExc_BufferError, op == RING_BUFFER_IO_RECV
+                     ? "Cannot write while a submitted recv is in flight"
+                     : "Cannot read while a submitted send is in flight");
+    return -1;
+}
+
+/* Refuse to consume from the plain read side while broadcast readers are attached, which
+ * would free bytes an open cursor has not seen, or while a submitted send is in flight.
+ * The caller holds the read lock. Return 0, or -1 with a BufferError set.
+ */
+static int
+Buffer_check_read(Buffer *self)
+{
+    if (ring_buffer_cursors_open (self->buffer) > 0) {
+        PyErr_SetString (PyExc_BufferError, "Cannot read from the buffer while readers are attached");
+        return -1;
+    }
+    return Buffer_check_io(self, RING_BUFFER_IO_SEND);
+}
+
+/* memcpy, without the GIL once @count_bytes reaches the threshold. The caller holds the
+ * side lock and keeps both ends alive, so nothing moves while other threads run.
+ */
+static void
+Buffer_copy(Buffer *self, void *destination, const void *source, Py_ssize_t count_bytes)
+{
+    if (count_bytes < self->gil_release_threshold) {
+        memcpy (destination, source, count_bytes);
+        return;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    memcpy (destination, source, count_bytes);
+    Py_END_ALLOW_THREADS
+}
+
+/* Argument parsing for the METH_FASTCALL | METH_KEYWORDS methods on the hot path, which
+ * take a handful of arguments and would otherwise spend more time building and parsing an
+ * args tuple and kwargs dict than copying a small message. Fill @values, one per name in
+ * the NULL-terminated @kwlist and NULL where not passed, from @args and @kwnames. The
+ * first @required are required. Return 0, or -1 with a TypeError set.
+ */
+static int
+parse_fastcall(const char *function, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames,
+               const char *const *kwlist, Py_ssize_t required, PyObject **values)
+{
+    Py_ssize_t count, i, k, nkwargs = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+
+    for (count = 0; kwlist[count]; count++)
+        values[count] = NULL;
+    if (nargs > count) {
+        PyErr_Format (PyExc_TypeError, "%s() takes at most %zd arguments (%zd given)", function, count, nargs);
+        return -1;
+    }
+    for (i = 0; i < nargs; i++)
+        values[i] = args[i];
+
+    for (k = 0; k < nkwargs; k++) {
+        PyObject *name = PyTuple_GET_ITEM(kwnames, k);
+
+        for (i = 0; i < count; i++) {
+            if (PyUnicode_CompareWithASCIIString(name, kwlist[i]) == 0)
+                break;
+        }
+        if (i == count) {
+            PyErr_Format (PyExc_TypeError, "%s() got an unexpected keyword argument '%U'", function, name);
+            return -1;
+        }
+        if (values[i] != NULL) {
+            PyErr_Format (PyExc_TypeError, "%s() got multiple values for argument '%s'", function, kwlist[i]);
+            return -1;
+        }
+        values[i] = args[nargs + k];
+    }
+
+    for (i = 0; i < required; i++) {
+        if (values[i] == NULL) {
+            PyErr_Format (PyExc_TypeError, "%s() missing required argument '%s'", function, kwlist[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* A non-negative byte count from @value, or -1 with an exception set. */
+static Py_ssize_t
+parse_length(PyObject *value, const char *name)
+{
+    Py_ssize_t length = PyNumber_AsSsize_t(value, PyExc_OverflowError);
+
+    if (length == -1 && PyErr_Occurred())
+        return -1;
+    if (length < 0) {
+        PyErr_Format (PyExc_ValueError, "%s must not be negative", name);
+        return -1;
+    }
+    return length;
+}
+
+/* Setter for record_format: a struct module format string such as '<qd16s' whose size
+ * is the record size, or None for a plain byte buffer.
+ */
+static int
+Buffer_set_record_format(Buffer *self, PyObject *value, void *closure)
+{
+    PyObject *struct_module, *size, *old_format;
+    Py_ssize_t record_bytes = 0;
+
+    if (value == NULL)
+        value = Py_None;
+    if (self->exports > 0) {
+        PyErr_SetString (PyExc_ValueError, "Cannot change record_format while views are exported");
+        return -1;
+    }
+    if (value != Py_None) {
+        if (!PyUnicode_Check(value)) {
+            PyErr_SetString (PyExc_TypeError, "record_format must be a struct format string or None");
+            return -1;
+        }
+        struct_module = PyImport_ImportModule("struct");
+        if (struct_module == NULL)
+            return -1;
+        size = PyObject_CallMethod(struct_module, "calcsize", "O", value);
+        Py_DECREF(struct_module);
+        if (size == NULL)
+            return -1;
+        record_bytes = PyLong_AsSsize_t (size);
+        Py_DECREF(size);
+        if (record_bytes == -1 && PyErr_Occurred())
+            return -1;
+        if (record_bytes < 1 || (unsigned long)record_bytes > self->buffer->count_bytes) {
+            PyErr_SetString (PyExc_ValueError, "record_format size must be between 1 and the buffer size");
+            return -1;
+        }
+    }
+
+    old_format = self->record_format;
+    self->record_format = value == Py_None ? NULL : value;
+    Py_XINCREF(self->record_format);
+    Py_XDECREF(old_format);
+    self->record_bytes = record_bytes;
+    return 0;
+}
+
+/* auto-grow stops at max_order, so it has to be an order resize() accepts */
+static int
+Buffer_check_max_order(Buffer *self, int max_order)
+{
+    if (max_order != 0 && (max_order < self->order || max_order > 40)) {
+        PyErr_SetString (PyExc_ValueError, "max_order must be 0, or between order and 40");
+        return -1;
+    }
+    return 0;
+}
+
+static int
+Buffer_init(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"order", "huge_pages", "populate", "lock", "numa_node", "overwrite",
+                             "record_format", "max_order", NULL};
+    struct ring_buffer_options options = RING_BUFFER_DEFAULT_OPTIONS;
+    int overwrite = 0;
+    PyObject *record_format = Py_None;
+
+    if ( !PyArg_ParseTupleAndKeywords(args, kwargs, "|ikiiiiOi", kwlist, &self->order,
+                                      &options.huge_page_bytes, &options.populate,
+                                      &options.lock, &options.numa_node, &overwrite,
+                                      &record_format, &self->max_order) ) {
+        return -1;
+    }
+
+    if (self->order == 0) {
+        self->order = 12; // the ring buffer size defaults to 4KB
+    }
+
+    if (self->order < 12 || self->order > 40) {
+        PyErr_SetString (PyExc_ValueError, "order must be between 12 and 40");
+        return -1;
+    }
+    if (Buffer_check_max_order(self, self->max_order) < 0)
+        return -1;
+
+    if (Buffer_alloc_ring(self) < 0)
+        return -1;
+    if (ring_buffer_create_with_options (self->buffer, self->order, &options)) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    ring_buffer_set_overwrite (self->buffer, overwrite);
+    self->min_order = self->order;
+
+    return Buffer_set_record_format(self, record_format, NULL);
+}
+
+static PyObject *
+Buffer_create_shared(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    const char *name;
+    int order = 12, overwrite = 0;
+    PyObject *record_format = Py_None;
+    Buffer *self;
+    static char *kwlist[] = {"name", "order", "overwrite", "record_format", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|iiO", kwlist, &name, &order, &overwrite,
+                                     &record_format))
+        return NULL;
+
+    if (order < 12 || order > 40) {
+        PyErr_SetString (PyExc_ValueError, "order must be between 12 and 40");
+        return NULL;
+    }
+
+    self = (Buffer *)type->tp_alloc(type, 0);
+    if (self == NULL || Buffer_alloc_ring(self) < 0) {
+        Py_XDECREF(self);
+        return NULL;
+    }
+
+    if (ring_buffer_create_shared (self->buffer, name, order)) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *)name);
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->order = self->min_order = order;
+    self->shared = 1;
+    ring_buffer_set_overwrite (self->buffer, overwrite);
+    if (Buffer_set_record_format(self, record_format, NULL) < 0) {
+        Py_DECREF(self);
+        return NULL;
+    }
+
+    return (PyObject *)self;
+}
+
+static PyObject *
+Buffer_open_shared(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    const char *name;
+    Buffer *self;
+    static char *kwlist[] = {"name", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &name))
+        return NULL;
+
+    self = (Buffer *)type->tp_alloc(type, 0);
+    if (self == NULL || Buffer_alloc_ring(self) < 0) {
+        Py_XDECREF(self);
+        return NULL;
+    }
+
+    if (ring_buffer_attach (self->buffer, name)) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *)name);
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->order = self->min_order = __builtin_ctzl (self->buffer->count_bytes);
+    self->shared = 1;
+
+    return (PyObject *)self;
+}
+
+static PyObject *
+Buffer_open_file(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    const char *path;
+    int order = 0;
+    PyObject *sync = Py_None;
+    double interval = 0;
+    Buffer *self;
+    static char *kwlist[] = {"path", "order", "sync", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|iO", kwlist, &path, &order, &sync))
+        return NULL;
+
+    if (order != 0 && (order < 12 || order > 40)) {
+        PyErr_SetString (PyExc_ValueError, "order must be between 12 and 40");
+        return NULL;
+    }
+    // None: on sync() and close only, True: every advance, seconds: that often at most
+    if (sync != Py_None && !PyBool_Check(sync)) {
+        interval = PyFloat_AsDouble(sync);
+        if (interval == -1.0 && PyErr_Occurred())
+            return NULL;
+        if (interval < 0) {
+            PyErr_SetString (PyExc_ValueError, "sync interval must be non-negative");
+            return NULL;
+        }
+    }
+
+    self = (Buffer *)type->tp_alloc(type, 0);
+    if (self == NULL || Buffer_alloc_ring(self) < 0) {
+        Py_XDECREF(self);
+        return NULL;
+    }
+
+    if (ring_buffer_open_file (self->buffer, path, order)) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *)path);
+        Py_DECREF(self);
+        return NULL;
+    }
+    self->order = self->min_order = __builtin_ctzl (self->buffer->count_bytes);
+    if (sync == Py_True)
+        ring_buffer_set_sync_policy (self->buffer, RING_BUFFER_SYNC_ALWAYS, 0);
+    else if (sync != Py_None && sync != Py_False)
+        ring_buffer_set_sync_policy (self->buffer, RING_BUFFER_SYNC_INTERVAL, (unsigned long)(interval * 1e9));
+
+    return (PyObject *)self;
+}
+
+static PyObject *
+Buffer_sync(Buffer *self)
+{
+    int status;
+
+    Py_BEGIN_ALLOW_THREADS
+    status = ring_buffer_sync (self->buffer);
+    Py_END_ALLOW_THREADS
+
+    if (status)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    Py_RETURN_NONE;
+}
+
+/* Block without the GIL until @min_bytes are readable (@readable) or writable.
+ * @cursor: the broadcast cursor to read from, or -1 for the plain read side
+ * @timeout: NULL to not wait at all, Py_None to wait forever, or seconds
+ * Return 1 when ready, 0 when not ready in time, -1 with an exception set.
+ */
+static int
+Buffer_wait_cursor(Buffer *self, int cursor, int readable, unsigned long min_bytes, PyObject *timeout)
+{
+    double seconds = -1.0;
+    struct timespec now, deadline;
+    long timeout_ns = -1;
+    int status, saved_errno;
+
+    if (timeout == NULL || min_bytes > self->buffer->count_bytes)
+        return 0;
+
+    if (timeout != Py_None) {
+        seconds = PyFloat_AsDouble(timeout);
+        if (seconds == -1.0 && PyErr_Occurred())
+            return -1;
+        if (seconds < 0) {
+            PyErr_SetString (PyExc_ValueError, "timeout must be non-negative");
+            return -1;
+        }
+        clock_gettime (CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += (time_t)seconds;
+        deadline.tv_nsec += (long)((seconds - (time_t)seconds) * 1e9);
+    }
+
+    for (;;) {
+        if (seconds >= 0) {
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            timeout_ns = (deadline.tv_sec - now.tv_sec) * 1000000000L + (deadline.tv_nsec - now.tv_nsec);
+            if (timeout_ns < 0)
+                timeout_ns = 0;
+        }
+
+        Py_BEGIN_ALLOW_THREADS
+        if (readable && cursor >= 0)
+            status = ring_buffer_cursor_wait_readable (self->buffer, cursor, min_bytes, timeout_ns);
+        else if (readable)
+            status = ring_buffer_wait_readable (self->buffer, min_bytes, timeout_ns);
+        else
+            status = ring_buffer_wait_writable (self->buffer, min_bytes, timeout_ns);
+        saved_errno = errno;
+        Py_END_ALLOW_THREADS
+
+        if (status == 0)
+            return 1;
+        if (saved_errno == ETIMEDOUT)
+            return 0;
+        if (saved_errno != EINTR) {
+            errno = saved_errno;
+            PyErr_SetFromErrno(PyExc_OSError);
+            return -1;
+        }
+        if (PyErr_CheckSignals())
+            return -1; // EINTR and a signal handler raised
+    }
+}
+
+#define Buffer_wait(self, readable, min_bytes, timeout) Buffer_wait_cursor(self, -1, readable, min_bytes, timeout)
+
+/* Resize to 2^@order bytes unless something points into the mapping: a memoryview, a
+ * reservation or a snapshot() in progress. The caller holds both side locks. Return 0, or
+ * -1 with an exception set.
+ */
+static int
+Buffer_resize_locked(Buffer *self, int order)
+{
+    if (self->exports > 0 || self->reserved_bytes > 0) {
+        PyErr_SetString (PyExc_BufferError, "Cannot resize while views are exported");
+        return -1;
+    }
+    if ((unsigned long)self->record_bytes > (1UL << order)) {
+        PyErr_SetString (PyExc_ValueError, "order is too small for the record_format");
+        return -1;
+    }
+    if (ring_buffer_resize (self->buffer, order)) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    self->order = order;
+    self->low_since_ns = 0;
+    return 0;
+}
+
+/* With max_order above order, grow so that @count_bytes more fit instead of running full.
+ * The caller holds the write lock; a reader in the middle of a read keeps the buffer as
+ * it is, rather than having the writer wait for it.
+ */
+static void
+Buffer_auto_grow(Buffer *self, unsigned long count_bytes)
+{
+    unsigned long needed_bytes;
+    int order = self->order;
+
+    if (ring_buffer_producer_free_bytes (self->buffer, count_bytes) >= count_bytes)
+        return;
+    needed_bytes = ring_buffer_count_bytes (self->buffer) + count_bytes;
+    while (order < self->max_order && (1UL << order) < needed_bytes)
+        order++;
+    if ((1UL << order) < needed_bytes || !PyThread_acquire_lock(self->read_lock, NOWAIT_LOCK))
+        return;
+    if (Buffer_resize_locked(self, order) < 0)
+        PyErr_Clear(); // the write then waits or fails as if the buffer could not grow
+    Buffer_unlock(self->read_lock);
+}
+
+static unsigned long
+Buffer_now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/* After an auto-grow, halve the buffer once it has been a quarter full or less for
+ * shrink_after seconds, down to min_order. The caller holds one side lock and passes the
+ * other, which is only taken if free.
+ */
+static void
+Buffer_auto_shrink(Buffer *self, PyThread_type_lock other_lock)
+{
+    unsigned long now_ns;
+
+    if (self->order <= self->min_order)
+        return;
+    if (ring_buffer_count_bytes (self->buffer) > self->buffer->count_bytes / 4) {
+        self->low_since_ns = 0;
+        return;
+    }
+
+    now_ns = Buffer_now_ns();
+    if (self->low_since_ns == 0) {
+        self->low_since_ns = now_ns;
+        return;
+    }
+    if (now_ns - self->low_since_ns < self->shrink_after * 1e9
+        || !PyThread_acquire_lock(other_lock, NOWAIT_LOCK))
+        return;
+    if (Buffer_resize_locked(self, self->order - 1) < 0)
+        PyErr_Clear();
+    Buffer_unlock(other_lock);
+}
+
+/* Give the free pages back. The caller holds the write lock, as ring_buffer_trim is a
+ * write side call.
+ */
+static int
+Buffer_trim_locked(Buffer *self)
+{
+    if (self->reserved_bytes > 0) {
+        PyErr_SetString (PyExc_BufferError, "Cannot trim before the reserved bytes are committed");
+        return -1;
+    }
+    if (ring_buffer_trim (self->buffer)) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    self->trimmed = 1;
+    return 0;
+}
+
+/* Trim once at most trim_below bytes have been readable for trim_after seconds. A writer
+ * passes NULL for @write_lock, which it holds; a reader passes the write lock, which is
+ * only taken if free, and leaves shared buffers to the writing process.
+ */
+static void
+Buffer_auto_trim(Buffer *self, PyThread_type_lock write_lock)
+{
+    unsigned long now_ns;
+
+    if (self->trim_after < 0)
+        return;
+    if (ring_buffer_count_bytes (self->buffer) > (unsigned long)self->trim_below) {
+        self->trim_since_ns = 0;
+        self->trimmed = 0;
+        return;
+    }
+    if (self->trimmed || (write_lock && self->shared))
+        return;
+
+    now_ns = Buffer_now_ns();
+    if (self->trim_since_ns == 0) {
+        self->trim_since_ns = now_ns;
+        return;
+    }
+    if (now_ns - self->trim_since_ns < self->trim_after * 1e9
+        || (write_lock && !PyThread_acquire_lock(write_lock, NOWAIT_LOCK)))
+        return;
+    if (Buffer_trim_locked(self) < 0)
+        PyErr_Clear();
+    if (write_lock)
+        Buffer_unlock(write_lock);
+}
+
+/* Give memory back after a write or a read: shrink a grown buffer, trim an idle one. The
+ * caller holds one side lock and passes the other.
+ */
+static void
+Buffer_auto_reclaim(Buffer *self, PyThread_type_lock other_lock)
+{
+    PyObject *type, *value, *traceback;
+
+    // a failed shrink or trim is dropped, but the caller's own exception must survive it
+    PyErr_Fetch(&type, &value, &traceback);
+    Buffer_auto_shrink(self, other_lock);
+    Buffer_auto_trim(self, other_lock == self->write_lock ? other_lock : NULL);
+    PyErr_Restore(type, value, traceback);
+}
+
+/* Make room for @count_bytes: grow an auto-resizing buffer, or in overwrite mode discard
+ * the oldest bytes or records. The caller holds the write lock.
+ */
+static void
+Buffer_make_room(Buffer *self, unsigned long count_bytes, int whole_records)
+{
+    unsigned long capacity_bytes, used_bytes, drop_bytes;
+
+    if (!ring_buffer_overwrite (self->buffer)) {
+        if (self->max_order > self->order)
+            Buffer_auto_grow(self, count_bytes);
+        return;
+    }
+    capacity_bytes = self->buffer->count_bytes;
+    if (count_bytes > capacity_bytes)
+        return;
+
+    // with a record_format, drop whole fixed-size records so reads stay aligned
+    if (!whole_records && self->record_bytes > 1) {
+        used_bytes = ring_buffer_count_bytes (self->buffer);
+        if (used_bytes + count_bytes <= capacity_bytes)
+            return;
+        drop_bytes = used_bytes + count_bytes - capacity_bytes;
+        drop_bytes = (drop_bytes + self->record_bytes - 1) / self->record_bytes * self->record_bytes;
+        count_bytes = capacity_bytes - used_bytes + drop_bytes;
+    }
+    ring_buffer_make_room (self->buffer, count_bytes, whole_records);
+}
+
+/* Write all of @data or, after waiting per @timeout, raise FullError. */
+static PyObject *
+Buffer_write_bytes(Buffer *self, const char *data, Py_ssize_t count_bytes, PyObject *timeout)
+{
+    if (self->closed) {
+        PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+        return NULL;
+    }
+
+    Buffer_lock(self->write_lock);
+    if (Buffer_check_io(self, RING_BUFFER_IO_RECV) < 0) {
+        Buffer_unlock(self->write_lock);
+        return NULL;
+    }
+    Buffer_make_room(self, count_bytes, 0);
+    if (ring_buffer_producer_free_bytes (self->buffer, count_bytes) < (unsigned long)count_bytes
+        && Buffer_wait(self, 0, count_bytes, timeout) < 0) {
+        Buffer_unlock(self->write_lock);
+        return NULL;
+    }
+    if (ring_buffer_producer_free_bytes (self->buffer, count_bytes) < (unsigned long)count_bytes) {
+        self->buffer->producer_stats.full++;
+        Buffer_unlock(self->write_lock);
+        PyErr_SetString(FullError, "Not enough free bytes to write");
+        return NULL;
+    }
+
+    Buffer_copy(self, ring_buffer_write_address (self->buffer), data, count_bytes);
+    ring_buffer_write_advance (self->buffer, count_bytes);
+    Buffer_auto_reclaim(self, self->read_lock);
+    Buffer_unlock(self->write_lock);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Buffer_write(Buffer *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"data", "timeout", NULL};
+    PyObject *values[2], *result;
+    Py_buffer data;
+
+    if (parse_fastcall("write", args, nargs, kwnames, kwlist, 1, values) < 0
+        || PyObject_GetBuffer(values[0], &data, PyBUF_SIMPLE) < 0)
+        return NULL;
+
+    result = Buffer_write_bytes(self, data.buf, data.len, values[1]);
+    PyBuffer_Release(&data);
+    return result;
+}
+
+static PyObject *
+Buffer_write_array(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_buffer view;
+    PyObject *timeout = NULL, *result;
+    static char *kwlist[] = {"records", "timeout", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|O", kwlist, &view, &timeout))
+        return NULL;
+
+    if (self->record_format == NULL) {
+        PyBuffer_Release(&view);
+        PyErr_SetString (PyExc_ValueError, "write_array() needs a record_format");
+        return NULL;
+    }
+    if (view.len % self->record_bytes != 0) {
+        PyBuffer_Release(&view);
+        PyErr_SetString (PyExc_ValueError, "records must be a whole number of record_format records");
+        return NULL;
+    }
+
+    result = Buffer_write_bytes(self, view.buf, view.len, timeout);
+    PyBuffer_Release(&view);
+    return result;
+}
+
+static PyObject *
+Buffer_write_many(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *iterable, *sequence;
+    PyObject *timeout = NULL;
+    PyObject *result = NULL;
+    static char *kwlist[] = {"pieces", "timeout", NULL};
+    Py_buffer *views;
+    struct iovec *iov;
+    Py_ssize_t i, count = 0;
+    unsigned long count_bytes = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O", kwlist, &iterable, &timeout))
+        return NULL;
+
+    if (self->closed) {
+        PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+        return NULL;
+    }
+
+    sequence = PySequence_Fast(iterable, "write_many() expects an iterable of strings");
+    if (sequence == NULL)
+        return NULL;
+
+    views = PyMem_New(Py_buffer, PySequence_Fast_GET_SIZE(sequence));
+    iov = PyMem_New(struct iovec, PySequence_Fast_GET_SIZE(sequence));
+    if (views == NULL || iov == NULL) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    for (count = 0; count < PySequence_Fast_GET_SIZE(sequence); count++) {
+        if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(sequence, count), &views[count], PyBUF_SIMPLE) < 0)
+            goto done;
+        iov[count].iov_base = views[count].buf;
+        iov[count].iov_len = views[count].len;
+        count_bytes += views[count].len;
+    }
+
+    Buffer_lock(self->write_lock);
+    if (Buffer_check_io(self, RING_BUFFER_IO_RECV) < 0) {
+        Buffer_unlock(self->write_lock);
+        goto done;
+    }
+    Buffer_make_room(self, count_bytes, 0);
+    if (ring_buffer_producer_free_bytes (self->buffer, count_bytes) < count_bytes
+        && Buffer_wait(self, 0, count_bytes, timeout) < 0) {
+        Buffer_unlock(self->write_lock);
+        goto done;
+    }
+    if (ring_buffer_producer_free_bytes (self->buffer, count_bytes) < count_bytes) {
+        self->buffer->producer_stats.full++;
+        Buffer_unlock(self->write_lock);
+        PyErr_SetString(FullError, "Not enough free bytes to write");
+        goto done;
+    }
+
+    // the views pin every piece, so the gather can run without the GIL
+    if ((Py_ssize_t)count_bytes >= self->gil_release_threshold) {
+        Py_BEGIN_ALLOW_THREADS
+        ring_buffer_writev (self->buffer, iov, count);
+        Py_END_ALLOW_THREADS
+    } else {
+        ring_buffer_writev (self->buffer, iov, count);
+    }
+    Buffer_auto_reclaim(self, self->read_lock);
+    Buffer_unlock(self->write_lock);
+
+    Py_INCREF(Py_None);
+    result = Py_None;
+
+done:
+    for (i = 0; i < count; i++)
+        PyBuffer_Release(&views[i]);
+    PyMem_Free(views);
+    PyMem_Free(iov);
+    Py_DECREF(sequence);
+    return result;
+}
+
+static PyObject *
+Buffer_read_into(Buffer *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"buffer", "nbytes", NULL};
+    PyObject *values[2];
+    Py_buffer view;
+    Py_ssize_t count_bytes = 0;
+    struct iovec iov;
+    long read_bytes;
+
+    if (parse_fastcall("read_into", args, nargs, kwnames, kwlist, 1, values) < 0)
+        return NULL;
+    if (values[1] != NULL) {
+        count_bytes = PyNumber_AsSsize_t(values[1], PyExc_OverflowError);
+        if (count_bytes == -1 && PyErr_Occurred())
+            return NULL;
+    }
+    if (PyObject_GetBuffer(values[0], &view, PyBUF_WRITABLE) < 0)
+        return NULL;
+
+    if (count_bytes <= 0 || count_bytes > view.len)
+        count_bytes = view.len;
+
+    iov.iov_base = view.buf;
+    iov.iov_len = count_bytes;
+    Buffer_lock(self->read_lock);
+    if (Buffer_check_read(self) < 0) {
+        Buffer_unlock(self->read_lock);
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+    if (count_bytes >= self->gil_release_threshold) {
+        Py_BEGIN_ALLOW_THREADS
+        read_bytes = ring_buffer_readv (self->buffer, &iov, 1);
+        Py_END_ALLOW_THREADS
+    } else {
+        read_bytes = ring_buffer_readv (self->buffer, &iov, 1);
+    }
+    Buffer_auto_reclaim(self, self->write_lock);
+    Buffer_unlock(self->read_lock);
+    PyBuffer_Release(&view);
+
+    return PyLong_FromLong (read_bytes);
+}
+
+static PyObject *
+Buffer_recv_from(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *file;
+    int fd;
+    long max_bytes = 0, status;
+    unsigned long room_bytes;
+    static char *kwlist[] = {"fd", "max_bytes", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|l", kwlist, &file, &max_bytes))
+        return NULL;
+
+    fd = PyObject_AsFileDescriptor(file);
+    if (fd < 0)
+        return NULL;
+
+    if (self->closed) {
+        PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+        return NULL;
+    }
+    Buffer_lock(self->write_lock);
+    if (Buffer_check_io(self, RING_BUFFER_IO_RECV) < 0) {
+        Buffer_unlock(self->write_lock);
+        return NULL;
+    }
+    room_bytes = self->buffer->count_bytes;
+    if (max_bytes > 0 && (unsigned long)max_bytes < room_bytes)
+        room_bytes = max_bytes;
+    Buffer_make_room(self, room_bytes, 0);
+    if (ring_buffer_producer_free_bytes (self->buffer, 1) == 0) {
+        self->buffer->producer_stats.full++;
+        Buffer_unlock(self->write_lock);
+        PyErr_SetString(FullError, "Not enough free bytes to write");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    status = ring_buffer_fill_from_fd (self->buffer, fd, max_bytes > 0 ? max_bytes : 0);
+    Py_END_ALLOW_THREADS
+    Buffer_unlock(self->write_lock);
+
+    if (status < 0)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    return PyLong_FromLong (status);
+}
+
+/* The I/O engine behind submit_recv(), submit_send() and poll_completions(), made on first
+ * use. io_lock keeps one thread at a time in it, and is held without the GIL while
+ * poll_completions() waits.
+ */
+#define BUFFER_IO_MAX_OPS 4096
+
+static struct ring_buffer_io *buffer_io;
+static PyThread_type_lock io_lock;
+
+static struct ring_buffer_io *
+Buffer_io_engine(void)
+{
+    if (buffer_io != NULL)
+        return buffer_io;
+
+    io_lock = PyThread_allocate_lock();
+    buffer_io = PyMem_Malloc(sizeof *buffer_io);
+    if (io_lock == NULL || buffer_io == NULL) {
+        if (io_lock)
+            PyThread_free_lock (io_lock);
+        PyMem_Free (buffer_io);
+        io_lock = NULL;
+        buffer_io = NULL;
+        PyErr_NoMemory();
+        return NULL;
+    }
+    if (ring_buffer_io_create (buffer_io, BUFFER_IO_MAX_OPS, 0)) {
+        PyThread_free_lock (io_lock);
+        PyMem_Free (buffer_io);
+        io_lock = NULL;
+        buffer_io = NULL;
+        PyErr_SetFromErrno(PyExc_OSError);
+        return NULL;
+    }
+    return buffer_io;
+}
+
+/* Queue a recv (@op RING_BUFFER_IO_RECV) or send on the engine. The engine holds a
+ * reference to the buffer until the operation completes, so the mapping outlives it.
+ */
+static PyObject *
+Buffer_submit(Buffer *self, PyObject *args, PyObject *kwargs, int op)
+{
+    PyObject *file;
+    int fd, status, saved_errno;
+    long max_bytes = 0;
+    static char *kwlist[] = {"fd", "max_bytes", NULL};
+    PyThread_type_lock side_lock = op == RING_BUFFER_IO_RECV ? self->write_lock : self->read_lock;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|l", kwlist, &file, &max_bytes))
+        return NULL;
+
+    fd = PyObject_AsFileDescriptor(file);
+    if (fd < 0 || Buffer_io_engine() == NULL)
+        return NULL;
+
+    if (op == RING_BUFFER_IO_RECV && self->closed) {
+        PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+        return NULL;
+    }
+    Buffer_lock(side_lock);
+    if (op == RING_BUFFER_IO_SEND && ring_buffer_cursors_open (self->buffer) > 0) {
+        Buffer_unlock(side_lock);
+        PyErr_SetString (PyExc_BufferError, "Cannot read from the buffer while readers are attached");
+        return NULL;
+    }
+    if (op == RING_BUFFER_IO_RECV ? self->reserved_bytes > 0 : self->acquired_bytes > 0) {
+        Buffer_unlock(side_lock);
+        PyErr_SetString (PyExc_BufferError, "Cannot submit over a reserved or acquired span");
+        return NULL;
+    }
+    Buffer_lock(io_lock);
+    if (op == RING_BUFFER_IO_RECV)
+        status = ring_buffer_io_submit_recv (buffer_io, self->buffer, fd, max_bytes > 0 ? max_bytes : 0, self);
+    else
+        status = ring_buffer_io_submit_send (buffer_io, self->buffer, fd, max_bytes > 0 ? max_bytes : 0, self);
+    saved_errno = errno;
+    Buffer_unlock(io_lock);
+    if (status < 0 && saved_errno == EAGAIN && op == RING_BUFFER_IO_RECV)
+        self->buffer->producer_stats.full++;
+    else if (status < 0 && saved_errno == EAGAIN)
+        self->buffer->consumer_stats.empty++;
+    Buffer_unlock(side_lock);
+
+    if (status == 0) {
+        Py_INCREF(self);
+        Py_RETURN_NONE;
+    }
+    if (saved_errno == EAGAIN && op == RING_BUFFER_IO_RECV) {
+        PyErr_SetString(FullError, "Not enough free bytes to write");
+    } else if (saved_errno == EAGAIN) {
+        PyErr_SetString (InsufficientDataError, "No data in buffer");
+    } else {
+        errno = saved_errno;
+        PyErr_SetFromErrno(PyExc_OSError);
+    }
+    return NULL;
+}
+
+static PyObject *
+Buffer_submit_recv(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    return Buffer_submit(self, args, kwargs, RING_BUFFER_IO_RECV);
+}
+
+static PyObject *
+Buffer_submit_send(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    return Buffer_submit(self, args, kwargs, RING_BUFFER_IO_SEND);
+}
+
+static PyObject *
+Buffer_send_to(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *file;
+    int fd;
+    long max_bytes = 0, status;
+    static char *kwlist[] = {"fd", "max_bytes", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|l", kwlist, &file, &max_bytes))
+        return NULL;
+
+    fd = PyObject_AsFileDescriptor(file);
+    if (fd < 0)
+        return NULL;
+
+    Buffer_lock(self->read_lock);
+    if (Buffer_check_read(self) < 0) {
+        Buffer_unlock(self->read_lock);
+        return NULL;
+    }
+    if (ring_buffer_consumer_count_bytes (self->buffer, 1) == 0) {
+        self->buffer->consumer_stats.empty++;
+        Buffer_unlock(self->read_lock);
+        PyErr_SetString (InsufficientDataError, "No data in buffer");
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    status = ring_buffer_drain_to_fd (self->buffer, fd, max_bytes > 0 ? max_bytes : 0);
+    Py_END_ALLOW_THREADS
+    Buffer_unlock(self->read_lock);
+
+    if (status < 0)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    return PyLong_FromLong (status);
+}
+
+static PyObject * 
+Buffer_close(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    ring_buffer_write_close (self->buffer);
+    self->closed = 1;
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Buffer_eof(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    return PyBool_FromLong ((self->closed || ring_buffer_write_closed(self->buffer)) && ring_buffer_eof(self->buffer));
+}
+
+static PyObject *
+Buffer_read(Buffer *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"length", "timeout", NULL};
+    PyObject *values[2], *timeout;
+    Py_ssize_t count_bytes;
+
+    if (parse_fastcall("read", args, nargs, kwnames, kwlist, 1, values) < 0
+        || (count_bytes = parse_length(values[0], "length")) < 0)
+        return NULL;
+    timeout = values[1];
+
+    PyObject *datagram = PyBytes_FromStringAndSize(NULL, count_bytes);
+    if (datagram == NULL)
+        return NULL;
+
+    Buffer_lock(self->read_lock);
+    if (Buffer_check_read(self) < 0) {
+        Buffer_unlock(self->read_lock);
+        Py_DECREF(datagram);
+        return NULL;
+    }
+    do {
+        if (ring_buffer_consumer_count_bytes (self->buffer, count_bytes) < (unsigned long)count_bytes
+            && Buffer_wait(self, 1, count_bytes, timeout) < 0) {
+            Buffer_unlock(self->read_lock);
+            Py_DECREF(datagram);
+            return NULL;
+        }
+        if (ring_buffer_consumer_count_bytes (self->buffer, count_bytes) < (unsigned long)count_bytes) {
+            self->buffer->consumer_stats.empty++;
+            Buffer_unlock(self->read_lock);
+            Py_DECREF(datagram);
+            PyErr_SetString(InsufficientDataError, "Not enough data to read from");
+            return NULL;
+        }
+
+        Buffer_copy(self, PyBytes_AS_STRING(datagram), ring_buffer_read_address (self->buffer), count_bytes);
+    } while (ring_buffer_read_advance (self->buffer, count_bytes) < 0); // overwritten meanwhile
+    Buffer_auto_reclaim(self, self->write_lock);
+    Buffer_unlock(self->read_lock);
+
+    return datagram;
+}
+
+static PyObject *
+Buffer_push(Buffer *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"data", "timeout", NULL};
+    PyObject *values[2];
+    Py_buffer data;
+
+    if (parse_fastcall("push", args, nargs, kwnames, kwlist, 1, values) < 0)
+        return NULL;
+
+    if (self->closed) {
+        PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+        return NULL;
+    }
+    if (PyObject_GetBuffer(values[0], &data, PyBUF_SIMPLE) < 0)
+        return NULL;
+    if (data.len > UINT32_MAX) {
+        PyBuffer_Release(&data);
+        PyErr_SetString (PyExc_ValueError, "record is larger than 4 GB");
+        return NULL;
+    }
+
+    unsigned long record_bytes = RING_BUFFER_RECORD_HEADER_BYTES + data.len;
+    uint32_t length = data.len;
+    char *address;
+
+    Buffer_lock(self->write_lock);
+    if (Buffer_check_io(self, RING_BUFFER_IO_RECV) < 0) {
+        Buffer_unlock(self->write_lock);
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+    Buffer_make_room(self, record_bytes, 1);
+    if (ring_buffer_producer_free_bytes (self->buffer, record_bytes) < record_bytes
+        && Buffer_wait(self, 0, record_bytes, values[1]) < 0) {
+        Buffer_unlock(self->write_lock);
+        PyBuffer_Release(&data);
+        return NULL;
+    }
+    if (ring_buffer_producer_free_bytes (self->buffer, record_bytes) < record_bytes) {
+        self->buffer->producer_stats.full++;
+        Buffer_unlock(self->write_lock);
+        PyBuffer_Release(&data);
+        PyErr_SetString(FullError, "Not enough free bytes to push the record");
+        return NULL;
+    }
+
+    // same layout as ring_buffer_push_record, with the payload copy off the GIL when large
+    address = ring_buffer_write_address (self->buffer);
+    memcpy (address, &length, RING_BUFFER_RECORD_HEADER_BYTES);
+    Buffer_copy(self, address + RING_BUFFER_RECORD_HEADER_BYTES, data.buf, data.len);
+    ring_buffer_write_advance (self->buffer, record_bytes);
+    Buffer_auto_reclaim(self, self->read_lock);
+    Buffer_unlock(self->write_lock);
+    PyBuffer_Release(&data);
+
+    Py_RETURN_NONE;
+}
+
+/* Copy the oldest record into a new string and drop it from the buffer. The caller
+ * holds the read lock.
+ */
+static PyObject *
+Buffer_pop_record(Buffer *self)
+{
+    unsigned long count_bytes;
+    char *record;
+    PyObject *datagram;
+
+    for (;;) {
+        record = ring_buffer_front_record (self->buffer, &count_bytes);
+        if (record == NULL) {
+            PyErr_SetString (InsufficientDataError, "No record in buffer");
+            return NULL;
+        }
+
+        datagram = PyBytes_FromStringAndSize(NULL, count_bytes);
+        if (datagram == NULL)
+            return NULL;
+        Buffer_copy(self, PyBytes_AS_STRING(datagram), record, count_bytes);
+        if (ring_buffer_pop_record (self->buffer) == 0)
+            return datagram;
+        Py_DECREF(datagram); // overwritten meanwhile
+    }
+}
+
+static PyObject *
+Buffer_pop(Buffer *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"timeout", NULL};
+    PyObject *values[1];
+
+    if (parse_fastcall("pop", args, nargs, kwnames, kwlist, 0, values) < 0)
+        return NULL;
+
+    PyObject *record = NULL;
+
+    Buffer_lock(self->read_lock);
+    // only Buffer_pop_record counts an empty buffer, once
+    if (Buffer_check_read(self) == 0
+        && (ring_buffer_consumer_count_bytes (self->buffer, RING_BUFFER_RECORD_HEADER_BYTES) >= RING_BUFFER_RECORD_HEADER_BYTES
+            || Buffer_wait(self, 1, RING_BUFFER_RECORD_HEADER_BYTES, values[0]) >= 0))
+        record = Buffer_pop_record(self);
+    Buffer_auto_reclaim(self, self->write_lock);
+    Buffer_unlock(self->read_lock);
+
+    return record;
+}
+
+static PyObject *
+Buffer_pop_many(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t max_records = PY_SSIZE_T_MAX;
+    unsigned long count_bytes;
+    static char *kwlist[] = {"max_records", NULL};
+    PyObject *records, *record;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n", kwlist, &max_records))
+        return NULL;
+
+    records = PyList_New(0);
+    if (records == NULL)
+        return NULL;
+
+    Buffer_lock(self->read_lock);
+    if (Buffer_check_read(self) < 0) {
+        Buffer_unlock(self->read_lock);
+        Py_DECREF(records);
+        return NULL;
+    }
+    while (PyList_GET_SIZE(records) < max_records
+           && ring_buffer_front_record (self->buffer, &count_bytes) != NULL) {
+        record = Buffer_pop_record(self);
+        if (record == NULL || PyList_Append(records, record) < 0) {
+            Buffer_unlock(self->read_lock);
+            Py_XDECREF(record);
+            Py_DECREF(records);
+            return NULL;
+        }
+        Py_DECREF(record);
+    }
+    Buffer_auto_reclaim(self, self->write_lock);
+    Buffer_unlock(self->read_lock);
+
+    return records;
+}
+
+static PyObject *
+Buffer_wait_readable(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t min_bytes = 1;
+    PyObject *timeout = Py_None;
+    static char *kwlist[] = {"min_bytes", "timeout", NULL};
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|nO", kwlist, &min_bytes, &timeout))
+        return NULL;
+
+    if (ring_buffer_consumer_count_bytes (self->buffer, min_bytes) >= (unsigned long)min_bytes)
+        Py_RETURN_TRUE;
+    status = Buffer_wait(self, 1, min_bytes, timeout);
+    if (status < 0)
+        return NULL;
+
+    return PyBool_FromLong (ring_buffer_consumer_count_bytes (self->buffer, min_bytes) >= (unsigned long)min_bytes);
+}
+
+static PyObject *
+Buffer_wait_writable(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t min_bytes = 1;
+    PyObject *timeout = Py_None;
+    static char *kwlist[] = {"min_bytes", "timeout", NULL};
+    int status;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|nO", kwlist, &min_bytes, &timeout))
+        return NULL;
+
+    status = Buffer_wait(self, 0, min_bytes, timeout);
+    if (status < 0)
+        return NULL;
+
+    return PyBool_FromLong (ring_buffer_producer_free_bytes (self->buffer, min_bytes) >= (unsigned long)min_bytes);
+}
+
+/* Length of the next line ending in @delimiter, waiting up to @timeout (see Buffer_wait)
+ * for it; once the writer closed, the unterminated rest, 0 at the end. Return -1 with an
+ * exception set if no whole line came in time. The caller holds the read lock.
+ */
+static long
+Buffer_line_bytes(Buffer *self, const char *delimiter, Py_ssize_t delimiter_bytes, PyObject *timeout)
+{
+    double seconds = 0;
+    struct timespec then, now;
+    PyObject *remaining = timeout;
+    unsigned long readable_bytes;
+    long found;
+    int status;
+
+    if (timeout != NULL && timeout != Py_None) {
+        seconds = PyFloat_AsDouble(timeout);
+        if (seconds == -1.0 && PyErr_Occurred())
+            return -1;
+        if (seconds < 0) {
+            PyErr_SetString (PyExc_ValueError, "timeout must be non-negative");
+            return -1;
+        }
+        clock_gettime (CLOCK_MONOTONIC, &then);
+    }
+
+    for (;;) {
+        found = ring_buffer_find (self->buffer, delimiter, delimiter_bytes);
+        if (found >= 0)
+            return found + delimiter_bytes;
+        readable_bytes = ring_buffer_count_bytes (self->buffer);
+        if (ring_buffer_write_closed (self->buffer))
+            return readable_bytes;
+
+        // each wait is for one more byte, so each gets what is left of the timeout
+        if (timeout != NULL && timeout != Py_None) {
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            seconds -= (now.tv_sec - then.tv_sec) + (now.tv_nsec - then.tv_nsec) / 1e9;
+            then = now;
+            remaining = PyFloat_FromDouble(seconds > 0 ? seconds : 0);
+            if (remaining == NULL)
+                return -1;
+        }
+        status = Buffer_wait(self, 1, readable_bytes + 1, remaining);
+        if (remaining != timeout)
+            Py_DECREF(remaining);
+        if (status < 0)
+            return -1;
+        if (status == 0) {
+            self->buffer->consumer_stats.empty++;
+            PyErr_SetString (InsufficientDataError, "No complete line to read");
+            return -1;
+        }
+    }
+}
+
+/* Copy the @count_bytes that the last ring_buffer_find looked at into *@line and consume
+ * them. Return 1, 0 if an overwriting producer took them first, or -1 with an exception.
+ */
+static int
+Buffer_take_line(Buffer *self, long count_bytes, PyObject **line)
+{
+    struct ring_buffer *buffer = self->buffer;
+
+    *line = PyBytes_FromStringAndSize(NULL, count_bytes);
+    if (*line == NULL)
+        return -1;
+    Buffer_copy(self, PyBytes_AS_STRING(*line),
+                (char *)buffer->address + (buffer->claimed_read_offset_bytes & (buffer->count_bytes - 1)),
+                count_bytes);
+    if (ring_buffer_read_advance (buffer, count_bytes) < 0) {
+        Py_CLEAR(*line);
+        return 0;
+    }
+    return 1;
+}
+
+static PyObject *
+Buffer_read_line(Buffer *self, const char *delimiter, Py_ssize_t delimiter_bytes, PyObject *timeout)
+{
+    PyObject *line = NULL;
+    long count_bytes;
+
+    if (delimiter_bytes == 0) {
+        PyErr_SetString (PyExc_ValueError, "delimiter must not be empty");
+        return NULL;
+    }
+
+    Buffer_lock(self->read_lock);
+    if (Buffer_check_read(self) < 0) {
+        Buffer_unlock(self->read_lock);
+        return NULL;
+    }
+    do
+        count_bytes = Buffer_line_bytes(self, delimiter, delimiter_bytes, timeout);
+    while (count_bytes >= 0 && Buffer_take_line(self, count_bytes, &line) == 0);
+    Buffer_auto_reclaim(self, self->write_lock);
+    Buffer_unlock(self->read_lock);
+
+    return line;
+}
+
+static PyObject *
+Buffer_read_until(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    const char *delimiter;
+    Py_ssize_t delimiter_bytes;
+    PyObject *timeout = NULL;
+    static char *kwlist[] = {"delimiter", "timeout", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y#|O", kwlist, &delimiter, &delimiter_bytes, &timeout))
+        return NULL;
+
+    return Buffer_read_line(self, delimiter, delimiter_bytes, timeout);
+}
+
+static PyObject *
+Buffer_readline(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    PyObject *timeout = NULL;
+    static char *kwlist[] = {"timeout", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O", kwlist, &timeout))
+        return NULL;
+
+    return Buffer_read_line(self, "\n", 1, timeout);
+}
+
+static PyObject *
+Buffer_find(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    const char *delimiter;
+    Py_ssize_t delimiter_bytes;
+    long found;
+    static char *kwlist[] = {"delimiter", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y#", kwlist, &delimiter, &delimiter_bytes))
+        return NULL;
+
+    Buffer_lock(self->read_lock);
+    found = ring_buffer_find (self->buffer, delimiter, delimiter_bytes);
+    Buffer_unlock(self->read_lock);
+
+    return PyLong_FromLong (found);
+}
+
+static PyObject *
+Buffer_iter_lines(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    const char *delimiter = "\n";
+    Py_ssize_t delimiter_bytes = 1, max_lines = PY_SSIZE_T_MAX;
+    int status;
+    long found, count_bytes;
+    PyObject *lines, *line, *iterator;
+    static char *kwlist[] = {"delimiter", "max_lines", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|y#n", kwlist, &delimiter, &delimiter_bytes, &max_lines))
+        return NULL;
+
+    if (delimiter_bytes == 0) {
+        PyErr_SetString (PyExc_ValueError, "delimiter must not be empty");
+        return NULL;
+    }
+
+    lines = PyList_New(0);
+    if (lines == NULL)
+        return NULL;
+
+    Buffer_lock(self->read_lock);
+    if (Buffer_check_read(self) < 0) {
+        Buffer_unlock(self->read_lock);
+        Py_DECREF(lines);
+        return NULL;
+    }
+    while (PyList_GET_SIZE(lines) < max_lines) {
+        found = ring_buffer_find (self->buffer, delimiter, delimiter_bytes);
+        if (found >= 0)
+            count_bytes = found + delimiter_bytes;
+        else if (ring_buffer_write_closed (self->buffer))
+            count_bytes = ring_buffer_count_bytes (self->buffer);
+        else
+            count_bytes = 0;
+        if (count_bytes == 0)
+            break;
+
+        status = Buffer_take_line(self, count_bytes, &line);
+        if (status < 0 || (status > 0 && PyList_Append(lines, line) < 0)) {
+            Buffer_unlock(self->read_lock);
+            Py_XDECREF(line);
+            Py_DECREF(lines);
+            return NULL;
+        }
+        Py_XDECREF(line);
+    }
+    Buffer_unlock(self->read_lock);
+
+    iterator = PyObject_GetIter(lines);
+    Py_DECREF(lines);
+    return iterator;
+}
+
+static PyObject *
+Buffer_peek_read(Buffer *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"length", NULL};
+    PyObject *values[1];
+    Py_ssize_t count_bytes;
+
+    if (parse_fastcall("peek_read", args, nargs, kwnames, kwlist, 1, values) < 0
+        || (count_bytes = parse_length(values[0], "length")) < 0)
+        return NULL;
+
+    Buffer_lock(self->read_lock);
+    if (ring_buffer_count_bytes (self->buffer) < (unsigned long)count_bytes) {
+        self->buffer->consumer_stats.empty++;
+        Buffer_unlock(self->read_lock);
+        PyErr_SetString (InsufficientDataError, "Not enough data to read from");
+        return NULL;
+    }
+
+    PyObject *datagram = PyBytes_FromStringAndSize(NULL, count_bytes);
+    if (datagram != NULL)
+        Buffer_copy(self, PyBytes_AS_STRING(datagram), ring_buffer_read_address (self->buffer), count_bytes);
+    Buffer_unlock(self->read_lock);
+
+    return datagram;
+}
+
+static PyObject *
+Buffer_read_piece(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Buffer_lock(self->read_lock);
+    if (ring_buffer_eof(self->buffer)) {
+        self->buffer->consumer_stats.empty++;
+        Buffer_unlock(self->read_lock);
+        PyErr_SetString (InsufficientDataError, "No data in buffer");
+        return NULL;
+    }
+    if (Buffer_check_read(self) < 0) {
+        Buffer_unlock(self->read_lock);
+        return NULL;
+    }
+    int bytes_available_for_read = ring_buffer_count_bytes (self->buffer);
+    PyObject *datagram;
+    if (bytes_available_for_read > self->buffer->page_size)
+        bytes_available_for_read = self->buffer->page_size;
+
+    datagram = PyBytes_FromStringAndSize(NULL, bytes_available_for_read);
+    if (datagram != NULL) {
+        do
+            Buffer_copy(self, PyBytes_AS_STRING(datagram), ring_buffer_read_address (self->buffer), bytes_available_for_read);
+        while (ring_buffer_read_advance (self->buffer, bytes_available_for_read) < 0); // overwritten meanwhile
+    }
+    Buffer_unlock(self->read_lock);
+
+    return datagram;
+}
+
+static PyObject *
+Buffer_snapshot(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    int records = 0;
+    static char *kwlist[] = {"records", NULL};
+    PyObject *window, *list, *record;
+    unsigned long count_bytes, offset_bytes = 0;
+    uint32_t length;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &records))
+        return NULL;
+
+    window = PyBytes_FromStringAndSize(NULL, self->buffer->count_bytes);
+    if (window == NULL)
+        return NULL;
+
+    // no lock: the snapshot moves no offsets, and copes with both sides moving them; it
+    // counts as an export so that no resize unmaps the data under it
+    if ((Py_ssize_t)self->buffer->count_bytes >= self->gil_release_threshold) {
+        self->exports++;
+        Py_BEGIN_ALLOW_THREADS
+        count_bytes = ring_buffer_snapshot (self->buffer, PyBytes_AS_STRING(window));
+        Py_END_ALLOW_THREADS
+        self->exports--;
+    } else {
+        count_bytes = ring_buffer_snapshot (self->buffer, PyBytes_AS_STRING(window));
+    }
+    if (_PyBytes_Resize(&window, count_bytes) < 0)
+        return NULL;
+    if (!records)
+        return window;
+
+    list = PyList_New(0);
+    while (list != NULL && count_bytes - offset_bytes >= RING_BUFFER_RECORD_HEADER_BYTES) {
+        memcpy (&length, PyBytes_AS_STRING(window) + offset_bytes, RING_BUFFER_RECORD_HEADER_BYTES);
+        offset_bytes += RING_BUFFER_RECORD_HEADER_BYTES;
+        if (length > count_bytes - offset_bytes)
+            break; // a record the producer has not finished publishing
+        record = PyBytes_FromStringAndSize(PyBytes_AS_STRING(window) + offset_bytes, length);
+        if (record == NULL || PyList_Append(list, record) < 0)
+            Py_CLEAR(list);
+        Py_XDECREF(record);
+        offset_bytes += length;
+    }
+    Py_DECREF(window);
+
+    return list;
+}
+
+/* Add @name: @value to @dict, stealing the reference to @value. */
+static int
+Buffer_stats_set(PyObject *dict, const char *name, PyObject *value)
+{
+    int status;
+
+    if (value == NULL)
+        return -1;
+    status = PyDict_SetItemString(dict, name, value);
+    Py_DECREF(value);
+    return status;
+}
+
+static PyObject *
+Buffer_stats(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    struct ring_buffer_producer_stats *producer = &self->buffer->producer_stats;
+    struct ring_buffer_consumer_stats *consumer = &self->buffer->consumer_stats;
+    unsigned long high_water_bytes = producer->high_water_bytes;
+    PyObject *stats, *histogram;
+    int i;
+
+    if (consumer->high_water_bytes > high_water_bytes)
+        high_water_bytes = consumer->high_water_bytes;
+
+    stats = PyDict_New();
+    if (stats == NULL)
+        return NULL;
+
+    if (Buffer_stats_set(stats, "count_bytes", PyLong_FromUnsignedLong (self->buffer->count_bytes))
+        || Buffer_stats_set(stats, "bytes_written", PyLong_FromUnsignedLong (producer->bytes_written))
+        || Buffer_stats_set(stats, "writes", PyLong_FromUnsignedLong (producer->writes))
+        || Buffer_stats_set(stats, "full", PyLong_FromUnsignedLong (producer->full))
+        || Buffer_stats_set(stats, "write_waits", PyLong_FromUnsignedLong (producer->waits))
+        || Buffer_stats_set(stats, "write_wait_ns", PyLong_FromUnsignedLong (producer->wait_ns))
+        || Buffer_stats_set(stats, "bytes_read", PyLong_FromUnsignedLong (consumer->bytes_read))
+        || Buffer_stats_set(stats, "reads", PyLong_FromUnsignedLong (consumer->reads))
+        || Buffer_stats_set(stats, "empty", PyLong_FromUnsignedLong (consumer->empty))
+        || Buffer_stats_set(stats, "wraps", PyLong_FromUnsignedLong (consumer->wraps))
+        || Buffer_stats_set(stats, "read_waits", PyLong_FromUnsignedLong (consumer->waits))
+        || Buffer_stats_set(stats, "read_wait_ns", PyLong_FromUnsignedLong (consumer->wait_ns))
+        || Buffer_stats_set(stats, "high_water_bytes", PyLong_FromUnsignedLong (high_water_bytes))
+        || Buffer_stats_set(stats, "dropped_bytes", PyLong_FromUnsignedLong (ring_buffer_dropped_bytes (self->buffer)))
+        || Buffer_stats_set(stats, "dropped_records", PyLong_FromUnsignedLong (ring_buffer_dropped_records (self->buffer))))
+        goto fail;
+
+    if (self->buffer->latency == NULL)
+        return stats;
+
+    // {2**i: writes that spent [2**i, 2**(i+1)) ns in the buffer}
+    histogram = PyDict_New();
+    if (histogram == NULL)
+        goto fail;
+    Py_INCREF(histogram);
+    if (Buffer_stats_set(stats, "latency_ns", histogram))
+        goto fail_histogram;
+    for (i = 0; i < RING_BUFFER_LATENCY_BUCKETS; i++) {
+        unsigned long count = self->buffer->latency->buckets[i];
+        PyObject *bound, *value;
+        int status;
+
+        if (count == 0)
+            continue;
+        bound = PyLong_FromUnsignedLong (1UL << i);
+        value = PyLong_FromUnsignedLong (count);
+        status = bound && value ? PyDict_SetItem(histogram, bound, value) : -1;
+        Py_XDECREF(bound);
+        Py_XDECREF(value);
+        if (status < 0)
+            goto fail_histogram;
+    }
+    Py_DECREF(histogram);
+
+    return stats;
+
+fail_histogram:
+    Py_DECREF(histogram);
+
+fail:
+    Py_DECREF(stats);
+    return NULL;
+}
+
+static PyObject *
+Buffer_reset_stats(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    ring_buffer_reset_stats (self->buffer);
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Buffer_enable_timestamps(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    if (ring_buffer_enable_timestamps (self->buffer))
+        return PyErr_SetFromErrno(PyExc_OSError);
+    Py_RETURN_NONE;
+}
+
+/* Return a memoryview over @count_bytes of the mapping at @address. The view keeps a
+ * reference to @self, so the mapping outlives it, but the bytes it shows are only
+ * meaningful until the span is committed or released.
+ */
+static PyObject *
+Buffer_memoryview(Buffer *self, void *address, Py_ssize_t count_bytes, int readonly)
+{
+    PyObject *view;
+
+    self->view_address = address;
+    self->view_bytes = count_bytes;
+    self->view_readonly = readonly;
+    view = PyMemoryView_FromObject((PyObject *)self);
+    self->view_address = NULL;
+
+    return view;
+}
+
+static PyObject *
+Buffer_reserve(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t count_bytes;
+    PyObject *view;
+    static char *kwlist[] = {"length", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", kwlist, &count_bytes))
+        return NULL;
+
+    if (self->closed) {
+        PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+        return NULL;
+    }
+    if (count_bytes < 0) {
+        PyErr_SetString (PyExc_ValueError, "length must not be negative");
+        return NULL;
+    }
+    Buffer_lock(self->write_lock);
+    if (Buffer_check_io(self, RING_BUFFER_IO_RECV) < 0) {
+        Buffer_unlock(self->write_lock);
+        return NULL;
+    }
+    if (ring_buffer_producer_free_bytes (self->buffer, count_bytes) < (unsigned long)count_bytes) {
+        self->buffer->producer_stats.full++;
+        Buffer_unlock(self->write_lock);
+        PyErr_SetString(FullError, "Not enough free bytes to write");
+        return NULL;
+    }
+
+    self->reserved_bytes = count_bytes;
+    view = Buffer_memoryview(self, ring_buffer_write_address (self->buffer), count_bytes, 0);
+    Buffer_unlock(self->write_lock);
+    return view;
+}
+
+static PyObject *
+Buffer_commit(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t count_bytes;
+    static char *kwlist[] = {"length", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", kwlist, &count_bytes))
+        return NULL;
+
+    Buffer_lock(self->write_lock);
+    if (count_bytes < 0 || count_bytes > self->reserved_bytes) {
+        Buffer_unlock(self->write_lock);
+        PyErr_SetString (PyExc_ValueError, "Cannot commit more bytes than were reserved");
+        return NULL;
+    }
+
+    ring_buffer_write_advance (self->buffer, count_bytes);
+    self->reserved_bytes = 0;
+    Buffer_unlock(self->write_lock);
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Buffer_acquire(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t count_bytes;
+    PyObject *view;
+    static char *kwlist[] = {"length", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", kwlist, &count_bytes))
+        return NULL;
+
+    if (count_bytes < 0) {
+        PyErr_SetString (PyExc_ValueError, "length must not be negative");
+        return NULL;
+    }
+    Buffer_lock(self->read_lock);
+    if (Buffer_check_read(self) < 0) {
+        Buffer_unlock(self->read_lock);
+        return NULL;
+    }
+    if (ring_buffer_consumer_count_bytes (self->buffer, count_bytes) < (unsigned long)count_bytes) {
+        self->buffer->consumer_stats.empty++;
+        Buffer_unlock(self->read_lock);
+        PyErr_SetString (InsufficientDataError, "Not enough data to read from");
+        return NULL;
+    }
+
+    self->acquired_bytes = count_bytes;
+    view = Buffer_memoryview(self, ring_buffer_read_address (self->buffer), count_bytes, 1);
+    Buffer_unlock(self->read_lock);
+    return view;
+}
+
+static PyObject *
+Buffer_release(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t count_bytes;
+    int status;
+    static char *kwlist[] = {"length", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", kwlist, &count_bytes))
+        return NULL;
+
+    Buffer_lock(self->read_lock);
+    if (count_bytes < 0 || count_bytes > self->acquired_bytes) {
+        Buffer_unlock(self->read_lock);
+        PyErr_SetString (PyExc_ValueError, "Cannot release more bytes than were acquired");
+        return NULL;
+    }
+
+    self->acquired_bytes = 0;
+    status = ring_buffer_read_advance (self->buffer, count_bytes);
+    Buffer_unlock(self->read_lock);
+    if (status < 0) {
+        PyErr_SetString (InsufficientDataError, "The acquired bytes were overwritten");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/* Like Buffer_memoryview, but the view is an array of @count_records records in
+ * record_format: view.format, view.itemsize and view.shape describe them, so
+ * numpy.asarray(view) or numpy.frombuffer(view, dtype) parse them without a copy.
+ */
+static PyObject *
+Buffer_array_view(Buffer *self, void *address, Py_ssize_t count_records, int readonly)
+{
+    PyObject *view;
+
+    self->view_records = 1;
+    view = Buffer_memoryview(self, address, count_records * self->record_bytes, readonly);
+    self->view_records = 0;
+
+    return view;
+}
+
+static PyObject *
+Buffer_read_array(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t max_records = PY_SSIZE_T_MAX;
+    unsigned long count_records;
+    PyObject *view;
+    static char *kwlist[] = {"max_records", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n", kwlist, &max_records))
+        return NULL;
+
+    if (self->record_format == NULL) {
+        PyErr_SetString (PyExc_ValueError, "read_array() needs a record_format");
+        return NULL;
+    }
+    if (max_records < 0) {
+        PyErr_SetString (PyExc_ValueError, "max_records must not be negative");
+        return NULL;
+    }
+
+    Buffer_lock(self->read_lock);
+    if (Buffer_check_read(self) < 0) {
+        Buffer_unlock(self->read_lock);
+        return NULL;
+    }
+
+    // the mirror mapping makes every readable record contiguous, wrapped or not
+    count_records = ring_buffer_consumer_count_bytes (self->buffer, self->record_bytes) / self->record_bytes;
+    if (count_records > (unsigned long)max_records)
+        count_records = max_records;
+    if (count_records == 0)
+        self->buffer->consumer_stats.empty++;
+
+    self->acquired_bytes = count_records * self->record_bytes;
+    view = Buffer_array_view(self, ring_buffer_read_address (self->buffer), count_records, 1);
+    Buffer_unlock(self->read_lock);
+    return view;
+}
+
+static PyObject *
+Buffer_release_array(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t count_records;
+    int status;
+    static char *kwlist[] = {"count", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "n", kwlist, &count_records))
+        return NULL;
+
+    if (self->record_format == NULL) {
+        PyErr_SetString (PyExc_ValueError, "release_array() needs a record_format");
+        return NULL;
+    }
+    Buffer_lock(self->read_lock);
+    if (count_records < 0 || count_records > self->acquired_bytes / self->record_bytes) {
+        Buffer_unlock(self->read_lock);
+        PyErr_SetString (PyExc_ValueError, "Cannot release more records than were read");
+        return NULL;
+    }
+
+    self->acquired_bytes = 0;
+    status = ring_buffer_read_advance (self->buffer, count_records * self->record_bytes);
+    Buffer_unlock(self->read_lock);
+    if (status < 0) {
+        PyErr_SetString (InsufficientDataError, "The records were overwritten");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/* put_object() sends an object as one push() record whose payload is laid out for pickle
+ * protocol 5:
+ *
+ *   uint64 pickle_bytes | pickle stream | out-of-band buffers | table | uint64 count
+ *
+ * The Pickler writes its stream straight into the free bytes after the record header, and
+ * each out-of-band PickleBuffer (a numpy array, a PickleBuffer over bytes) is copied once,
+ * from its own memory, to an address aligned to BUFFER_OBJECT_ALIGN. The table holds a
+ * {uint64 offset, uint64 length} pair per buffer, offsets counted from the start of the
+ * payload. Mappings are page aligned, so the alignment holds in every process.
+ */
+#define BUFFER_OBJECT_ALIGN 64
+
+/* The file put_object() hands to pickle.Pickler: write() appends to the record being
+ * built at the write address, which only moves forward once the whole record is there.
+ */
+typedef struct {
+    PyObject_HEAD
+    Buffer *owner; // borrowed while put_object() runs, NULL after
+    PyObject *timeout;
+    char *record;
+    unsigned long count_bytes; // written so far, record header included
+} ObjectWriter;
+
+/* Make sure @count_bytes from the write address are free for put_object(), waiting up to
+ * @timeout for them. Never auto-grows: that would leave behind the part of the record
+ * already written. Return 0, or -1 with an exception set.
+ */
+static int
+Buffer_object_room(Buffer *self, unsigned long count_bytes, PyObject *timeout)
+{
+    if (count_bytes - RING_BUFFER_RECORD_HEADER_BYTES > UINT32_MAX) {
+        PyErr_SetString (PyExc_ValueError, "record is larger than 4 GB");
+        return -1;
+    }
+    if (ring_buffer_producer_free_bytes (self->buffer, count_bytes) >= count_bytes)
+        return 0;
+    if (ring_buffer_overwrite (self->buffer))
+        Buffer_make_room(self, count_bytes, 1);
+    if (ring_buffer_producer_free_bytes (self->buffer, count_bytes) < count_bytes
+        && Buffer_wait(self, 0, count_bytes, timeout) < 0)
+        return -1;
+    if (ring_buffer_producer_free_bytes (self->buffer, count_bytes) < count_bytes) {
+        self->buffer->producer_stats.full++;
+        PyErr_SetString(FullError, "Not enough free bytes to put the object");
+        return -1;
+    }
+    return 0;
+}
+
+/* Append @count_bytes at @source to the record, after @align_bytes - 1 bytes of padding
+ * at most. Return the offset written at, or -1 with an exception set.
+ */
+static long
+ObjectWriter_append(ObjectWriter *self, const void *source, Py_ssize_t count_bytes, unsigned long align_bytes)
+{
+    unsigned long offset;
+
+    if (self->owner == NULL) {
+        PyErr_SetString (PyExc_ValueError, "write() after put_object() returned");
+        return -1;
+    }
+    offset = self->count_bytes + (-(uintptr_t)(self->record + self->count_bytes) & (align_bytes - 1));
+    if (Buffer_object_room(self->owner, offset + count_bytes, self->timeout) < 0)
+        return -1;
+    Buffer_copy(self->owner, self->record + offset, source, count_bytes);
+    self->count_bytes = offset + count_bytes;
+    return offset;
+}
+
+static PyObject *
+ObjectWriter_write(ObjectWriter *self, PyObject *data_object)
+{
+    Py_buffer data;
+    long offset;
+
+    if (PyObject_GetBuffer(data_object, &data, PyBUF_SIMPLE) < 0)
+        return NULL;
+    offset = ObjectWriter_append(self, data.buf, data.len, 1);
+    PyBuffer_Release(&data);
+    if (offset < 0)
+        return NULL;
+
+    return PyLong_FromSsize_t(data.len);
+}
+
+static PyMethodDef ObjectWriter_methods[] = {
+    {"write", (PyCFunction)ObjectWriter_write, METH_O,
+     "Append the bytes to the object record"},
+    {NULL} /* Sentinel */
+};
+
+static PyTypeObject buffer_ObjectWriterType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "ring_buffer._ObjectWriter", /*tp_name*/
+    sizeof(ObjectWriter),      /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    0,                         /*tp_dealloc*/
+    0,                         /*tp_vectorcall_offset*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_as_async*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "The file Buffer.put_object() pickles into", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    ObjectWriter_methods,      /* tp_methods */
+};
+
+/* Pickle @obj into the record @writer builds, then the out-of-band @buffers after it, then
+ * the table. The caller holds the write lock. Return 0, or -1 with an exception set.
+ */
+static int
+Buffer_put_object_locked(Buffer *self, ObjectWriter *writer, PyObject *pickler, PyObject *obj, PyObject *buffers)
+{
+    Py_ssize_t i, count = 0;
+    uint64_t *table, pickle_bytes;
+    Py_buffer data;
+    PyObject *result;
+    long offset;
+    int status = -1;
+
+    writer->record = ring_buffer_write_address (self->buffer);
+    writer->count_bytes = RING_BUFFER_RECORD_HEADER_BYTES + sizeof pickle_bytes;
+    if (Buffer_object_room(self, writer->count_bytes, writer->timeout) < 0)
+        return -1;
+    result = PyObject_CallMethod(pickler, "dump", "(O)", obj);
+    if (result == NULL)
+        return -1;
+    Py_DECREF(result);
+    pickle_bytes = writer->count_bytes - RING_BUFFER_RECORD_HEADER_BYTES - sizeof pickle_bytes;
+    memcpy (writer->record + RING_BUFFER_RECORD_HEADER_BYTES, &pickle_bytes, sizeof pickle_bytes);
+
+    table = PyMem_New(uint64_t, 2 * PyList_GET_SIZE(buffers) + 1);
+    if (table == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (i=0; i<PyList_GET_SIZE(buffers); i++) {
+        if (PyObject_GetBuffer(PyList_GET_ITEM(buffers, i), &data, PyBUF_ANY_CONTIGUOUS) < 0)
+            goto done;
+        offset = ObjectWriter_append(writer, data.buf, data.len, BUFFER_OBJECT_ALIGN);
+        table[count++] = offset - RING_BUFFER_RECORD_HEADER_BYTES;
+        table[count++] = data.len;
+        PyBuffer_Release(&data);
+        if (offset < 0)
+            goto done;
+    }
+    table[count++] = PyList_GET_SIZE(buffers);
+    if (ObjectWriter_append(writer, table, count * sizeof *table, sizeof *table) < 0)
+        goto done;
+
+    uint32_t length = writer->count_bytes - RING_BUFFER_RECORD_HEADER_BYTES;
+    memcpy (writer->record, &length, RING_BUFFER_RECORD_HEADER_BYTES);
+    ring_buffer_write_advance (self->buffer, writer->count_bytes);
+    status = 0;
+
+done:
+    PyMem_Free(table);
+    return status;
+}
+
+static PyObject *
+Buffer_put_object(Buffer *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"obj", "timeout", NULL};
+    PyObject *values[2];
+    PyObject *pickle_module, *buffers, *pickler = NULL;
+    ObjectWriter *writer;
+    int status;
+
+    if (parse_fastcall("put_object", args, nargs, kwnames, kwlist, 1, values) < 0)
+        return NULL;
+
+    if (self->closed) {
+        PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+        return NULL;
+    }
+    pickle_module = PyImport_ImportModule("pickle");
+    if (pickle_module == NULL)
+        return NULL;
+    buffers = PyList_New(0);
+    writer = PyObject_New(ObjectWriter, &buffer_ObjectWriterType);
+    if (buffers != NULL && writer != NULL) {
+        writer->owner = self;
+        writer->timeout = values[1];
+        writer->record = NULL;
+        writer->count_bytes = 0;
+        // pickle.Pickler(writer, 5, buffer_callback=buffers.append)
+        PyObject *append = PyObject_GetAttrString(buffers, "append");
+        PyObject *pickler_class = PyObject_GetAttrString(pickle_module, "Pickler");
+        PyObject *pickler_args = Py_BuildValue("(Oi)", writer, 5);
+        PyObject *pickler_kwargs = Py_BuildValue("{s:O}", "buffer_callback", append ? append : Py_None);
+        if (append && pickler_class && pickler_args && pickler_kwargs)
+            pickler = PyObject_Call(pickler_class, pickler_args, pickler_kwargs);
+        Py_XDECREF(append);
+        Py_XDECREF(pickler_class);
+        Py_XDECREF(pickler_args);
+        Py_XDECREF(pickler_kwargs);
+    }
+    Py_DECREF(pickle_module);
+    if (pickler == NULL) {
+        Py_XDECREF((PyObject *)writer);
+        Py_XDECREF(buffers);
+        return NULL;
+    }
+
+    Buffer_lock(self->write_lock);
+    status = Buffer_check_io(self, RING_BUFFER_IO_RECV);
+    if (status == 0)
+        status = Buffer_put_object_locked(self, writer, pickler, values[0], buffers);
+    if (status == 0)
+        Buffer_auto_reclaim(self, self->read_lock);
+    Buffer_unlock(self->write_lock);
+    writer->owner = NULL; // the pickler may outlive the call in a reference cycle
+    Py_DECREF(pickler);
+    Py_DECREF((PyObject *)writer);
+    Py_DECREF(buffers);
+    if (status < 0)
+        return NULL;
+
+    Py_RETURN_NONE;
+}
+
+/* Check the put_object() layout of the @count_bytes payload at @record and find its table.
+ * Return the number of out-of-band buffers, or -1 with a ValueError set.
+ */
+static Py_ssize_t
+Buffer_object_table(const char *record, unsigned long count_bytes, uint64_t *pickle_bytes, const char **table)
+{
+    uint64_t count, entry[2], i;
+    unsigned long table_offset;
+
+    if (count_bytes < 2 * sizeof count)
+        goto invalid;
+    memcpy (pickle_bytes, record, sizeof *pickle_bytes);
+    memcpy (&count, record + count_bytes - sizeof count, sizeof count);
+    if (count > (count_bytes - 2 * sizeof count) / sizeof entry)
+        goto invalid;
+    table_offset = count_bytes - sizeof count - count * sizeof entry;
+    if (*pickle_bytes > table_offset - sizeof count)
+        goto invalid;
+    *table = record + table_offset;
+    for (i=0; i<count; i++) {
+        memcpy (entry, *table + i * sizeof entry, sizeof entry);
+        if (entry[0] > table_offset || entry[1] > table_offset - entry[0])
+            goto invalid;
+    }
+    return count;
+
+invalid:
+    PyErr_SetString (PyExc_ValueError, "The oldest record is not from put_object()");
+    return -1;
+}
+
+/* Unpickle the oldest record. The caller holds the read lock. The pickle stream is parsed
+ * in place; the out-of-band buffers are copied into bytearrays, or with @zero_copy are
+ * read-only memoryviews over the ring and the record stays until release_object().
+ */
+static PyObject *
+Buffer_get_object_locked(Buffer *self, int zero_copy)
+{
+    PyObject *pickle_module, *record_object = NULL, *source, *stream = NULL, *buffers = NULL, *result = NULL;
+    unsigned long count_bytes;
+    uint64_t pickle_bytes, entry[2];
+    const char *table;
+    char *record;
+    Py_ssize_t count, i;
+
+    if (zero_copy && ring_buffer_overwrite (self->buffer)) {
+        PyErr_SetString (PyExc_ValueError, "zero_copy needs a buffer without overwrite");
+        return NULL;
+    }
+    if (zero_copy && self->acquired_bytes > 0) {
+        PyErr_SetString (PyExc_BufferError, "release_object() the previous object first");
+        return NULL;
+    }
+    if (ring_buffer_overwrite (self->buffer)) {
+        // a writer may overwrite the record while it is parsed, so take a copy first
+        record_object = Buffer_pop_record(self);
+        if (record_object == NULL)
+            return NULL;
+        record = PyBytes_AS_STRING(record_object);
+        count_bytes = PyBytes_GET_SIZE(record_object);
+        source = PyMemoryView_FromObject(record_object);
+    } else {
+        record = ring_buffer_front_record (self->buffer, &count_bytes); // counts an empty buffer
+        if (record == NULL) {
+            PyErr_SetString (InsufficientDataError, "No record in buffer");
+            return NULL;
+        }
+        source = Buffer_memoryview(self, record, count_bytes, 1);
+    }
+    if (source == NULL)
+        goto done;
+
+    count = Buffer_object_table(record, count_bytes, &pickle_bytes, &table);
+    if (count < 0)
+        goto done;
+    stream = PySequence_GetSlice(source, sizeof pickle_bytes, sizeof pickle_bytes + pickle_bytes);
+    buffers = PyList_New(count);
+    if (stream == NULL || buffers == NULL)
+        goto done;
+    for (i=0; i<count; i++) {
+        PyObject *segment;
+
+        memcpy (entry, table + i * sizeof entry, sizeof entry);
+        if (zero_copy || record_object) {
+            segment = PySequence_GetSlice(source, entry[0], entry[0] + entry[1]);
+        } else {
+            segment = PyByteArray_FromStringAndSize(NULL, entry[1]);
+            if (segment)
+                Buffer_copy(self, PyByteArray_AS_STRING(segment), record + entry[0], entry[1]);
+        }
+        if (segment == NULL)
+            goto done;
+        PyList_SET_ITEM(buffers, i, segment);
+    }
+
+    // pickle.loads(stream, buffers=buffers)
+    pickle_module = PyImport_ImportModule("pickle");
+    if (pickle_module == NULL)
+        goto done;
+    PyObject *loads = PyObject_GetAttrString(pickle_module, "loads");
+    PyObject *loads_args = PyTuple_Pack(1, stream);
+    PyObject *loads_kwargs = Py_BuildValue("{s:O}", "buffers", buffers);
+    if (loads && loads_args && loads_kwargs)
+        result = PyObject_Call(loads, loads_args, loads_kwargs);
+    Py_XDECREF(loads);
+    Py_XDECREF(loads_args);
+    Py_XDECREF(loads_kwargs);
+    Py_DECREF(pickle_module);
+    if (result == NULL || record_object)
+        goto done;
+
+    if (zero_copy)
+        self->acquired_bytes = RING_BUFFER_RECORD_HEADER_BYTES + count_bytes;
+    else
+        ring_buffer_pop_record (self->buffer);
+
+done:
+    Py_XDECREF(buffers);
+    Py_XDECREF(stream);
+    Py_XDECREF(source);
+    Py_XDECREF(record_object);
+    return result;
+}
+
+static PyObject *
+Buffer_get_object(Buffer *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"timeout", "zero_copy", NULL};
+    PyObject *values[2];
+    int zero_copy = 0;
+
+    if (parse_fastcall("get_object", args, nargs, kwnames, kwlist, 0, values) < 0)
+        return NULL;
+    if (values[1] && (zero_copy = PyObject_IsTrue(values[1])) < 0)
+        return NULL;
+
+    PyObject *result = NULL;
+
+    Buffer_lock(self->read_lock);
+    // only Buffer_get_object_locked counts an empty buffer, once
+    if (Buffer_check_read(self) == 0
+        && (ring_buffer_consumer_count_bytes (self->buffer, RING_BUFFER_RECORD_HEADER_BYTES) >= RING_BUFFER_RECORD_HEADER_BYTES
+            || Buffer_wait(self, 1, RING_BUFFER_RECORD_HEADER_BYTES, values[0]) >= 0))
+        result = Buffer_get_object_locked(self, zero_copy);
+    Buffer_auto_reclaim(self, self->write_lock);
+    Buffer_unlock(self->read_lock);
+
+    return result;
+}
+
+static PyObject *
+Buffer_release_object(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    Py_ssize_t count_bytes;
+    int status;
+
+    Buffer_lock(self->read_lock);
+    count_bytes = self->acquired_bytes;
+    if (count_bytes == 0) {
+        Buffer_unlock(self->read_lock);
+        PyErr_SetString (PyExc_ValueError, "No object was read with zero_copy");
+        return NULL;
+    }
+
+    self->acquired_bytes = 0;
+    status = ring_buffer_read_advance (self->buffer, count_bytes);
+    Buffer_unlock(self->read_lock);
+    if (status < 0) {
+        PyErr_SetString (InsufficientDataError, "The object record was overwritten");
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Buffer_resize(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    int order, status;
+    static char *kwlist[] = {"order", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", kwlist, &order))
+        return NULL;
+
+    if (order < 12 || order > 40) {
+        PyErr_SetString (PyExc_ValueError, "order must be between 12 and 40");
+        return NULL;
+    }
+
+    Buffer_lock(self->write_lock);
+    Buffer_lock(self->read_lock);
+    status = Buffer_resize_locked(self, order);
+    if (status == 0)
+        self->min_order = order;
+    Buffer_unlock(self->read_lock);
+    Buffer_unlock(self->write_lock);
+
+    if (status < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Buffer_trim(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    int status;
+
+    Buffer_lock(self->write_lock);
+    status = Buffer_trim_locked(self);
+    Buffer_unlock(self->write_lock);
+
+    if (status < 0)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+Buffer_resident_bytes(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    long resident_bytes = ring_buffer_resident_bytes (self->buffer);
+
+    if (resident_bytes < 0)
+        return PyErr_SetFromErrno(PyExc_OSError);
+    return PyLong_FromLong (resident_bytes);
+}
+
+/* Buffer protocol: export the span prepared by Buffer_memoryview, or else the
+ * readable bytes read-only, so memoryview(buffer) is a zero-copy peek.
+ */
+static int
+Buffer_getbuffer(Buffer *self, Py_buffer *view, int flags)
+{
+    void *address = self->view_address;
+    Py_ssize_t count_bytes = self->view_bytes;
+    int readonly = self->view_readonly;
+
+    // a peek: read the header offsets without touching the consumer's claimed offset,
+    // which a read() running without the GIL may be about to advance from
+    if (address == NULL) {
+        unsigned long read_offset_bytes = __atomic_load_n (&self->buffer->header->read_offset_bytes, __ATOMIC_ACQUIRE);
+
+        address = self->buffer->address + (read_offset_bytes & (self->buffer->count_bytes - 1));
+        count_bytes = __atomic_load_n (&self->buffer->header->write_offset_bytes, __ATOMIC_ACQUIRE) - read_offset_bytes;
+        readonly = 1;
+    }
+
+    if (PyBuffer_FillInfo(view, (PyObject *)self, address, count_bytes, readonly, flags) < 0)
+        return -1;
+
+    // a record array hangs its {shape, stride} off view->internal until the view is released
+    if (self->view_records && (flags & PyBUF_ND)) {
+        Py_ssize_t *shape = PyMem_New(Py_ssize_t, 2);
+        const char *format = PyUnicode_AsUTF8(self->record_format);
+
+        if (shape == NULL || format == NULL) {
+            PyMem_Free(shape);
+            Py_CLEAR(view->obj);
+            if (!PyErr_Occurred())
+                PyErr_NoMemory();
+            return -1;
+        }
+        shape[0] = count_bytes / self->record_bytes;
+        shape[1] = self->record_bytes;
+        view->internal = shape;
+        view->ndim = 1;
+        view->itemsize = self->record_bytes;
+        view->format = (flags & PyBUF_FORMAT) ? (char *)format : NULL;
+        view->shape = &shape[0];
+        view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? &shape[1] : NULL;
+    }
+
+    self->exports++;
+    return 0;
+}
+
+static void
+Buffer_releasebuffer(Buffer *self, Py_buffer *view)
+{
+    PyMem_Free(view->internal);
+    self->exports--;
+}
+
+static PyBufferProcs Buffer_buffer_procs = {
+    (getbufferproc)Buffer_getbuffer,      /* bf_getbuffer */
+    (releasebufferproc)Buffer_releasebuffer, /* bf_releasebuffer */
+};
+
+/* Create the eventfds on first use so buffers nobody polls pay nothing for them. */
+static int
+Buffer_enable_eventfd(Buffer *self)
+{
+    if (ring_buffer_enable_eventfd (self->buffer)) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+Buffer_readable_fileno(Buffer *self)
+{
+    if (Buffer_enable_eventfd(self) < 0)
+        return NULL;
+    return PyLong_FromLong (self->buffer->readable_fd);
+}
+
+static PyObject *
+Buffer_writable_fileno(Buffer *self)
+{
+    if (Buffer_enable_eventfd(self) < 0)
+        return NULL;
+    return PyLong_FromLong (self->buffer->writable_fd);
+}
+
+static PyObject *
+Buffer_get_readable_mark(Buffer *self, void *closure)
+{
+    return PyLong_FromSize_t (self->buffer->readable_mark_bytes);
+}
+
+static int
+Buffer_set_readable_mark(Buffer *self, PyObject *value, void *closure)
+{
+    long count_bytes = value ? PyLong_AsLong (value) : -1;
+
+    if (count_bytes == -1 && PyErr_Occurred())
+        return -1;
+    if (count_bytes < 1) {
+        PyErr_SetString (PyExc_ValueError, "readable_mark must be at least 1");
+        return -1;
+    }
+    ring_buffer_set_readable_mark (self->buffer, count_bytes);
+    return 0;
+}
+
+static PyObject *
+Buffer_get_writable_mark(Buffer *self, void *closure)
+{
+    return PyLong_FromSize_t (self->buffer->writable_mark_bytes);
+}
+
+static int
+Buffer_set_writable_mark(Buffer *self, PyObject *value, void *closure)
+{
+    long count_bytes = value ? PyLong_AsLong (value) : -1;
+
+    if (count_bytes == -1 && PyErr_Occurred())
+        return -1;
+    if (count_bytes < 1) {
+        PyErr_SetString (PyExc_ValueError, "writable_mark must be at least 1");
+        return -1;
+    }
+    ring_buffer_set_writable_mark (self->buffer, count_bytes);
+    return 0;
+}
+
+static Py_ssize_t
+Buffer_len(Buffer* self)
+{
+    return ring_buffer_count_bytes (self->buffer);
+}
+
+static PySequenceMethods Buffer_sequence_methods = {
+    (lenfunc)Buffer_len     /* sq_length */
+};
+
+static PyMemberDef Buffer_members[] = {
+    {"order", T_INT, offsetof(Buffer, order), READONLY,
+     "size of ring buffer represented by log2; resize() changes it"},
+    {"gil_release_threshold", T_PYSSIZET, offsetof(Buffer, gil_release_threshold), 0,
+     "copies of at least this many bytes let other threads run"},
+    {"shrink_after", T_DOUBLE, offsetof(Buffer, shrink_after), 0,
+     "seconds a grown buffer stays a quarter full or less before it halves"},
+    {"trim_after", T_DOUBLE, offsetof(Buffer, trim_after), 0,
+     "seconds at most trim_below bytes stay readable before the free pages go back; negative never"},
+    {"trim_below", T_PYSSIZET, offsetof(Buffer, trim_below), 0,
+     "readable bytes at or under which the buffer counts as idle for trim_after"},
+    {NULL} /* Sentinel */
+};
+
+static PyObject *
+Buffer_get_writer_closed(Buffer *self, void *closure)
+{
+    return PyBool_FromLong (ring_buffer_write_closed (self->buffer));
+}
+
+static PyObject *
+Buffer_get_page_size(Buffer *self, void *closure)
+{
+    return PyLong_FromLong (self->buffer->page_size);
+}
+
+static PyObject *
+Buffer_get_overwrite(Buffer *self, void *closure)
+{
+    return PyBool_FromLong (ring_buffer_overwrite (self->buffer));
+}
+
+static PyObject *
+Buffer_get_dropped_bytes(Buffer *self, void *closure)
+{
+    return PyLong_FromUnsignedLong (ring_buffer_dropped_bytes (self->buffer));
+}
+
+static PyObject *
+Buffer_get_dropped_records(Buffer *self, void *closure)
+{
+    return PyLong_FromUnsignedLong (ring_buffer_dropped_records (self->buffer));
+}
+
+static PyObject *
+Buffer_get_generation(Buffer *self, void *closure)
+{
+    return PyLong_FromUnsignedLong (ring_buffer_generation (self->buffer));
+}
+
+static PyObject *
+Buffer_get_record_format(Buffer *self, void *closure)
+{
+    PyObject *record_format = self->record_format ? self->record_format : Py_None;
+
+    Py_INCREF(record_format);
+    return record_format;
+}
+
+static PyObject *
+Buffer_get_record_size(Buffer *self, void *closure)
+{
+    return PyLong_FromSsize_t (self->record_bytes);
+}
+
+static PyObject *
+Buffer_get_max_order(Buffer *self, void *closure)
+{
+    return PyLong_FromLong (self->max_order);
+}
+
+static int
+Buffer_set_max_order(Buffer *self, PyObject *value, void *closure)
+{
+    int max_order;
+
+    if (value == NULL) {
+        PyErr_SetString (PyExc_AttributeError, "Cannot delete max_order");
+        return -1;
+    }
+    max_order = PyLong_AsLong (value);
+    if (max_order == -1 && PyErr_Occurred())
+        return -1;
+    if (Buffer_check_max_order(self, max_order) < 0)
+        return -1;
+    self->max_order = max_order;
+    return 0;
+}
+
+static PyGetSetDef Buffer_getset[] = {
+    {"max_order", (getter)Buffer_get_max_order, (setter)Buffer_set_max_order,
+     "writes that do not fit grow the buffer up to this order; 0 never grows it", NULL},
+    {"readable_mark", (getter)Buffer_get_readable_mark, (setter)Buffer_set_readable_mark,
+     "readable_fileno() is signalled when the readable bytes rise to this", NULL},
+    {"writable_mark", (getter)Buffer_get_writable_mark, (setter)Buffer_set_writable_mark,
+     "writable_fileno() is signalled when the free bytes rise to this", NULL},
+    {"page_size", (getter)Buffer_get_page_size, NULL,
+     "size of the pages backing the data, to check whether huge_pages took effect", NULL},
+    {"writer_closed", (getter)Buffer_get_writer_closed, NULL,
+     "True once the writer called close(), in this or another process", NULL},
+    {"overwrite", (getter)Buffer_get_overwrite, NULL,
+     "True when writes that do not fit discard the oldest data instead of failing", NULL},
+    {"dropped_bytes", (getter)Buffer_get_dropped_bytes, NULL,
+     "bytes discarded by overwrite mode, records included", NULL},
+    {"dropped_records", (getter)Buffer_get_dropped_records, NULL,
+     "whole records discarded by overwrite mode", NULL},
+    {"generation", (getter)Buffer_get_generation, NULL,
+     "number of syncs of a file-backed buffer, 0 for other buffers", NULL},
+    {"record_format", (getter)Buffer_get_record_format, (setter)Buffer_set_record_format,
+     "struct format of the fixed-size records read_array() and write_array() handle, or None", NULL},
+    {"record_size", (getter)Buffer_get_record_size, NULL,
+     "bytes per record_format record, 0 without one", NULL},
+    {NULL} /* Sentinel */
+};
+
+/* A broadcast reader: a named cursor over a Buffer, see ring_buffer_cursor_open. It keeps
+ * the Buffer alive and has a lock of its own, so readers of different cursors copy
+ * concurrently.
+ */
+typedef struct {
+    PyObject_HEAD
+    Buffer *owner;
+    int cursor; // -1 once closed
+    PyThread_type_lock lock;
+} Reader;
+
+static void
+Reader_dealloc(Reader* self)
+{
+    // the cursor stays open, so a reader of the same name resumes where this one stopped
+    if (self->lock)
+        PyThread_free_lock (self->lock);
+    Py_XDECREF(self->owner);
+    Py_TYPE(self)->tp_free ((PyObject*) self);
+}
+
+static int
+Reader_check(Reader *self)
+{
+    if (self->cursor < 0) {
+        PyErr_SetString (PyExc_ValueError, "reader is closed");
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+Reader_read(Reader *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"length", "timeout", NULL};
+    Buffer *owner = self->owner;
+    PyObject *values[2], *timeout;
+    Py_ssize_t count_bytes;
+
+    if (parse_fastcall("read", args, nargs, kwnames, kwlist, 1, values) < 0
+        || (count_bytes = parse_length(values[0], "length")) < 0)
+        return NULL;
+    if (Reader_check(self) < 0)
+        return NULL;
+    timeout = values[1];
+
+    PyObject *datagram = PyBytes_FromStringAndSize(NULL, count_bytes);
+    if (datagram == NULL)
+        return NULL;
+
+    Buffer_lock(self->lock);
+    do {
+        if (ring_buffer_cursor_count_bytes (owner->buffer, self->cursor) < (unsigned long)count_bytes
+            && Buffer_wait_cursor(owner, self->cursor, 1, count_bytes, timeout) < 0) {
+            Buffer_unlock(self->lock);
+            Py_DECREF(datagram);
+            return NULL;
+        }
+        if (ring_buffer_cursor_count_bytes (owner->buffer, self->cursor) < (unsigned long)count_bytes) {
+            __atomic_add_fetch (&owner->buffer->consumer_stats.empty, 1, __ATOMIC_RELAXED); // readers of other cursors hold other locks
+            Buffer_unlock(self->lock);
+            Py_DECREF(datagram);
+            PyErr_SetString(InsufficientDataError, "Not enough data to read from");
+            return NULL;
+        }
+
+        Buffer_copy(owner, PyBytes_AS_STRING(datagram), ring_buffer_cursor_read_address (owner->buffer, self->cursor), count_bytes);
+    } while (ring_buffer_cursor_read_advance (owner->buffer, self->cursor, count_bytes) < 0); // overwritten meanwhile
+    Buffer_unlock(self->lock);
+
+    return datagram;
+}
+
+static PyObject *
+Reader_peek_read(Reader *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char *const kwlist[] = {"length", NULL};
+    Buffer *owner = self->owner;
+    PyObject *values[1];
+    Py_ssize_t count_bytes;
+
+    if (parse_fastcall("peek_read", args, nargs, kwnames, kwlist, 1, values) < 0
+        || (count_bytes = parse_length(values[0], "length")) < 0)
+        return NULL;
+    if (Reader_check(self) < 0)
+        return NULL;
+
+    Buffer_lock(self->lock);
+    if (ring_buffer_cursor_count_bytes (owner->buffer, self->cursor) < (unsigned long)count_bytes) {
+        __atomic_add_fetch (&owner->buffer->consumer_stats.empty, 1, __ATOMIC_RELAXED);
+        Buffer_unlock(self->lock);
+        PyErr_SetString (InsufficientDataError, "Not enough data to read from");
+        return NULL;
+    }
+
+    PyObject *datagram = PyBytes_FromStringAndSize(NULL, count_bytes);
+    if (datagram != NULL)
+        Buffer_copy(owner, PyBytes_AS_STRING(datagram), ring_buffer_cursor_read_address (owner->buffer, self->cursor), count_bytes);
+    Buffer_unlock(self->lock);
+
+    return datagram;
+}
+
+static PyObject *
+Reader_close(Reader *self)
+{
+    if (self->cursor >= 0) {
+        ring_buffer_cursor_close (self->owner->buffer, self->cursor);
+        self->cursor = -1;
+    }
+    Py_RETURN_NONE;
+}
+
+static Py_ssize_t
+Reader_len(Reader *self)
+{
+    if (Reader_check(self) < 0)
+        return -1;
+    return ring_buffer_cursor_count_bytes (self->owner->buffer, self->cursor);
+}
+
+static PyObject *
+Reader_get_name(Reader *self, void *closure)
+{
+    if (Reader_check(self) < 0)
+        return NULL;
+    return PyUnicode_FromString (self->owner->buffer->header->cursors[self->cursor].name);
+}
+
+static PyObject *
+Reader_get_dropped_bytes(Reader *self, void *closure)
+{
+    if (Reader_check(self) < 0)
+        return NULL;
+    return PyLong_FromUnsignedLong (self->owner->buffer->header->cursors[self->cursor].dropped_bytes);
+}
+
+static PySequenceMethods Reader_sequence_methods = {
+    (lenfunc)Reader_len,       /* sq_length */
+};
+
+static PyGetSetDef Reader_getset[] = {
+    {"name", (getter)Reader_get_name, NULL,
+     "name of the cursor, shared by every reader that opened it", NULL},
+    {"dropped_bytes", (getter)Reader_get_dropped_bytes, NULL,
+     "bytes an overwriting writer discarded before this cursor read them", NULL},
+    {NULL} /* Sentinel */
+};
+
+static PyMethodDef Reader_methods[] = {
+    {"read", (PyCFunction)(void(*)(void))Reader_read, METH_FASTCALL | METH_KEYWORDS,
+     "Read a certain amount of bytes at this cursor, waiting up to timeout seconds for them"},
+    {"peek_read", (PyCFunction)(void(*)(void))Reader_peek_read, METH_FASTCALL | METH_KEYWORDS,
+     "Read data without advancing this cursor"},
+    {"close", (PyCFunction)Reader_close, METH_NOARGS,
+     "Close the cursor for every reader of its name and stop holding back the writer"},
+    {NULL} /* Sentinel */
+};
+
+static PyTypeObject buffer_ReaderType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "ring_buffer.Reader",      /*tp_name*/
+    sizeof(Reader),            /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)Reader_dealloc, /*tp_dealloc*/
+    0,                         /*tp_vectorcall_offset*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_as_async*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &Reader_sequence_methods,  /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "ring_buffer.Reader objects: a named read cursor of a broadcast buffer, from Buffer.reader()", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    Reader_methods,            /* tp_methods */
+    0,                         /* tp_members */
+    Reader_getset,             /* tp_getset */
+};
+
+static PyObject *
+Buffer_reader(Buffer *self, PyObject *args, PyObject *kwargs)
+{
+    const char *name;
+    static char *kwlist[] = {"name", NULL};
+    Reader *reader;
+    int cursor;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &name))
+        return NULL;
+
+    // everything that can fail comes first, so an open cursor always has its Reader
+    reader = PyObject_New(Reader, &buffer_ReaderType);
+    if (reader == NULL)
+        return NULL;
+    reader->cursor = -1;
+    Py_INCREF(self);
+    reader->owner = self;
+    reader->lock = PyThread_allocate_lock();
+    if (reader->lock == NULL) {
+        Py_DECREF(reader);
+        return PyErr_NoMemory();
+    }
+
+    cursor = ring_buffer_cursor_open (self->buffer, name);
+    if (cursor < 0) {
+        if (errno == EINVAL)
+            PyErr_SetString (PyExc_ValueError, "reader name must be 1 to 39 bytes");
+        else
+            PyErr_SetFromErrno(PyExc_OSError);
+        Py_DECREF(reader);
+        return NULL;
+    }
+    reader->cursor = cursor;
+    return (PyObject *)reader;
+}
+
+static PyMethodDef Buffer_methods[] = {
+    {"write", (PyCFunction)(void(*)(void))Buffer_write, METH_FASTCALL | METH_KEYWORDS,
+     "Write a bytearray to the ring buffer, waiting up to timeout seconds for room"},
+    {"read", (PyCFunction)(void(*)(void))Buffer_read, METH_FASTCALL | METH_KEYWORDS,
+     "Read a certain amount of bytes from the buffer, waiting up to timeout seconds for them"},
+    {"push", (PyCFunction)(void(*)(void))Buffer_push, METH_FASTCALL | METH_KEYWORDS,
+     "Append data as one length-prefixed record, waiting up to timeout seconds for room"},
+    {"pop", (PyCFunction)(void(*)(void))Buffer_pop, METH_FASTCALL | METH_KEYWORDS,
+     "Remove and return the oldest record, waiting up to timeout seconds for one"},
+    {"pop_many", (PyCFunction)Buffer_pop_many, METH_VARARGS | METH_KEYWORDS,
+     "Remove and return a list of up to max_records records"},
+    {"write_many", (PyCFunction)Buffer_write_many, METH_VARARGS | METH_KEYWORDS,
+     "Write every string in pieces back to back, or none of them if they do not all fit"},
+    {"read_into", (PyCFunction)(void(*)(void))Buffer_read_into, METH_FASTCALL | METH_KEYWORDS,
+     "Read up to nbytes (default len(buffer)) into a writable buffer, return the count"},
+    {"recv_from", (PyCFunction)Buffer_recv_from, METH_VARARGS | METH_KEYWORDS,
+     "read(2) up to max_bytes from fd (an int or an object with fileno()) straight into the "
+     "buffer without the GIL; return the count, 0 at end of file"},
+    {"send_to", (PyCFunction)Buffer_send_to, METH_VARARGS | METH_KEYWORDS,
+     "write(2) up to max_bytes from the buffer straight to fd without the GIL; return the count"},
+    {"wait_readable", (PyCFunction)Buffer_wait_readable, METH_VARARGS | METH_KEYWORDS,
+     "Wait up to timeout seconds until min_bytes are readable or the writer closed"},
+    {"wait_writable", (PyCFunction)Buffer_wait_writable, METH_VARARGS | METH_KEYWORDS,
+     "Wait up to timeout seconds until min_bytes can be written"},
+    {"close", (PyCFunction)Buffer_close, METH_NOARGS,
+     "Signal that the writing is done"},
+    {"eof", (PyCFunction)Buffer_eof, METH_NOARGS,
+     "Signal that end-of-file is reached"},
+    {"find", (PyCFunction)Buffer_find, METH_VARARGS | METH_KEYWORDS,
+     "Return the offset of the first delimiter in the readable bytes, or -1"},
+    {"read_until", (PyCFunction)Buffer_read_until, METH_VARARGS | METH_KEYWORDS,
+     "Read up to and including delimiter, waiting up to timeout seconds for it; the rest once the writer closed"},
+    {"readline", (PyCFunction)Buffer_readline, METH_VARARGS | METH_KEYWORDS,
+     "read_until(b'\\n')"},
+    {"iter_lines", (PyCFunction)Buffer_iter_lines, METH_VARARGS | METH_KEYWORDS,
+     "Consume the complete lines readable now, up to max_lines, and iterate over them"},
+    {"peek_read", (PyCFunction)(void(*)(void))Buffer_peek_read, METH_FASTCALL | METH_KEYWORDS,
+     "Read data without advancing the read pointer"},
+    {"read_piece", (PyCFunction)Buffer_read_piece, METH_NOARGS,
+     "Read a piece of buffer data efficiently"},
+    {"create_shared", (PyCFunction)Buffer_create_shared, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Create a buffer in POSIX shared memory under name, e.g. '/capture'"},
+    {"open_shared", (PyCFunction)Buffer_open_shared, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Attach the shared buffer another process created under name"},
+    {"open_file", (PyCFunction)Buffer_open_file, METH_VARARGS | METH_KEYWORDS | METH_CLASS,
+     "Open or create a buffer backed by the file at path, resuming from its last sync"},
+    {"resize", (PyCFunction)Buffer_resize, METH_VARARGS | METH_KEYWORDS,
+     "Change the capacity to 2**order bytes, keeping the readable bytes; not for shared or file-backed buffers"},
+    {"trim", (PyCFunction)Buffer_trim, METH_NOARGS,
+     "Give the pages that hold no readable byte back to the system; on a shared buffer, only from the writing process"},
+    {"resident_bytes", (PyCFunction)Buffer_resident_bytes, METH_NOARGS,
+     "Return how many bytes of the data are in memory"},
+    {"submit_recv", (PyCFunction)Buffer_submit_recv, METH_VARARGS | METH_KEYWORDS,
+     "Queue a read from fd straight into the free bytes; poll_completions() reports and publishes it"},
+    {"submit_send", (PyCFunction)Buffer_submit_send, METH_VARARGS | METH_KEYWORDS,
+     "Queue a write of the readable bytes to fd; poll_completions() reports and consumes it"},
+    {"reader", (PyCFunction)Buffer_reader, METH_VARARGS | METH_KEYWORDS,
+     "Open or resume the broadcast cursor called name; every reader sees every byte"},
+    {"sync", (PyCFunction)Buffer_sync, METH_NOARGS,
+     "Make a file-backed buffer durable up to now; a no-op for other buffers"},
+    {"fileno", (PyCFunction)Buffer_readable_fileno, METH_NOARGS,
+     "Same as readable_fileno(), for select/epoll"},
+    {"readable_fileno", (PyCFunction)Buffer_readable_fileno, METH_NOARGS,
+     "Edge-triggered eventfd signalled when data becomes readable or the writer closes"},
+    {"writable_fileno", (PyCFunction)Buffer_writable_fileno, METH_NOARGS,
+     "Edge-triggered eventfd signalled when space becomes free"},
+    {"stats", (PyCFunction)Buffer_stats, METH_NOARGS,
+     "Return a dict of this process' counters for the buffer, with latency_ns once timestamps are on"},
+    {"reset_stats", (PyCFunction)Buffer_reset_stats, METH_NOARGS,
+     "Zero the counters and the latency histogram"},
+    {"enable_timestamps", (PyCFunction)Buffer_enable_timestamps, METH_NOARGS,
+     "Sample how long written bytes wait until they are read into stats()['latency_ns']"},
+    {"snapshot", (PyCFunction)Buffer_snapshot, METH_VARARGS | METH_KEYWORDS,
+     "Copy the readable bytes, or with records=True the readable records, without consuming them"},
+    {"put_object", (PyCFunction)(void(*)(void))Buffer_put_object, METH_FASTCALL | METH_KEYWORDS,
+     "Pickle obj (protocol 5) straight into the buffer as one record, out-of-band buffers included, waiting up to timeout seconds for room"},
+    {"get_object", (PyCFunction)(void(*)(void))Buffer_get_object, METH_FASTCALL | METH_KEYWORDS,
+     "Unpickle the oldest put_object() record, waiting up to timeout seconds for one; with zero_copy, "
+     "out-of-band buffers are read-only views over the buffer and release_object() consumes the record"},
+    {"release_object", (PyCFunction)Buffer_release_object, METH_NOARGS,
+     "Consume the record of the last get_object(zero_copy=True)"},
+    {"reserve", (PyCFunction)Buffer_reserve, METH_VARARGS | METH_KEYWORDS,
+     "Return a writable memoryview over the next length free bytes; the reserving thread commits"},
+    {"commit", (PyCFunction)Buffer_commit, METH_VARARGS | METH_KEYWORDS,
+     "Publish length bytes written into the reserved memoryview"},
+    {"acquire", (PyCFunction)Buffer_acquire, METH_VARARGS | METH_KEYWORDS,
+     "Return a read-only memoryview over the next length readable bytes; the acquiring thread releases"},
+    {"read_array", (PyCFunction)Buffer_read_array, METH_VARARGS | METH_KEYWORDS,
+     "Return up to max_records readable records as a read-only record_format memoryview, without copying; release_array() consumes them"},
+    {"release_array", (PyCFunction)Buffer_release_array, METH_VARARGS | METH_KEYWORDS,
+     "Consume count records of the last read_array() view"},
+    {"write_array", (PyCFunction)Buffer_write_array, METH_VARARGS | METH_KEYWORDS,
+     "Write a block of record_format records in one copy, waiting up to timeout seconds for room"},
+    {"release", (PyCFunction)Buffer_release, METH_VARARGS | METH_KEYWORDS,
+     "Discard length bytes of the acquired memoryview"},
+    {NULL} /* Sentinel */
+};
+
+static PyTypeObject buffer_BufferType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "ring_buffer.Buffer",           /*tp_name: textual representation and show up in error messages*/
+    sizeof(Buffer),            /*tp_basicsize: how much to allocate when PyObject_New() is called*/
+    0,                         /*tp_itemsize*/
+    (destructor)Buffer_dealloc,/*tp_dealloc*/
+    0,                         /*tp_vectorcall_offset*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_as_async*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &Buffer_sequence_methods,    /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    &Buffer_buffer_procs,      /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    "ring_buffer.Buffer objects",          /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    Buffer_methods,            /* tp_methods */
+    Buffer_members,            /* tp_members */
+    Buffer_getset,             /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)Buffer_init,     /* tp_init */
+    0,                         /* tp_alloc */
+    Buffer_new,                /* tp_new */
+};
+
+
+typedef struct {
+    PyObject_HEAD
+    struct mpmc_queue *queue;
+    int order;
+    int max_record_bytes;
+} MPMCQueue;
+
+static void
+MPMCQueue_dealloc(MPMCQueue* self)
+{
+    mpmc_queue_free (self->queue);
+    free (self->queue);
+    Py_TYPE(self)->tp_free ((PyObject*) self);
 }
 
 static int
-Buffer_init(Buffer *self, PyObject *args, PyObject *kwargs)
+MPMCQueue_init(MPMCQueue *self, PyObject *args, PyObject *kwargs)
 {
-    static char *kwlist[] = {"order", NULL};
+    static char *kwlist[] = {"order", "max_record_bytes", NULL};
 
-    if ( !PyArg_ParseTupleAndKeywords(args, kwargs, "|i", kwlist, &self->order) ) {
+    if (self->queue != NULL) {
+        PyErr_SetString (PyExc_RuntimeError, "MPMCQueue is already initialized");
         return -1;
     }
-
-    if (self->order == 0) {
-        self->order = 12; // the ring buffer size defaults to 4KB
+    self->order = 10;
+    self->max_record_bytes = 256;
+    if ( !PyArg_ParseTupleAndKeywords(args, kwargs, "|ii", kwlist, &self->order, &self->max_record_bytes) ) {
+        return -1;
     }
 
-    if (self->order < 12) {
-        PyErr_SetString (PyExc_ValueError, "Order is too small, which has to be at least 12");
-        return NULL;
+    if (self->order < 1 || self->order > 30 || self->max_record_bytes < 0) {
+        PyErr_SetString (PyExc_ValueError, "order must be between 1 and 30 and max_record_bytes non-negative");
+        return -1;
     }
 
-    self->buffer = malloc(sizeof *self->buffer);
-    ring_buffer_create (self->buffer, self->order);
+    // struct mpmc_queue is cache-line aligned, plain malloc only guarantees 16 bytes
+    if (posix_memalign((void **)&self->queue, RING_BUFFER_CACHE_LINE_BYTES, sizeof *self->queue)) {
+        self->queue = NULL;
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (mpmc_queue_create (self->queue, self->order, self->max_record_bytes)) {
+        free (self->queue);
+        self->queue = NULL;
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
 
     return 0;
 }
 
+/* Return 1 if pushed, 0 if full, -1 with an exception set if @data cannot be a record. */
+static int
+MPMCQueue_try_push_data(MPMCQueue *self, PyObject *data)
+{
+    Py_buffer view;
+    int status;
+
+    if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) < 0)
+        return -1;
+    if (view.len > self->max_record_bytes) {
+        PyBuffer_Release(&view);
+        PyErr_SetString (PyExc_ValueError, "record is larger than max_record_bytes");
+        return -1;
+    }
+    status = mpmc_queue_try_push (self->queue, view.buf, view.len) == 0;
+    PyBuffer_Release(&view);
+    return status;
+}
+
 static PyObject *
-Buffer_write(Buffer *self, PyObject *args, PyObject *kwargs)
+MPMCQueue_try_push(MPMCQueue *self, PyObject *data)
 {
-    char *data;
-    int count_bytes;
-    static char *kwlist[] = {"data", NULL};
+    int status = MPMCQueue_try_push_data(self, data);
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#", kwlist, &data, &count_bytes))
+    if (status < 0)
         return NULL;
+    return PyBool_FromLong (status);
+}
 
-    if (self->closed) {
-        PyErr_SetString (PyExc_ValueError, "I/O operation on closed file");
+static PyObject *
+MPMCQueue_push(MPMCQueue *self, PyObject *data)
+{
+    int status = MPMCQueue_try_push_data(self, data);
+
+    if (status < 0)
         return NULL;
-    }
-    int available_bytes = ring_buffer_count_free_bytes (self->buffer);
-    if (available_bytes < count_bytes) {
-        PyErr_SetString(FullError, "Not enough free bytes to write");
+    if (status == 0) {
+        PyErr_SetString(FullError, "Queue is full");
         return NULL;
     }
+    Py_RETURN_NONE;
+}
+
+/* Pop up to @count records into a new list, which is empty if the queue is. */
+static PyObject *
+MPMCQueue_pop_records(MPMCQueue *self, int count)
+{
+    PyObject *records;
+    struct iovec *iov;
+    int i, popped;
+
+    records = PyList_New(count);
+    iov = PyMem_New(struct iovec, count);
+    if (records == NULL || iov == NULL) {
+        Py_XDECREF(records);
+        PyMem_Free(iov);
+        return PyErr_NoMemory();
+    }
+
+    for (i = 0; i < count; i++) {
+        PyObject *record = PyBytes_FromStringAndSize(NULL, self->max_record_bytes);
+        if (record == NULL) {
+            Py_DECREF(records);
+            PyMem_Free(iov);
+            return NULL;
+        }
+        PyList_SET_ITEM(records, i, record);
+        iov[i].iov_base = PyBytes_AS_STRING(record);
+    }
 
-    ring_buffer_write (self->buffer, data, count_bytes);
+    popped = mpmc_queue_try_pop_many (self->queue, iov, count);
+    for (i = 0; i < popped; i++) {
+        PyObject *record = PyList_GET_ITEM(records, i);
+        // the list holds the only reference, so the string can still be resized in place
+        PyList_SET_ITEM(records, i, NULL);
+        if (_PyBytes_Resize(&record, iov[i].iov_len) < 0) {
+            Py_DECREF(records);
+            PyMem_Free(iov);
+            return NULL;
+        }
+        PyList_SET_ITEM(records, i, record);
+    }
+    PyMem_Free(iov);
 
-    return Py_None;
+    if (PyList_SetSlice(records, popped, count, NULL) < 0) {
+        Py_DECREF(records);
+        return NULL;
+    }
+    return records;
 }
 
-static PyObject * 
-Buffer_close(Buffer *self, PyObject *args, PyObject *kwargs)
+static PyObject *
+MPMCQueue_try_pop(MPMCQueue *self)
 {
-    ring_buffer_write_close (self->buffer);
-    self->closed = 1;
+    PyObject *records = MPMCQueue_pop_records(self, 1);
+    PyObject *record;
 
-    return Py_None;
+    if (records == NULL)
+        return NULL;
+    if (PyList_GET_SIZE(records) == 0) {
+        Py_DECREF(records);
+        Py_RETURN_NONE;
+    }
+    record = PyList_GET_ITEM(records, 0);
+    Py_INCREF(record);
+    Py_DECREF(records);
+    return record;
 }
 
 static PyObject *
-Buffer_eof(Buffer *self, PyObject *args, PyObject *kwargs)
+MPMCQueue_pop(MPMCQueue *self)
 {
-    if ( self->closed && ring_buffer_eof(self->buffer) )
-        return Py_True;
-    return Py_False;
+    PyObject *record = MPMCQueue_try_pop(self);
+
+    if (record == Py_None) {
+        Py_DECREF(record);
+        PyErr_SetString (InsufficientDataError, "Queue is empty");
+        return NULL;
+    }
+    return record;
 }
 
 static PyObject *
-Buffer_read(Buffer *self, PyObject *args, PyObject *kwargs)
+MPMCQueue_push_many(MPMCQueue *self, PyObject *args, PyObject *kwargs)
 {
-    int count_bytes;
-    char *kwlist[] = {"length", NULL};
+    PyObject *iterable, *sequence;
+    PyObject *result = NULL;
+    static char *kwlist[] = {"records", NULL};
+    Py_buffer *views;
+    struct iovec *iov;
+    Py_ssize_t i, count = 0;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", kwlist, &count_bytes))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", kwlist, &iterable))
         return NULL;
 
-    int bytes_available_for_read = ring_buffer_count_bytes (self->buffer);
-    if (bytes_available_for_read < count_bytes) {
-        PyErr_SetString(InsufficientDataError, "Not enough data to read from");
+    sequence = PySequence_Fast(iterable, "push_many() expects an iterable of strings");
+    if (sequence == NULL)
         return NULL;
+
+    views = PyMem_New(Py_buffer, PySequence_Fast_GET_SIZE(sequence));
+    iov = PyMem_New(struct iovec, PySequence_Fast_GET_SIZE(sequence));
+    if (views == NULL || iov == NULL) {
+        PyErr_NoMemory();
+        goto done;
     }
 
-    PyObject *datagram = PyString_FromStringAndSize(NULL, count_bytes);
-    ring_buffer_read (self->buffer, PyString_AsString(datagram), count_bytes);
-    return datagram;
+    for (count = 0; count < PySequence_Fast_GET_SIZE(sequence); count++) {
+        if (PyObject_GetBuffer(PySequence_Fast_GET_ITEM(sequence, count), &views[count], PyBUF_SIMPLE) < 0)
+            goto done;
+        if (views[count].len > self->max_record_bytes) {
+            PyBuffer_Release(&views[count]);
+            PyErr_SetString (PyExc_ValueError, "record is larger than max_record_bytes");
+            goto done;
+        }
+        iov[count].iov_base = views[count].buf;
+        iov[count].iov_len = views[count].len;
+    }
+
+    result = PyLong_FromLong (mpmc_queue_try_push_many (self->queue, iov, count));
+
+done:
+    for (i = 0; i < count; i++)
+        PyBuffer_Release(&views[i]);
+    PyMem_Free(views);
+    PyMem_Free(iov);
+    Py_DECREF(sequence);
+    return result;
 }
 
 static PyObject *
-Buffer_peek_read(Buffer *self, PyObject *args, PyObject *kwargs)
+MPMCQueue_pop_many(MPMCQueue *self, PyObject *args, PyObject *kwargs)
 {
-    int count_bytes;
-    char *kwlist[] = {"length", NULL};
+    Py_ssize_t max_records = -1;
+    static char *kwlist[] = {"max_records", NULL};
+    unsigned long count;
 
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "i", kwlist, &count_bytes))
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n", kwlist, &max_records))
         return NULL;
 
-    int bytes_available_for_read = ring_buffer_count_bytes (self->buffer);
-    if (bytes_available_for_read < count_bytes) {
-        PyErr_SetString (InsufficientDataError, "Not enough data to read from");
+    // never allocate more strings than there can be records
+    count = mpmc_queue_count (self->queue);
+    if (max_records >= 0 && (unsigned long)max_records < count)
+        count = max_records;
+    return MPMCQueue_pop_records(self, count);
+}
+
+static Py_ssize_t
+MPMCQueue_len(MPMCQueue* self)
+{
+    return mpmc_queue_count (self->queue);
+}
+
+static PySequenceMethods MPMCQueue_sequence_methods = {
+    (lenfunc)MPMCQueue_len     /* sq_length */
+};
+
+static PyMemberDef MPMCQueue_members[] = {
+    {"order", T_INT, offsetof(MPMCQueue, order), READONLY,
+     "number of slots represented by log2"},
+    {"max_record_bytes", T_INT, offsetof(MPMCQueue, max_record_bytes), READONLY,
+     "largest record a slot holds"},
+    {NULL} /* Sentinel */
+};
+
+static PyMethodDef MPMCQueue_methods[] = {
+    {"push", (PyCFunction)MPMCQueue_push, METH_O,
+     "Append a record, raising FullError when the queue is full"},
+    {"try_push", (PyCFunction)MPMCQueue_try_push, METH_O,
+     "Append a record, returning False when the queue is full"},
+    {"pop", (PyCFunction)MPMCQueue_pop, METH_NOARGS,
+     "Remove and return the oldest record, raising InsufficientDataError when empty"},
+    {"try_pop", (PyCFunction)MPMCQueue_try_pop, METH_NOARGS,
+     "Remove and return the oldest record, or None when empty"},
+    {"push_many", (PyCFunction)MPMCQueue_push_many, METH_VARARGS | METH_KEYWORDS,
+     "Append records in order while they fit, return how many were appended"},
+    {"pop_many", (PyCFunction)MPMCQueue_pop_many, METH_VARARGS | METH_KEYWORDS,
+     "Remove and return a list of up to max_records records"},
+    {NULL} /* Sentinel */
+};
+
+static PyTypeObject buffer_MPMCQueueType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "ring_buffer.MPMCQueue",   /*tp_name*/
+    sizeof(MPMCQueue),         /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)MPMCQueue_dealloc, /*tp_dealloc*/
+    0,                         /*tp_vectorcall_offset*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_as_async*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    &MPMCQueue_sequence_methods, /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
+    "ring_buffer.MPMCQueue objects: a lock-free bounded queue of records for many producers and consumers", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    MPMCQueue_methods,         /* tp_methods */
+    MPMCQueue_members,         /* tp_members */
+    0,                         /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    (initproc)MPMCQueue_init,  /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+};
+
+/* A stack of cleared rings of one order, so that a new Buffer is a pointer pop rather
+ * than a memfd and three mmaps, and a dead one a pointer push rather than a munmap. The
+ * GIL guards it: rings come off in acquire() and go back when their Buffer is freed.
+ */
+typedef struct {
+    PyObject_HEAD
+    int order;
+    Py_ssize_t max_cached;
+    Py_ssize_t count; // rings in rings[]
+    struct ring_buffer **rings;
+    unsigned long hits; // acquires served from the cache
+    unsigned long misses; // acquires that mapped a new ring
+    unsigned long recycled; // rings reset and cached when their Buffer was freed
+    unsigned long discarded; // rings unmapped as the cache was full or they were resized
+} BufferPool;
+
+/* Map a new ring of the pool's order. */
+static struct ring_buffer *
+BufferPool_map(BufferPool *self)
+{
+    struct ring_buffer_options options = RING_BUFFER_DEFAULT_OPTIONS;
+    struct ring_buffer *ring;
+
+    if (posix_memalign((void **)&ring, RING_BUFFER_CACHE_LINE_BYTES, sizeof *ring)) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+    memset (ring, 0, sizeof *ring);
+    if (ring_buffer_create_with_options (ring, self->order, &options)) {
+        free (ring);
+        PyErr_SetFromErrno(PyExc_OSError);
         return NULL;
     }
+    return ring;
+}
 
-    PyObject *datagram = PyString_FromStringAndSize(NULL, count_bytes);
-    ring_buffer_peek (self->buffer, PyString_AsString(datagram), count_bytes);
+static void
+BufferPool_recycle(PyObject *pool, struct ring_buffer *ring)
+{
+    BufferPool *self = (BufferPool *)pool;
 
-    return datagram;
+    if (self->count < self->max_cached && ring->count_bytes == (1UL << self->order)) {
+        ring_buffer_reset (ring);
+        self->rings[self->count++] = ring;
+        self->recycled++;
+        return;
+    }
+    ring_buffer_free (ring);
+    free (ring);
+    self->discarded++;
+}
+
+static void
+BufferPool_dealloc(BufferPool* self)
+{
+    while (self->count > 0) {
+        ring_buffer_free (self->rings[--self->count]);
+        free (self->rings[self->count]);
+    }
+    PyMem_Free (self->rings);
+    Py_TYPE(self)->tp_free ((PyObject*) self);
+}
+
+static int
+BufferPool_init(BufferPool *self, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"order", "prealloc", "max_cached", NULL};
+    Py_ssize_t prealloc = 0;
+    struct ring_buffer *ring;
+
+    self->order = 12;
+    self->max_cached = 64;
+    if ( !PyArg_ParseTupleAndKeywords(args, kwargs, "|inn", kwlist, &self->order, &prealloc,
+                                      &self->max_cached) ) {
+        return -1;
+    }
+
+    if (self->order < 12 || self->order > 40) {
+        PyErr_SetString (PyExc_ValueError, "order must be between 12 and 40");
+        return -1;
+    }
+    if (prealloc < 0 || self->max_cached < prealloc) {
+        PyErr_SetString (PyExc_ValueError, "prealloc must be between 0 and max_cached");
+        return -1;
+    }
+    if (self->rings != NULL) {
+        PyErr_SetString (PyExc_RuntimeError, "BufferPool is already initialized");
+        return -1;
+    }
+
+    self->rings = PyMem_New(struct ring_buffer *, self->max_cached ? self->max_cached : 1);
+    if (self->rings == NULL) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    while (self->count < prealloc) {
+        if ((ring = BufferPool_map(self)) == NULL)
+            return -1;
+        self->rings[self->count++] = ring;
+    }
+
+    return 0;
 }
 
 static PyObject *
-Buffer_read_piece(Buffer *self, PyObject *args, PyObject *kwargs)
+BufferPool_acquire(BufferPool *self, PyObject *args, PyObject *kwargs)
 {
-    if ( ring_buffer_eof(self->buffer) ) {
-        PyErr_SetString (InsufficientDataError, "No data in buffer");
+    static char *kwlist[] = {"overwrite", "record_format", NULL};
+    int overwrite = 0;
+    PyObject *record_format = Py_None;
+    struct ring_buffer *ring;
+    Buffer *buffer;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|iO", kwlist, &overwrite, &record_format))
+        return NULL;
+    if (self->rings == NULL) {
+        PyErr_SetString (PyExc_ValueError, "BufferPool is not initialized");
         return NULL;
     }
 
-    int bytes_available_for_read = ring_buffer_count_bytes (self->buffer);
-    PyObject *datagram;
-    if (bytes_available_for_read < self->buffer->page_size) {
-        datagram = PyString_FromStringAndSize(NULL, bytes_available_for_read);
-        ring_buffer_read (self->buffer, PyString_AsString(datagram), bytes_available_for_read);
+    if (self->count > 0) {
+        ring = self->rings[--self->count];
+        self->hits++;
     } else {
-        datagram = PyString_FromStringAndSize(NULL, self->buffer->page_size);
-        ring_buffer_read (self->buffer, PyString_AsString(datagram), bytes_available_for_read);
+        if ((ring = BufferPool_map(self)) == NULL)
+            return NULL;
+        self->misses++;
     }
 
-    return datagram;
+    buffer = (Buffer *)buffer_BufferType.tp_alloc(&buffer_BufferType, 0);
+    if (buffer == NULL) {
+        BufferPool_recycle((PyObject *)self, ring);
+        return NULL;
+    }
+    // from here on Buffer_dealloc gives the ring back
+    buffer->buffer = ring;
+    Py_INCREF(self);
+    buffer->pool = (PyObject *)self;
+    if (Buffer_alloc_locks(buffer) < 0) {
+        Py_DECREF(buffer);
+        return NULL;
+    }
+    buffer->order = buffer->min_order = self->order;
+    ring_buffer_set_overwrite (ring, overwrite);
+    if (Buffer_set_record_format(buffer, record_format, NULL) < 0) {
+        Py_DECREF(buffer);
+        return NULL;
+    }
+
+    return (PyObject *)buffer;
+}
+
+static PyObject *
+BufferPool_stats(BufferPool *self, PyObject *args, PyObject *kwargs)
+{
+    unsigned long acquires = self->hits + self->misses;
+    PyObject *stats = PyDict_New();
+
+    if (stats == NULL)
+        return NULL;
+    if (Buffer_stats_set(stats, "hits", PyLong_FromUnsignedLong (self->hits))
+        || Buffer_stats_set(stats, "misses", PyLong_FromUnsignedLong (self->misses))
+        || Buffer_stats_set(stats, "hit_rate", PyFloat_FromDouble (acquires ? (double)self->hits / acquires : 0.0))
+        || Buffer_stats_set(stats, "recycled", PyLong_FromUnsignedLong (self->recycled))
+        || Buffer_stats_set(stats, "discarded", PyLong_FromUnsignedLong (self->discarded))
+        || Buffer_stats_set(stats, "cached", PyLong_FromSsize_t (self->count))) {
+        Py_DECREF(stats);
+        return NULL;
+    }
+    return stats;
 }
 
 static Py_ssize_t
-Buffer_len(Buffer* self)
+BufferPool_len(BufferPool *self)
 {
-    return ring_buffer_count_bytes (self->buffer);
+    return self->count;
 }
 
-static PySequenceMethods Buffer_sequence_methods = {
-    Buffer_len     /* sq_length */
+static PySequenceMethods BufferPool_sequence_methods = {
+    (lenfunc)BufferPool_len,   /* sq_length */
 };
 
-static PyMemberDef Buffer_members[] = {
-    {"order", T_INT, offsetof(Buffer, order), 0,
-     "size of ring buffer represented by log2"},
+static PyMemberDef BufferPool_members[] = {
+    {"order", T_INT, offsetof(BufferPool, order), READONLY,
+     "size of the pooled buffers represented by log2"},
+    {"max_cached", T_PYSSIZET, offsetof(BufferPool, max_cached), READONLY,
+     "most rings kept for reuse; further ones are unmapped when their buffer is freed"},
     {NULL} /* Sentinel */
 };
 
-static PyMethodDef Buffer_methods[] = {
-    {"write", (PyCFunction)Buffer_write, METH_VARARGS | METH_KEYWORDS,
-     "Write a bytearray to the ring buffer"},
-    {"read", (PyCFunction)Buffer_read, METH_KEYWORDS,
-     "Read a certain amount of bytes from the buffer"},
-    {"close", (PyCFunction)Buffer_close, METH_NOARGS,
-     "Signal that the writing is done"},
-    {"eof", (PyCFunction)Buffer_eof, METH_NOARGS,
-     "Signal that end-of-file is reached"},
-    {"peek_read", (PyCFunction)Buffer_peek_read, METH_KEYWORDS,
-     "Read data without advancing the read pointer"},
-    {"read_piece", (PyCFunction)Buffer_read_piece, METH_NOARGS,
-     "Read a piece of buffer data efficiently"},
+static PyMethodDef BufferPool_methods[] = {
+    {"acquire", (PyCFunction)BufferPool_acquire, METH_VARARGS | METH_KEYWORDS,
+     "Return an empty Buffer on a cached ring; the ring comes back when the Buffer is freed"},
+    {"stats", (PyCFunction)BufferPool_stats, METH_NOARGS,
+     "Return a dict of hits, misses, hit_rate, recycled, discarded and cached"},
     {NULL} /* Sentinel */
 };
 
-static PyTypeObject buffer_BufferType = {
-    PyObject_HEAD_INIT(NULL)
-    0,                         /*ob_size: always set this to zero; retained for historical reason*/
-    "ring_buffer.Buffer",           /*tp_name: textual representation and show up in error messages*/
-    sizeof(Buffer),            /*tp_basicsize: how much to allocate when PyObject_New() is called*/
+static PyTypeObject buffer_BufferPoolType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "ring_buffer.BufferPool",  /*tp_name*/
+    sizeof(BufferPool),        /*tp_basicsize*/
     0,                         /*tp_itemsize*/
-    (destructor)Buffer_dealloc,/*tp_dealloc*/
-    0,                         /*tp_print*/
+    (destructor)BufferPool_dealloc, /*tp_dealloc*/
+    0,                         /*tp_vectorcall_offset*/
     0,                         /*tp_getattr*/
     0,                         /*tp_setattr*/
-    0,                         /*tp_compare*/
+    0,                         /*tp_as_async*/
     0,                         /*tp_repr*/
     0,                         /*tp_as_number*/
-    &Buffer_sequence_methods,    /*tp_as_sequence*/
+    &BufferPool_sequence_methods, /*tp_as_sequence*/
     0,                         /*tp_as_mapping*/
     0,                         /*tp_hash */
     0,                         /*tp_call*/
@@ -211,65 +3598,222 @@ static PyTypeObject buffer_BufferType = {
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
     Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
-    "ring_buffer.Buffer objects",          /* tp_doc */
+    "ring_buffer.BufferPool objects: premapped buffers of one order, reused across connections", /* tp_doc */
     0,                         /* tp_traverse */
     0,                         /* tp_clear */
     0,                         /* tp_richcompare */
     0,                         /* tp_weaklistoffset */
     0,                         /* tp_iter */
     0,                         /* tp_iternext */
-    Buffer_methods,            /* tp_methods */
-    Buffer_members,            /* tp_members */
+    BufferPool_methods,        /* tp_methods */
+    BufferPool_members,        /* tp_members */
     0,                         /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
     0,                         /* tp_descr_set */
     0,                         /* tp_dictoffset */
-    (initproc)Buffer_init,     /* tp_init */
+    (initproc)BufferPool_init, /* tp_init */
     0,                         /* tp_alloc */
-    Buffer_new,                /* tp_new */
+    0,                         /* tp_new */
 };
 
+static PyObject *
+unlink_shared(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    const char *name;
+    static char *kwlist[] = {"name", NULL};
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s", kwlist, &name))
+        return NULL;
+
+    if (ring_buffer_unlink (name)) {
+        PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *)name);
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+poll_completions(PyObject *module, PyObject *args, PyObject *kwargs)
+{
+    static char *kwlist[] = {"timeout", "max_completions", NULL};
+    struct ring_buffer_io_completion completions[256];
+    PyObject *timeout = NULL, *result, *completion;
+    int max_completions = 256, count, i, saved_errno;
+    double seconds = 0.0;
+    long timeout_ns = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Oi", kwlist, &timeout, &max_completions))
+        return NULL;
+    if (timeout == Py_None) {
+        timeout_ns = -1;
+    } else if (timeout != NULL) {
+        seconds = PyFloat_AsDouble(timeout);
+        if (seconds == -1.0 && PyErr_Occurred())
+            return NULL;
+        if (seconds < 0) {
+            PyErr_SetString (PyExc_ValueError, "timeout must be non-negative");
+            return NULL;
+        }
+        // inf, or anything past LONG_MAX nanoseconds, waits LONG_MAX
+        timeout_ns = seconds * 1e9 < LONG_MAX ? (long)(seconds * 1e9) : LONG_MAX;
+    }
+    if (max_completions < 1 || max_completions > 256) {
+        PyErr_SetString (PyExc_ValueError, "max_completions must be between 1 and 256");
+        return NULL;
+    }
+    if (Buffer_io_engine() == NULL)
+        return NULL;
+
+    Buffer_lock(io_lock);
+    Py_BEGIN_ALLOW_THREADS
+    count = ring_buffer_io_poll (buffer_io, completions, max_completions, timeout_ns);
+    saved_errno = errno;
+    Py_END_ALLOW_THREADS
+    Buffer_unlock(io_lock);
+
+    if (count < 0 && saved_errno == EINTR)
+        return PyErr_CheckSignals() ? NULL : PyList_New(0);
+    if (count < 0) {
+        errno = saved_errno;
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+
+    result = PyList_New(count);
+    for (i = 0; i < count; i++) {
+        // the reference taken at submit time passes to the tuple
+        completion = result ? Py_BuildValue("(Nsil)", (PyObject *)completions[i].user_data,
+                                            completions[i].op == RING_BUFFER_IO_RECV ? "recv" : "send",
+                                            completions[i].fd, completions[i].result) : NULL;
+        if (completion == NULL) {
+            Py_DECREF((PyObject *)completions[i].user_data);
+            Py_CLEAR(result);
+            continue;
+        }
+        PyList_SET_ITEM(result, i, completion);
+    }
+    return result;
+}
+
+static PyObject *
+io_backend(PyObject *module, PyObject *args)
+{
+    if (Buffer_io_engine() == NULL)
+        return NULL;
+    return PyUnicode_FromString (ring_buffer_io_uses_uring (buffer_io) ? "io_uring" : "poll");
+}
 
 static PyMethodDef module_methods[] = {
+    {"unlink_shared", (PyCFunction)unlink_shared, METH_VARARGS | METH_KEYWORDS,
+     "Remove the name of a shared buffer, attached buffers stay usable"},
+    {"poll_completions", (PyCFunction)poll_completions, METH_VARARGS | METH_KEYWORDS,
+     "Submit the queued recvs and sends and return a list of (buffer, 'recv' or 'send', fd, result) "
+     "for those that finished, waiting up to timeout seconds (None: until one does) if none did"},
+    {"io_backend", (PyCFunction)io_backend, METH_NOARGS,
+     "Return 'io_uring', or 'poll' where the kernel refuses io_uring"},
     {NULL}
 };
 
 
-#ifndef PyMODINIT_FUNC  /* declarations for DLL import/export */
-# define PyMODINIT_FUNC void
-#endif
-PyMODINIT_FUNC
-initring_buffer(void)
+/* Multi-phase init: ready the types and fill in the module object the import system
+ * created, see PEP 489.
+ */
+static int
+ring_buffer_exec(PyObject *m)
 {
-    PyObject* m;
-    PyObject* mod_bytearray_fifo;
-
-
     buffer_BufferType.tp_new = PyType_GenericNew;
     if (PyType_Ready(&buffer_BufferType) < 0)
-        return;
+        return -1;
 
-    m = Py_InitModule3("ring_buffer", module_methods,
-                       "a ring buffer extension type.");
-    if (m == NULL)
-        return;
+    if (PyType_Ready(&buffer_ReaderType) < 0)
+        return -1;
 
-    InsufficientDataError = PyErr_NewExceptionWithDoc(
-            "ring_buffer.InsufficientDataError",
-            "Not enough data to read from",
-            NULL,
-            NULL);
+    if (PyType_Ready(&buffer_ObjectWriterType) < 0)
+        return -1;
+
+    buffer_MPMCQueueType.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&buffer_MPMCQueueType) < 0)
+        return -1;
+
+    buffer_BufferPoolType.tp_new = PyType_GenericNew;
+    if (PyType_Ready(&buffer_BufferPoolType) < 0)
+        return -1;
+
+    // the exceptions outlive any one module object, like the static types
+    if (InsufficientDataError == NULL) {
+        InsufficientDataError = PyErr_NewExceptionWithDoc(
+                "ring_buffer.InsufficientDataError",
+                "Not enough data to read from",
+                NULL,
+                NULL);
+        if (InsufficientDataError == NULL)
+            return -1;
+    }
     Py_INCREF(InsufficientDataError);
-    PyModule_AddObject(m, "InsufficientDataError", InsufficientDataError);
+    if (PyModule_AddObject(m, "InsufficientDataError", InsufficientDataError) < 0) {
+        Py_DECREF(InsufficientDataError);
+        return -1;
+    }
 
-    FullError = PyErr_NewExceptionWithDoc(
-            "ring_buffer.FullError",
-            "Not enough free space to write to",
-            NULL,
-            NULL);
+    if (FullError == NULL) {
+        FullError = PyErr_NewExceptionWithDoc(
+                "ring_buffer.FullError",
+                "Not enough free space to write to",
+                NULL,
+                NULL);
+        if (FullError == NULL)
+            return -1;
+    }
+    Py_INCREF(FullError);
+    if (PyModule_AddObject(m, "FullError", FullError) < 0) {
+        Py_DECREF(FullError);
+        return -1;
+    }
 
     Py_INCREF(&buffer_BufferType);
-    PyModule_AddObject(m, "Buffer", (PyObject *)&buffer_BufferType);
+    if (PyModule_AddObject(m, "Buffer", (PyObject *)&buffer_BufferType) < 0) {
+        Py_DECREF(&buffer_BufferType);
+        return -1;
+    }
+
+    Py_INCREF(&buffer_ReaderType);
+    if (PyModule_AddObject(m, "Reader", (PyObject *)&buffer_ReaderType) < 0) {
+        Py_DECREF(&buffer_ReaderType);
+        return -1;
+    }
+
+    Py_INCREF(&buffer_MPMCQueueType);
+    if (PyModule_AddObject(m, "MPMCQueue", (PyObject *)&buffer_MPMCQueueType) < 0) {
+        Py_DECREF(&buffer_MPMCQueueType);
+        return -1;
+    }
+
+    Py_INCREF(&buffer_BufferPoolType);
+    if (PyModule_AddObject(m, "BufferPool", (PyObject *)&buffer_BufferPoolType) < 0) {
+        Py_DECREF(&buffer_BufferPoolType);
+        return -1;
+    }
+    return 0;
+}
+
+static PyModuleDef_Slot ring_buffer_slots[] = {
+    {Py_mod_exec, ring_buffer_exec},
+    {0, NULL}
+};
+
+static struct PyModuleDef ring_buffer_module = {
+    PyModuleDef_HEAD_INIT,
+    "ring_buffer",                   /* m_name */
+    "a ring buffer extension type.", /* m_doc */
+    0,                               /* m_size */
+    module_methods,                  /* m_methods */
+    ring_buffer_slots,               /* m_slots */
+};
+
+PyMODINIT_FUNC
+PyInit_ring_buffer(void)
+{
+    return PyModuleDef_Init(&ring_buffer_module);
 }